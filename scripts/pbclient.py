@@ -0,0 +1,478 @@
+#!/usr/bin/env python3
+"""Pipelined asyncio client for the power board serial protocol
+
+Commands are written as soon as they are issued, up to a window of
+outstanding commands, and responses are matched to commands in the order
+they were sent. With tagged=True each command carries a tag that the board
+echoes, so a lost response only fails its own command instead of shifting
+every response after it.
+
+Once enabled with set_events(True), the board also sends unsolicited event
+lines starting with '!', these are passed to the on_event callback.
+
+    async with await PowerBoard.open('/dev/ttyACM0') as pb:
+        volts, amps = await asyncio.gather(pb.battery_voltage(), pb.battery_current())
+"""
+import os
+import sys
+import tty
+import stat
+import socket
+import time
+import asyncio
+import argparse
+from collections import deque, namedtuple
+from typing import Dict, Iterable, List, Optional, Tuple
+
+BOARD_VID = '1bda'
+BOARD_PID = '0010'
+# Samples in a scope capture
+SCOPE_LEN = 256
+
+
+Identity = namedtuple('Identity', ['manufacturer', 'board', 'asset_tag', 'version'])
+Status = namedtuple('Status', ['overcurrent', 'temperature', 'fan', 'reg_voltage'])
+StartButton = namedtuple('StartButton', ['internal', 'external'])
+Note = namedtuple('Note', ['frequency', 'remaining'])
+BatteryEstimate = namedtuple('BatteryEstimate', ['ocv', 'soc', 'rint', 'runtime'])
+SpectrumState = namedtuple('SpectrumState', ['state', 'source', 'interval', 'blocks'])
+Spectrum = namedtuple('Spectrum', ['timestamp', 'mean', 'peaks', 'rms', 'bands'])
+RollupBucket = namedtuple('RollupBucket', ['timestamp', 'min', 'mean', 'max'])
+ScopeState = namedtuple('ScopeState', ['state', 'source', 'pre_trigger', 'trigger_time', 'interval'])
+SequenceProgress = namedtuple('SequenceProgress', ['playing', 'started', 'length', 'loops'])
+Event = namedtuple('Event', ['name', 'arg', 'timestamp'])
+DelayCoeffs = namedtuple('DelayCoeffs', ['adc_oc', 'batt_oc', 'reg_oc', 'uvlo', 'neg_batt_oc'])
+
+
+class BoardError(Exception):
+    "The board rejected a command with a NACK"
+    def __init__(self, command, reason):
+        super().__init__(f"{command}: {reason}")
+        self.command = command
+        self.reason = reason
+
+
+class OutputTripped(BoardError):
+    "An output that has had an overcurrent was turned on, see clear_output()"
+
+
+def parse_event(line: str) -> Event:
+    "Parse an event line, !<name>:<arg>:<timestamp>"
+    name, arg, timestamp = line[1:].split(':')
+    return Event(name, int(arg), int(timestamp))
+
+
+def find_port():
+    "Find the serial port of the first attached power board"
+    from serial.tools import list_ports
+
+    for port in list_ports.grep(f'{BOARD_VID}:{BOARD_PID}'):
+        return port.device
+    raise FileNotFoundError("No power board found")
+
+
+class PowerBoard:
+    def __init__(self, fd, window=8, timeout=1.0, tagged=False, on_event=None):
+        self._fd = fd
+        self.on_event = on_event
+        self._window = asyncio.Semaphore(window)
+        self._timeout = timeout
+        self._tagged = tagged
+        self._next_tag = 0
+        self._pending = deque()
+        self._tagged_pending: Dict[str, asyncio.Future] = {}
+        self._rx_buf = b''
+        self._tx_buf = b''
+        self._loop = asyncio.get_running_loop()
+        self._loop.add_reader(fd, self._on_readable)
+
+    @classmethod
+    async def open(cls, port=None, **kwargs):
+        "Open the board's serial port, finding the board if no port is given"
+        if port is None:
+            port = find_port()
+        if stat.S_ISSOCK(os.stat(port).st_mode):
+            # Shared through pbmux.py
+            sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            sock.connect(port)
+            sock.setblocking(False)
+            return cls(sock.detach(), **kwargs)
+        fd = os.open(port, os.O_RDWR | os.O_NOCTTY | os.O_NONBLOCK)
+        tty.setraw(fd)
+        return cls(fd, **kwargs)
+
+    async def __aenter__(self):
+        return self
+
+    async def __aexit__(self, *exc):
+        self.close()
+
+    def close(self):
+        if self._fd is None:
+            return
+        self._loop.remove_reader(self._fd)
+        if self._tx_buf:
+            self._loop.remove_writer(self._fd)
+        os.close(self._fd)
+        self._fd = None
+        for fut in (*self._pending, *self._tagged_pending.values()):
+            if not fut.done():
+                fut.set_exception(ConnectionError("Port closed"))
+        self._pending.clear()
+        self._tagged_pending.clear()
+
+    def _on_readable(self):
+        try:
+            data = os.read(self._fd, 4096)
+        except BlockingIOError:
+            return
+        if not data:
+            self.close()
+            return
+        self._rx_buf += data
+        *lines, self._rx_buf = self._rx_buf.split(b'\n')
+        for line in lines:
+            line = line.rstrip(b'\r').decode('ascii', 'replace')
+            if line.startswith('!'):
+                if self.on_event is not None:
+                    self.on_event(parse_event(line))
+                continue
+            if line.startswith('#'):
+                tag, _, line = line.partition(' ')
+                fut = self._tagged_pending.pop(tag, None)
+            elif self._pending:
+                fut = self._pending.popleft()
+            else:
+                fut = None
+            # a command that timed out still takes its response from the queue
+            if fut is not None and not fut.done():
+                fut.set_result(line)
+
+    def _write(self, data):
+        if not self._tx_buf:
+            try:
+                data = data[os.write(self._fd, data):]
+            except BlockingIOError:
+                pass
+            if data:
+                self._loop.add_writer(self._fd, self._on_writable)
+        self._tx_buf += data
+
+    def _on_writable(self):
+        try:
+            sent = os.write(self._fd, self._tx_buf)
+        except BlockingIOError:
+            return
+        self._tx_buf = self._tx_buf[sent:]
+        if not self._tx_buf:
+            self._loop.remove_writer(self._fd)
+
+    async def query(self, command: str) -> str:
+        "Send a command and return its response, raising BoardError on a NACK"
+        if self._fd is None:
+            raise ConnectionError("Port closed")
+        async with self._window:
+            fut = self._loop.create_future()
+            if self._tagged:
+                tag = f'#{self._next_tag}'
+                self._next_tag = (self._next_tag + 1) % 65536
+                self._tagged_pending[tag] = fut
+                self._write(f'{tag} {command}\n'.encode('ascii'))
+            else:
+                self._pending.append(fut)
+                self._write(command.encode('ascii') + b'\n')
+            try:
+                response = await asyncio.wait_for(asyncio.shield(fut), self._timeout)
+            except asyncio.TimeoutError:
+                if self._tagged:
+                    # A late response is dropped once its tag is forgotten
+                    self._tagged_pending.pop(tag, None)
+                else:
+                    # The response may still arrive, it stays queued to keep the order
+                    fut.add_done_callback(lambda f: f.cancelled() or f.exception())
+                raise
+        if response.startswith('NACK'):
+            reason = response[5:]
+            # In a batch the reason follows the failing command's index
+            if reason.rpartition(':')[2] == 'Output tripped':
+                raise OutputTripped(command, reason)
+            raise BoardError(command, reason)
+        return response
+
+    async def command(self, command: str) -> None:
+        "Send a command that is expected to be acknowledged"
+        response = await self.query(command)
+        if response != 'ACK':
+            raise BoardError(command, f"Unexpected response {response!r}")
+
+    async def batch(self, commands: List[str]) -> List[str]:
+        """Run several commands as one batch, returning their responses
+
+        None of the commands are run if any of them is invalid, the BoardError
+        reason then starts with the index of the failing command.
+        """
+        response = await self.query(';'.join(commands))
+        return response.split(';')
+
+    async def identify(self) -> Identity:
+        return Identity(*(await self.query('*IDN?')).split(':', 3))
+
+    async def status(self) -> Status:
+        overcurrent, temp, fan, reg_voltage = (await self.query('*STATUS?')).split(':')
+        return Status(
+            [x == '1' for x in overcurrent.split(',')],
+            int(temp),
+            fan == '1',
+            int(reg_voltage),
+        )
+
+    async def reset(self) -> None:
+        await self.command('*RESET')
+
+    async def start_button(self) -> StartButton:
+        internal, external = (await self.query('BTN:START:GET?')).split(':')
+        return StartButton(internal == '1', external == '1')
+
+    async def set_output(self, output: int, state: bool) -> None:
+        "Raises OutputTripped turning on an output that has had an overcurrent"
+        await self.command(f'OUT:{output}:SET:{int(state)}')
+
+    async def clear_output(self, output: int) -> None:
+        "Clear an output's overcurrent trip and retries, leaving it off"
+        await self.command(f'OUT:{output}:CLEAR')
+
+    async def get_output(self, output: int) -> bool:
+        return await self.query(f'OUT:{output}:GET?') == '1'
+
+    async def output_current(self, output: int) -> int:
+        "Output current in mA"
+        return int(await self.query(f'OUT:{output}:I?'))
+
+    async def battery_voltage(self) -> int:
+        "Battery voltage in mV"
+        return int(await self.query('BATT:V?'))
+
+    async def battery_current(self) -> int:
+        "Battery current in mA"
+        return int(await self.query('BATT:I?'))
+
+    async def battery_estimate(self) -> BatteryEstimate:
+        "Open-circuit voltage, state of charge, internal resistance and runtime in minutes"
+        ocv, soc, rint, runtime = (await self.query('BATT:EST?')).split(':')
+        return BatteryEstimate(int(ocv), int(soc), int(rint), None if runtime == '-1' else int(runtime))
+
+    async def arm_scope(self, source, threshold: int, pre_trigger: Optional[int] = None) -> None:
+        "Capture the current of an output, or 'BATT', around it rising through threshold mA"
+        command = f'SCOPE:ARM:{source}:{threshold}'
+        if pre_trigger is not None:
+            command += f':{pre_trigger}'
+        await self.command(command)
+
+    async def scope_state(self) -> ScopeState:
+        state, source, pre_trigger, trigger_time, interval = (await self.query('SCOPE:GET?')).split(':')
+        return ScopeState(state, source, int(pre_trigger), int(trigger_time), int(interval))
+
+    async def read_scope(self) -> List[int]:
+        "Download a finished capture, in mA, oldest first"
+        samples: List[int] = []
+        # The requests are pipelined, each response has up to 31 samples
+        chunks = await asyncio.gather(*(
+            self.query(f'SCOPE:DATA?:{offset}') for offset in range(0, SCOPE_LEN, 31)))
+        for chunk in chunks:
+            samples.extend(int(chunk[i:i + 4], 16) for i in range(0, len(chunk), 4))
+        return samples
+
+    async def start_spectrum(self, source, decimate: int = 1) -> None:
+        "Analyse the current of an output, or 'BATT', averaging decimate samples into each"
+        await self.command(f'SPEC:START:{source}:{decimate}')
+
+    async def spectrum_state(self) -> SpectrumState:
+        state, source, interval, blocks = (await self.query('SPEC:GET?')).split(':')
+        return SpectrumState(state, source, int(interval), int(blocks))
+
+    async def spectrum(self) -> Spectrum:
+        "The latest block's peaks, as (Hz, mA amplitude) largest first, and rms per band"
+        peak_values = [int(v) for v in (await self.query('SPEC:PEAK?')).split(':')]
+        band_values = [int(v) for v in (await self.query('SPEC:BAND?')).split(':')]
+        peaks = [(peak_values[i] / 100, peak_values[i + 1])
+                 for i in range(2, len(peak_values), 2) if peak_values[i + 1] != 0]
+        # The two responses may come from different blocks, the timestamp is from the bands
+        return Spectrum(band_values[0], peak_values[1], peaks, band_values[1], band_values[2:])
+
+    async def read_rollup(self, tier: int, channel: int) -> List[RollupBucket]:
+        "The buckets of history held in a tier for a channel, oldest first"
+        written, interval, length = (int(v) for v in (await self.query(f'ROLL:GET?:{tier}')).split(':'))
+        buckets: List[RollupBucket] = []
+        seq = max(0, written - length + 1)  # the oldest may be replaced as we read
+        while seq < written:
+            try:
+                timestamp, data = (await self.query(f'ROLL:DATA?:{tier}:{channel}:{seq}')).split(':')
+            except BoardError:
+                seq += 1
+                continue
+            values = [int(data[i:i + 4], 16) for i in range(0, len(data), 4)]
+            # The values are signed 16 bit
+            values = [v - 0x10000 if v & 0x8000 else v for v in values]
+            for i in range(0, len(values), 3):
+                buckets.append(RollupBucket(int(timestamp) + (i // 3) * interval, *values[i:i + 3]))
+            seq += len(values) // 3
+        return buckets
+
+    async def current_budget(self) -> Tuple[int, List[int]]:
+        "Available current in mA, and the expected draw of each output"
+        available, draws = (await self.query('BATT:BUDGET?')).split(':')
+        return int(available), [int(d) for d in draws.split(',')]
+
+    async def set_led(self, led: str, value: str) -> None:
+        "Set the RUN or ERR LED to 0, 1 or F (flash)"
+        await self.command(f'LED:{led}:SET:{value}')
+
+    async def get_led(self, led: str) -> str:
+        return await self.query(f'LED:{led}:GET?')
+
+    async def set_led_pattern(self, led: str, period: int, on_time: int, count: int = 0, gap: int = 0) -> None:
+        "Blink the RUN or ERR LED, giving count flashes then a gap if count is set"
+        command = f'LED:{led}:PAT:{period}:{on_time}'
+        if count:
+            command += f':{count}:{gap}'
+        await self.command(command)
+
+    async def play_note(self, frequency: int, duration: int) -> None:
+        "Play a note of frequency Hz for duration ms"
+        await self.command(f'NOTE:{frequency}:{duration}')
+
+    async def get_note(self) -> Note:
+        frequency, remaining = (await self.query('NOTE:GET?')).split(':')
+        return Note(int(frequency), int(remaining))
+
+    async def play_sequence(self, notes: Iterable[Tuple[int, int, int]], loop: bool = False) -> None:
+        "Replace the buzzer sequence with (frequency, duration, rest) notes and play it"
+        notes = list(notes)
+        commands = ['NOTE:SEQ:CLEAR']
+        # Keep each line well within the board's limit
+        for i in range(0, len(notes), 6):
+            commands.append('NOTE:SEQ:ADD:' + ':'.join(f'{f}:{d}:{r}' for f, d, r in notes[i:i + 6]))
+        for command in commands:
+            await self.command(command)
+        await self.command('NOTE:SEQ:LOOP' if loop else 'NOTE:SEQ:PLAY')
+
+    async def get_sequence(self) -> SequenceProgress:
+        playing, started, length, loops = (await self.query('NOTE:SEQ:GET?')).split(':')
+        return SequenceProgress(playing == '1', int(started), int(length), int(loops))
+
+    async def set_fan_override(self, state: bool) -> None:
+        await self.command(f'*SYS:FAN:SET:{int(state)}')
+
+    async def set_brain(self, state: bool) -> None:
+        await self.command(f'*SYS:BRAIN:SET:{int(state)}')
+
+    async def set_delay_coeffs(self, coeffs: DelayCoeffs) -> None:
+        await self.command('*SYS:DELAY_COEFF:SET:' + ':'.join(str(x) for x in coeffs))
+
+    async def set_events(self, state: bool) -> None:
+        "Enable or disable unsolicited event lines"
+        await self.command(f'EVT:SET:{int(state)}')
+
+    async def get_events(self) -> Tuple[bool, int]:
+        "Whether events are enabled and how many have been dropped"
+        enabled, dropped = (await self.query('EVT:GET?')).split(':')
+        return enabled == '1', int(dropped)
+
+    async def get_delay_coeffs(self) -> DelayCoeffs:
+        return DelayCoeffs(*(int(x) for x in (await self.query('*SYS:DELAY_COEFF:GET?')).split(':')))
+
+
+# Read-only commands, so the benchmark doesn't disturb the board's state
+BENCH_COMMANDS = [
+    '*IDN?',
+    '*STATUS?',
+    'BTN:START:GET?',
+    'OUT:0:GET?',
+    'OUT:0:I?',
+    'BATT:V?',
+    'BATT:I?',
+    'LED:RUN:GET?',
+    'NOTE:GET?',
+    '*SYS:DELAY_COEFF:GET?',
+]
+
+
+def percentile(samples: List[float], pct: float) -> float:
+    ordered = sorted(samples)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * pct / 100))]
+
+
+async def bench_command(pb: PowerBoard, command: str, count: int, window: int) -> Tuple[List[float], float, int]:
+    "Issue count copies of command, window at a time, returning latencies and the elapsed time"
+    in_flight = asyncio.Semaphore(window)
+    latencies = []
+    errors = 0
+
+    async def timed():
+        nonlocal errors
+        async with in_flight:
+            # Time from the command being written, not from when it was queued
+            start = time.perf_counter()
+            try:
+                await pb.query(command)
+            except (BoardError, asyncio.TimeoutError):
+                errors += 1
+                return
+            latencies.append(time.perf_counter() - start)
+
+    start = time.perf_counter()
+    await asyncio.gather(*(timed() for _ in range(count)))
+    return latencies, time.perf_counter() - start, errors
+
+
+async def bench(port: Optional[str], commands: List[str], count: int, window: int, timeout: float, tagged: bool) -> None:
+    async with await PowerBoard.open(port, window=window, timeout=timeout, tagged=tagged) as pb:
+        print(f"{'command':<24}{'p50 ms':>10}{'p99 ms':>10}{'cmd/s':>10}{'errors':>8}")
+        for command in commands:
+            latencies, elapsed, errors = await bench_command(pb, command, count, window)
+            if latencies:
+                p50 = f'{percentile(latencies, 50) * 1000:.2f}'
+                p99 = f'{percentile(latencies, 99) * 1000:.2f}'
+            else:
+                p50 = p99 = '-'
+            print(f"{command:<24}{p50:>10}{p99:>10}{len(latencies) / elapsed:>10.0f}{errors:>8}")
+
+
+async def send(port: Optional[str], commands: List[str], timeout: float, tagged: bool) -> None:
+    async with await PowerBoard.open(port, timeout=timeout, tagged=tagged) as pb:
+        results = await asyncio.gather(*(pb.query(c) for c in commands), return_exceptions=True)
+        for command, result in zip(commands, results):
+            print(f"{command} -> {result}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--port', default=None, help="Serial port of the board or pbmux socket, found by USB ID if omitted")
+    parser.add_argument('--timeout', type=float, default=1.0, help="Seconds to wait for each response")
+    parser.add_argument('--tagged', action='store_true', help="Match responses to commands by tag rather than order")
+    subparsers = parser.add_subparsers(dest='action', required=True)
+
+    send_parser = subparsers.add_parser('send', help="Send commands and print the responses")
+    send_parser.add_argument('commands', nargs='+')
+
+    bench_parser = subparsers.add_parser('bench', help="Measure round-trip latency and throughput")
+    bench_parser.add_argument('-n', '--count', type=int, default=1000, help="Repetitions of each command")
+    bench_parser.add_argument('-w', '--window', type=int, default=8, help="Commands in flight at once")
+    bench_parser.add_argument('commands', nargs='*', default=BENCH_COMMANDS)
+
+    args = parser.parse_args()
+
+    try:
+        if args.action == 'send':
+            asyncio.run(send(args.port, args.commands, args.timeout, args.tagged))
+        else:
+            asyncio.run(bench(args.port, args.commands, args.count, args.window, args.timeout, args.tagged))
+    except (OSError, FileNotFoundError) as e:
+        print(e, file=sys.stderr)
+        sys.exit(1)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,166 @@
+#!/usr/bin/env python3
+"""Share one power board between several local processes
+
+The daemon owns the board's serial port and serves the same line protocol on
+a Unix socket, so any number of clients can connect at once. Each client's
+responses are returned in the order it sent its commands.
+
+Identical queries that are waiting for the board at the same time, for
+example several loggers polling BATT:V?, are sent to the board once and the
+response is given to all of them. Commands that change the board's state are
+sent ahead of queued queries, so control isn't held up behind telemetry. A
+query that must observe the effect of a command should be sent after the
+command's response has been received.
+
+Event lines sent by the board, once enabled with EVT:SET:1, are passed on to
+every client.
+"""
+import os
+import sys
+import asyncio
+import argparse
+from typing import Dict, Optional, Set
+
+from pbclient import PowerBoard, BoardError, Event
+
+DEFAULT_SOCKET = os.path.join(os.environ.get('XDG_RUNTIME_DIR', '/tmp'), 'pbmux.sock')
+
+
+def is_query(command: str) -> bool:
+    return all(c.endswith('?') for c in command.split(';'))
+
+
+class Mux:
+    def __init__(self, board: PowerBoard, window: int):
+        self.board = board
+        self.window = window
+        self._control = asyncio.Queue()
+        self._queries = asyncio.Queue()
+        self._ready = asyncio.Event()
+        # Queries that are waiting for the board, by command
+        self._shared: Dict[str, asyncio.Future] = {}
+        self._clients: Set[asyncio.StreamWriter] = set()
+        self.stats = {'sent': 0, 'coalesced': 0}
+
+    def submit(self, command: str) -> asyncio.Future:
+        if is_query(command):
+            fut = self._shared.get(command)
+            if fut is not None:
+                self.stats['coalesced'] += 1
+                return fut
+            fut = asyncio.get_running_loop().create_future()
+            self._shared[command] = fut
+            self._queries.put_nowait((command, fut))
+        else:
+            fut = asyncio.get_running_loop().create_future()
+            self._control.put_nowait((command, fut))
+            # Later queries must not share a response from before this command
+            self._shared.clear()
+        self._ready.set()
+        return fut
+
+    async def _next(self):
+        while True:
+            for queue in (self._control, self._queries):
+                if not queue.empty():
+                    return queue.get_nowait()
+            self._ready.clear()
+            await self._ready.wait()
+
+    async def _worker(self):
+        while True:
+            command, fut = await self._next()
+            if self._shared.get(command) is fut:
+                # This query is being sent, later ones must ask again
+                del self._shared[command]
+            self.stats['sent'] += 1
+            try:
+                response = await self.board.query(command)
+            except BoardError as e:
+                response = f'NACK:{e.reason}'
+            except asyncio.TimeoutError:
+                response = 'NACK:Board timed out'
+            except ConnectionError:
+                response = 'NACK:Board disconnected'
+            if not fut.done():
+                fut.set_result(response)
+
+    def broadcast_event(self, event: Event) -> None:
+        line = f'!{event.name}:{event.arg}:{event.timestamp}\n'.encode('ascii')
+        for writer in self._clients:
+            writer.write(line)
+
+    async def run(self):
+        # Each worker keeps one command in flight, filling the board's window
+        await asyncio.gather(*(self._worker() for _ in range(self.window)))
+
+    async def handle_client(self, reader: asyncio.StreamReader, writer: asyncio.StreamWriter):
+        responses = asyncio.Queue()
+
+        async def reply():
+            while True:
+                fut = await responses.get()
+                if fut is None:
+                    break
+                writer.write((await fut).encode('ascii') + b'\n')
+                await writer.drain()
+
+        replier = asyncio.ensure_future(reply())
+        self._clients.add(writer)
+        try:
+            while True:
+                line = await reader.readline()
+                if not line:
+                    break
+                command = line.decode('ascii', 'replace').strip()
+                if command:
+                    responses.put_nowait(self.submit(command))
+            responses.put_nowait(None)
+            await replier
+        except (ConnectionError, asyncio.CancelledError):
+            replier.cancel()
+        finally:
+            self._clients.discard(writer)
+            writer.close()
+
+
+async def serve(port: Optional[str], socket_path: str, window: int, timeout: float, tagged: bool) -> None:
+    board = await PowerBoard.open(port, window=window, timeout=timeout, tagged=tagged)
+    mux = Mux(board, window)
+    board.on_event = mux.broadcast_event
+
+    if os.path.exists(socket_path):
+        os.unlink(socket_path)
+    server = await asyncio.start_unix_server(mux.handle_client, path=socket_path)
+    print(f"Serving {port or 'power board'} on {socket_path}", flush=True)
+
+    try:
+        await mux.run()
+    finally:
+        server.close()
+        board.close()
+        os.unlink(socket_path)
+        print(f"Sent {mux.stats['sent']} commands, coalesced {mux.stats['coalesced']} queries")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--port', default=None, help="Serial port of the board, found by USB ID if omitted")
+    parser.add_argument('--socket', default=DEFAULT_SOCKET, help=f"Path to serve on, default {DEFAULT_SOCKET}")
+    parser.add_argument('-w', '--window', type=int, default=8, help="Commands in flight to the board at once")
+    parser.add_argument('--timeout', type=float, default=1.0, help="Seconds to wait for each response")
+    parser.add_argument('--tagged', action='store_true', help="Tag commands sent to the board, needs firmware support")
+
+    args = parser.parse_args()
+
+    try:
+        asyncio.run(serve(args.port, args.socket, args.window, args.timeout, args.tagged))
+    except (OSError, FileNotFoundError) as e:
+        print(e, file=sys.stderr)
+        sys.exit(1)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,137 @@
+// Runs the firmware against the simulated hardware, serving the USB serial
+// protocol on a pseudo-terminal
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libopencm3/stm32/iwdg.h>
+
+#include "sim.h"
+#include "../src/cdcacm.h"
+
+static void usage(const char* name) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -l '<target> <model> [a] [b] [period]'  apply a load model, may be repeated\n"
+        "  -s <file>    script of '<time ms> <target> <model> [a] [b] [period]' lines\n"
+        "  -f <file>    schedule of faults to inject, see faultsim -h\n"
+        "  -L <path>    create a symlink to the pseudo-terminal\n"
+        "  -x <speed>   simulation speed relative to real time, 0 runs unpaced\n"
+        "  -d <ms>      exit after this much simulated time\n"
+        "  -t <tag>     asset tag reported by *IDN?\n"
+        "Targets: 0-5 outputs (mA), reg (mA), batt (mV), rint (mOhm), temp (C), ibatt (mA)\n"
+        "Models: const a | square a b period | ramp a b period | inrush peak steady tau | noise a spread\n",
+        name);
+}
+
+static int open_pty(const char* link_path) {
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((fd < 0) || (grantpt(fd) != 0) || (unlockpt(fd) != 0)) {
+        perror("sim: failed to create pseudo-terminal");
+        exit(1);
+    }
+
+    // Hold the client side open so the pty survives clients disconnecting,
+    // and put it in raw mode so lines pass through untouched
+    const char* client_path = ptsname(fd);
+    int client_fd = open(client_path, O_RDWR | O_NOCTTY);
+    struct termios tio;
+    if ((client_fd < 0) || (tcgetattr(client_fd, &tio) != 0)) {
+        perror("sim: failed to configure pseudo-terminal");
+        exit(1);
+    }
+    cfmakeraw(&tio);
+    tcsetattr(client_fd, TCSANOW, &tio);
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    if (link_path) {
+        unlink(link_path);
+        if (symlink(client_path, link_path) != 0) {
+            perror("sim: failed to create symlink");
+            exit(1);
+        }
+    }
+    printf("%s\n", client_path);
+    fflush(stdout);
+    return fd;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char** argv) {
+    const char* link_path = NULL;
+    const char* asset_tag = "srSIM";
+    double speed = 1.0;
+    uint64_t duration = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:s:f:L:x:d:t:h")) != -1) {
+        switch (opt) {
+            case 'l': {
+                int target;
+                sim_load_t load;
+                if (!sim_parse_load(optarg, &target, &load)) {
+                    fprintf(stderr, "sim: invalid load '%s'\n", optarg);
+                    return 1;
+                }
+                sim_set_load(target, load);
+                break;
+            }
+            case 's':
+                if (!sim_load_script(optarg)) {
+                    return 1;
+                }
+                break;
+            case 'f':
+                if (!sim_load_faults(optarg)) {
+                    return 1;
+                }
+                break;
+            case 'L': link_path = optarg; break;
+            case 'x': speed = atof(optarg); break;
+            case 'd': duration = strtoull(optarg, NULL, 10); break;
+            case 't': asset_tag = optarg; break;
+            default:
+                usage(argv[0]);
+                return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    sim_flash_init(asset_tag);
+    int fd = open_pty(link_path);
+    sim_usb_attach(fd);
+
+    sim_firmware_init();
+
+    uint64_t start = now_ns();
+    while ((duration == 0) || (sim_time_ms < duration)) {
+        sim_tick();
+
+        // Firmware main loop, if the systick handler left it any time
+        if (sim_main_loop_runs()) {
+            sim_main_loop();
+        }
+
+        if (speed > 0) {
+            // Sleep until the next tick is due, waking early if the host sends data
+            // so it is picked up at the start of the next frame
+            uint64_t due = start + (uint64_t)(sim_time_ms * 1e6 / speed);
+            uint64_t now = now_ns();
+            if (due > now) {
+                struct timespec wait = {0, (long)(due - now)};
+                nanosleep(&wait, NULL);
+            }
+        }
+    }
+    return 0;
+}
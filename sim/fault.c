@@ -0,0 +1,90 @@
+// Scheduled faults injected into the simulated hardware
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+
+#include "sim.h"
+
+#define MAX_FAULTS 64
+
+static sim_fault_t faults[MAX_FAULTS];
+static int num_faults;
+
+static const char* FAULT_NAMES[FAULT_NUM_TYPES] = {
+    [FAULT_I2C_NACK] = "i2c_nack",
+    [FAULT_I2C_BUSY] = "i2c_busy",
+    [FAULT_ADC] = "adc",
+    [FAULT_USB_STALL] = "usb_stall",
+};
+
+bool sim_parse_fault(const char* spec, sim_fault_t* fault) {
+    unsigned long long start, duration;
+    char name[16];
+    long arg = 0, value = 0;
+
+    int fields = sscanf(spec, "%llu %llu %15s %li %li", &start, &duration, name, &arg, &value);
+    if (fields < 3) {
+        return false;
+    }
+    for (int type = 0; type < FAULT_NUM_TYPES; type++) {
+        if (strcmp(name, FAULT_NAMES[type]) == 0) {
+            if ((type == FAULT_ADC) && (fields < 5)) {
+                return false;
+            }
+            *fault = (sim_fault_t){type, start, duration, arg, value};
+            return true;
+        }
+    }
+    return false;
+}
+
+bool sim_add_fault(sim_fault_t fault) {
+    if (num_faults == MAX_FAULTS) {
+        return false;
+    }
+    faults[num_faults++] = fault;
+    return true;
+}
+
+bool sim_load_faults(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+
+    char line[128];
+    int line_num = 0;
+    while (fgets(line, sizeof(line), f)) {
+        line_num++;
+        line[strcspn(line, "#\r\n")] = '\0';
+        if (strspn(line, " \t") == strlen(line)) {
+            continue;
+        }
+        sim_fault_t fault;
+        if (!sim_parse_fault(line, &fault) || !sim_add_fault(fault)) {
+            fprintf(stderr, "%s:%d: invalid fault\n", path, line_num);
+            fclose(f);
+            return false;
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+const sim_fault_t* sim_fault_active(sim_fault_type_t type, int32_t arg) {
+    // Faults are timed against the CPU's time so they can end part way through a tick
+    uint64_t now = sim_now_ns / 1000000;
+    for (int i = 0; i < num_faults; i++) {
+        const sim_fault_t* fault = &faults[i];
+        if ((fault->type != type) || (now < fault->start) || (now >= (fault->start + fault->duration))) {
+            continue;
+        }
+        if ((fault->arg == arg) || (type == FAULT_I2C_BUSY) || (type == FAULT_USB_STALL)
+            || ((type == FAULT_I2C_NACK) && (fault->arg == 0))
+            || ((type == FAULT_ADC) && (fault->arg == -1))) {
+            return fault;
+        }
+    }
+    return NULL;
+}
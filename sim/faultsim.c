@@ -0,0 +1,311 @@
+// Runs the firmware through scheduled hardware faults, measuring how long it
+// takes to recover and whether it ever stalls long enough to trip the watchdog
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <libopencm3/stm32/iwdg.h>
+
+#include "sim.h"
+#include "../src/cdcacm.h"
+#include "../src/global_vars.h"
+#include "../src/output.h"
+#include "../src/telemetry.h"
+
+#define RUN_TIME 3000
+#define IWDG_PERIOD_MS 50
+// How long after a fault ends the firmware has to be working normally again
+#define MAX_RECOVERY_MS 100
+// A blocking host resends a query if it gets no reply in this time
+#define COMMAND_TIMEOUT 50
+// Shed scenarios step their load or battery at this time, with square models
+// of a 2s period, and have this long to shed back to a safe load
+#define SHED_START 1000
+#define MAX_SHED_MS 100
+
+typedef enum {
+    CHECK_SENSORS,  // current sensor readings come back after the fault
+    CHECK_NO_TRIP,  // no output is tripped by the fault
+    CHECK_TRIP,  // the fault trips an output
+    CHECK_USB,  // commands are answered again after the fault
+    CHECK_SHED,  // outputs are shed to bring the battery back within its limits, keeping the brain
+} check_t;
+
+typedef struct {
+    const char* name;
+    const char* faults[4];
+    check_t check;
+    // Load models, each loaded output is enabled. Without any, L0 and L1 draw 1A.
+    const char* loads[10];
+} scenario_t;
+
+static const scenario_t SCENARIOS[] = {
+    {"battery sensor NACK 100ms", {"1003 100 i2c_nack 0x40"}, CHECK_SENSORS, {NULL}},
+    {"regulator sensor NACK 500ms", {"1007 500 i2c_nack 0x41"}, CHECK_SENSORS, {NULL}},
+    {"all sensors NACK 1s", {"1011 1000 i2c_nack 0"}, CHECK_SENSORS, {NULL}},
+    {"repeated NACKs", {"1019 3 i2c_nack 0", "1038 7 i2c_nack 0", "1061 30 i2c_nack 0x40"}, CHECK_SENSORS, {NULL}},
+    {"bus stuck busy 2ms", {"1019 2 i2c_busy"}, CHECK_SENSORS, {NULL}},
+    {"bus stuck busy 40ms", {"1019 40 i2c_busy"}, CHECK_SENSORS, {NULL}},
+    {"bus stuck busy 500ms", {"1019 500 i2c_busy"}, CHECK_SENSORS, {NULL}},
+    {"full scale ADC glitch 20ms", {"1000 20 adc -1 4095"}, CHECK_NO_TRIP, {NULL}},
+    {"L0/L1 14A ADC glitch 150ms", {"1000 150 adc 2 2000"}, CHECK_TRIP, {NULL}},
+    {"USB stall 100ms", {"1003 100 usb_stall"}, CHECK_USB, {NULL}},
+    {"USB stall 1.5s", {"1003 1500 usb_stall"}, CHECK_USB, {NULL}},
+    // Shedding the first stage still leaves more than the 27A soft limit
+    {"sustained 30.5A overload", {NULL}, CHECK_SHED, {
+        "0 const 1000", "1 const 1000", "2 const 9000", "3 const 9000", "5 square 0 9000 2000",
+        "4 const 1000", "reg const 1000",
+    }},
+    // Each stage shed leaves the voltage under UVLO until only the brain is left
+    {"UVLO sag over 3 stages", {NULL}, CHECK_SHED, {
+        "0 const 1000", "1 const 1000", "2 const 800", "3 const 800", "5 const 800",
+        "4 const 1000", "reg const 1900", "rint const 250", "batt square 12500 10600 2000",
+    }},
+};
+#define NUM_SCENARIOS (sizeof(SCENARIOS) / sizeof(SCENARIOS[0]))
+
+typedef struct {
+    bool watchdog;
+    bool latched;
+    bool passed;
+    uint64_t max_handler_ns;
+    uint64_t max_gap_ns;
+    int64_t recovery_ms;  // -1 if it never recovered
+} result_t;
+
+static jmp_buf stopped;
+static result_t result;
+
+static void watchdog_handler(void) {
+    result.watchdog = true;
+    longjmp(stopped, 1);
+}
+static void halt_handler(void) {
+    result.latched = true;
+    longjmp(stopped, 1);
+}
+
+
+static void run_scenario(const scenario_t* scenario, const char* fault_file) {
+    // Modified after setjmp
+    volatile int host_fd = -1;
+    volatile uint64_t end = 0;
+    volatile uint64_t last_main_loop = 0;
+    volatile uint64_t last_command = 0;
+    volatile bool waiting = false;
+
+    memset(&result, 0, sizeof(result));
+    result.recovery_ms = -1;
+
+    if (scenario) {
+        for (int i = 0; (i < 4) && scenario->faults[i]; i++) {
+            sim_fault_t fault;
+            if (!sim_parse_fault(scenario->faults[i], &fault)) {
+                fprintf(stderr, "faultsim: invalid fault '%s'\n", scenario->faults[i]);
+                exit(1);
+            }
+            sim_add_fault(fault);
+            if ((fault.start + fault.duration) > end) {
+                end = fault.start + fault.duration;
+            }
+        }
+    } else if (!sim_load_faults(fault_file)) {
+        exit(1);
+    }
+
+    if (!scenario || (scenario->check == CHECK_USB)) {
+        int fds[2];
+        socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+        fcntl(fds[0], F_SETFL, O_NONBLOCK);
+        fcntl(fds[1], F_SETFL, O_NONBLOCK);
+        sim_usb_attach(fds[0]);
+        host_fd = fds[1];
+    }
+
+    sim_set_watchdog_handler(watchdog_handler);
+    sim_set_halt_handler(halt_handler);
+    uint8_t loaded = 0;  // a bit for each output
+    if (!scenario || !scenario->loads[0]) {
+        sim_set_load(OUT_L0, (sim_load_t){LOAD_CONST, 1000, 0, 0});
+        sim_set_load(OUT_L1, (sim_load_t){LOAD_CONST, 1000, 0, 0});
+        loaded = (1 << OUT_L0) | (1 << OUT_L1);
+    } else {
+        for (int i = 0; (i < 10) && scenario->loads[i]; i++) {
+            int target;
+            sim_load_t load;
+            if (!sim_parse_load(scenario->loads[i], &target, &load)) {
+                fprintf(stderr, "faultsim: invalid load '%s'\n", scenario->loads[i]);
+                exit(1);
+            }
+            sim_set_load(target, load);
+            if (target <= SIM_TARGET_REG) {
+                loaded |= 1 << target;
+            }
+        }
+    }
+    if (scenario && (scenario->check == CHECK_SHED)) {
+        end = SHED_START;
+    }
+
+    if (setjmp(stopped) == 0) {
+        sim_firmware_init();
+        for (output_t out = OUT_H0; out <= OUT_5V; out++) {
+            if (loaded & (1 << out)) {
+                enable_output(out, true);
+            }
+        }
+        last_main_loop = sim_now_ns;
+
+        while (sim_time_ms < RUN_TIME) {
+            sim_tick();
+            if (sim_main_loop_runs()) {
+                sim_main_loop();
+                if ((sim_now_ns - last_main_loop) > result.max_gap_ns) {
+                    result.max_gap_ns = sim_now_ns - last_main_loop;
+                }
+                last_main_loop = sim_now_ns;
+            }
+
+            if (host_fd >= 0) {
+                // The host sends one query at a time, giving up on a reply after a timeout
+                if (!waiting || ((sim_time_ms - last_command) >= COMMAND_TIMEOUT)) {
+                    waiting = (write(host_fd, "BATT:V?\n", 8) == 8);
+                    last_command = sim_time_ms;
+                }
+                char buf[256];
+                ssize_t len = read(host_fd, buf, sizeof(buf));
+                if ((len > 0) && (buf[len - 1] == '\n')) {
+                    waiting = false;
+                    if ((result.recovery_ms < 0) && (sim_time_ms >= end) && (end > 0)) {
+                        result.recovery_ms = sim_time_ms - end;
+                    }
+                }
+            }
+
+            if (scenario && (sim_time_ms > end) && (result.recovery_ms < 0)
+                && (scenario->check == CHECK_SHED)
+                && (sim_battery_current() <= SHED_CURRENT_LIMIT)
+                && (sim_battery_voltage() >= UVLO_VOLTAGE)) {
+                result.recovery_ms = sim_time_ms - end;
+            }
+
+            if (scenario && (sim_time_ms >= end) && (result.recovery_ms < 0)
+                && (scenario->check == CHECK_SENSORS)) {
+                telemetry_t telemetry;
+                telemetry_read(&telemetry);
+                if (telemetry.battery.success && telemetry.reg_5v.success
+                    && (telemetry.timestamp >= end)) {
+                    result.recovery_ms = sim_time_ms - end;
+                }
+            }
+        }
+    }
+    result.max_handler_ns = sim_max_handler_ns;
+
+    bool tripped = false;
+    for (output_t out = OUT_H0; out <= OUT_5V; out++) {
+        tripped |= output_inhibited[out];
+    }
+
+    result.passed = !result.watchdog && !result.latched
+        && (result.max_gap_ns < (IWDG_PERIOD_MS * 1000000ULL));
+    if (scenario) {
+        switch (scenario->check) {
+            case CHECK_SENSORS:
+            case CHECK_USB:
+                result.passed &= (result.recovery_ms >= 0) && (result.recovery_ms <= MAX_RECOVERY_MS);
+                break;
+            case CHECK_NO_TRIP:
+                result.passed &= !tripped;
+                break;
+            case CHECK_TRIP:
+                result.passed &= tripped;
+                break;
+            case CHECK_SHED:
+                result.passed &= (result.recovery_ms >= 0) && (result.recovery_ms <= MAX_SHED_MS)
+                    && sim_output_on(BRAIN_OUTPUT);
+                break;
+        }
+    }
+}
+
+static void print_result(const char* name, const result_t* res) {
+    char recovery[24] = "-";
+    if (res->recovery_ms >= 0) {
+        snprintf(recovery, sizeof(recovery), "%lld", (long long)res->recovery_ms);
+    }
+    printf("%-30s %10.3f %10.3f %12s  %s%s\n", name,
+           res->max_handler_ns / 1e6, res->max_gap_ns / 1e6, recovery,
+           res->passed ? "PASS" : "FAIL",
+           res->watchdog ? " (watchdog reset)" : (res->latched ? " (latched off)" : ""));
+}
+
+// Each scenario runs in a child process so the firmware starts from a clean state
+static bool run_in_child(const scenario_t* scenario, const char* fault_file) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("faultsim: pipe");
+        exit(1);
+    }
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        run_scenario(scenario, fault_file);
+        if (write(fds[1], &result, sizeof(result)) != sizeof(result)) {
+            _exit(1);
+        }
+        _exit(0);
+    }
+    close(fds[1]);
+
+    result_t res = {0};
+    bool ok = (read(fds[0], &res, sizeof(res)) == sizeof(res));
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    if (!ok) {
+        memset(&res, 0, sizeof(res));
+        res.recovery_ms = -1;
+    }
+    print_result(scenario ? scenario->name : fault_file, &res);
+    return ok && res.passed;
+}
+
+int main(int argc, char** argv) {
+    const char* fault_file = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:h")) != -1) {
+        switch (opt) {
+            case 'f': fault_file = optarg; break;
+            default:
+                fprintf(stderr,
+                    "Usage: %s [-f faults]\n"
+                    "Runs the built-in fault scenarios, or the schedule in the given file.\n"
+                    "Each line of the file is '<start ms> <duration ms> <fault> [arg] [value]':\n"
+                    "  i2c_nack <addr>      the INA219 at addr NACKs, 0 for all\n"
+                    "  i2c_busy             the bus is stuck busy\n"
+                    "  adc <phase> <value>  current sense phase 0-3 reads value, -1 for all\n"
+                    "  usb_stall            the host stops moving data packets\n",
+                    argv[0]);
+                return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    printf("%-30s %10s %10s %12s  %s\n", "scenario", "isr max ms", "gap max ms", "recovery ms", "result");
+    bool passed = true;
+    if (fault_file) {
+        passed = run_in_child(NULL, fault_file);
+    } else {
+        for (size_t i = 0; i < NUM_SCENARIOS; i++) {
+            passed &= run_in_child(&SCENARIOS[i], NULL);
+        }
+    }
+    return passed ? 0 : 1;
+}
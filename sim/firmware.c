@@ -0,0 +1,46 @@
+// Startup of the firmware under simulation
+#include <libopencm3/stm32/iwdg.h>
+
+#include "sim.h"
+#include "../src/cdcacm.h"
+#include "../src/led.h"
+#include "../src/i2c.h"
+#include "../src/button.h"
+#include "../src/fan.h"
+#include "../src/adc.h"
+#include "../src/output.h"
+#include "../src/buzzer.h"
+#include "../src/sched.h"
+#include "../src/macro.h"
+#include "../src/spectrum.h"
+#include "../src/systick.h"
+
+// Same sequence as init() and the start of main() in the firmware
+void sim_firmware_init(void) {
+    usb_init();
+    led_init();
+    i2c_init();
+    disable_all_outputs(true);
+    init_i2c_sensors(true);
+    button_init();
+    fan_init();
+    adc_init();
+    outputs_init();
+    buzzer_init();
+    sched_init();
+    systick_init();
+
+    iwdg_set_period_ms(50);
+    iwdg_start();
+
+    reset_board();
+    set_led(LED_RUN);
+    set_led(LED_ERROR);
+}
+
+void sim_main_loop(void) {
+    usb_poll();
+    macro_poll();
+    spectrum_poll();
+    iwdg_reset();
+}
@@ -0,0 +1,478 @@
+// Simulated STM32F1 peripherals for the libopencm3 calls used by the firmware
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/adc.h>
+#include <libopencm3/stm32/i2c.h>
+#include <libopencm3/stm32/timer.h>
+#include <libopencm3/stm32/iwdg.h>
+#include <libopencm3/cm3/systick.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/dwt.h>
+
+#include "sim.h"
+
+#define SERIALNUM_LOC 0x08001FE0
+
+#define CSDIS_PORT GPIOC
+#define CSDIS_MASK 0x000f
+#define REG_PORT GPIOB
+#define REG_PIN GPIO5
+#define BTN_PORT GPIOC
+#define BTN_INT_PIN GPIO14
+#define BTN_EXT_PIN GPIO15
+// mA per ADC count of the output current sense
+#define ADC_MA_PER_BIT 7.336
+#define QUIESCENT_CURRENT 60
+
+#define NS_PER_MS 1000000ULL
+#define IWDG_PERIOD_NS (50 * NS_PER_MS)
+// Approximate time taken by hardware accesses
+#define HANDLER_ENTRY_NS 500  // exception entry and exit
+#define REG_POLL_NS 125  // one pass of a loop polling a peripheral register
+#define I2C_BYTE_NS 22500  // 9 bits at 400kHz
+#define ADC_CONVERSION_NS 3400  // 12.5 + 28.5 cycles at 12MHz
+
+static const uint32_t OUTPUT_PORT[7] = {GPIOB,  GPIOB,  GPIOC, GPIOC, GPIOC, GPIOC, GPIOB};
+static const uint16_t OUTPUT_PIN[7]  = {GPIO10, GPIO11, GPIO6, GPIO7, GPIO8, GPIO9, GPIO5};
+
+uint64_t sim_time_ms = 0;
+uint64_t sim_now_ns = 0;
+uint64_t sim_max_handler_ns = 0;
+
+static uint16_t gpio_odr[4];
+static uint32_t gpio_bsrr[4];
+static uint32_t afio_mapr;
+static bool systick_enabled;
+static bool in_systick;
+static bool iwdg_running;
+static uint64_t iwdg_last_reset;
+
+static void default_halt_handler(void) {
+    fprintf(stderr, "sim: firmware latched off at %llu ms\n", (unsigned long long)sim_time_ms);
+    sim_print_state();
+    exit(2);
+}
+static void (*halt_handler)(void) = default_halt_handler;
+
+static void default_watchdog_handler(void) {
+    fprintf(stderr, "sim: watchdog reset at %llu ms\n", (unsigned long long)(sim_now_ns / NS_PER_MS));
+    sim_print_state();
+    exit(3);
+}
+static void (*watchdog_handler)(void) = default_watchdog_handler;
+
+void sim_set_halt_handler(void (*handler)(void)) {
+    halt_handler = handler ? handler : default_halt_handler;
+}
+
+void sim_set_watchdog_handler(void (*handler)(void)) {
+    watchdog_handler = handler ? handler : default_watchdog_handler;
+}
+
+void sim_charge(uint64_t ns) {
+    sim_now_ns += ns;
+    if (iwdg_running && ((sim_now_ns - iwdg_last_reset) > IWDG_PERIOD_NS)) {
+        iwdg_running = false;
+        watchdog_handler();
+    }
+}
+
+void sim_print_state(void) {
+    fprintf(stderr, "sim: outputs on:");
+    for (int out = 0; out < 7; out++) {
+        fprintf(stderr, " %d", sim_output_on(out));
+    }
+    fprintf(stderr, " batt %d mV\n", sim_target_value(SIM_TARGET_BATT));
+}
+
+void sim_flash_init(const char* asset_tag) {
+    uintptr_t page = SERIALNUM_LOC & ~0xfffUL;
+    void* mem = mmap((void*)page, 0x1000, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (mem != (void*)page) {
+        perror("sim: failed to map bootloader serial number");
+        exit(1);
+    }
+    strncpy((char*)SERIALNUM_LOC, asset_tag, 16);
+}
+
+bool sim_systick_running(void) {
+    return systick_enabled;
+}
+
+void sim_tick(void) {
+    sim_time_ms++;
+    // If the last handler overran, this tick was pending and starts as soon as it finished
+    if (sim_now_ns < (sim_time_ms * NS_PER_MS)) {
+        sim_now_ns = sim_time_ms * NS_PER_MS;
+    }
+    sim_charge(0);
+
+    sim_usb_frame();
+    sim_update_loads();
+    if (systick_enabled && !in_systick) {
+        uint64_t start = sim_now_ns;
+        in_systick = true;
+        sim_charge(HANDLER_ENTRY_NS);
+        sys_tick_handler();
+        in_systick = false;
+        if ((sim_now_ns - start) > sim_max_handler_ns) {
+            sim_max_handler_ns = sim_now_ns - start;
+        }
+    }
+}
+
+bool sim_main_loop_runs(void) {
+    return sim_now_ns < ((sim_time_ms + 1) * NS_PER_MS);
+}
+
+// DWT, the cycle counter follows the simulated time at 72MHz
+bool dwt_enable_cycle_counter(void) {
+    return true;
+}
+
+uint32_t dwt_read_cycle_counter(void) {
+    return (uint32_t)((sim_now_ns * 72) / 1000);
+}
+
+// RCC
+void rcc_periph_clock_enable(enum rcc_periph_clken clken) {(void)clken;}
+void rcc_periph_reset_pulse(enum rcc_periph_rst rst) {(void)rst;}
+
+// GPIO
+volatile uint32_t* sim_afio_mapr(void) {return &afio_mapr;}
+
+// Writes to BSRR are latched and applied before the port is next accessed
+static uint16_t* port_odr(uint32_t gpioport) {
+    uint32_t bsrr = gpio_bsrr[gpioport];
+    if (bsrr != 0) {
+        gpio_odr[gpioport] = (gpio_odr[gpioport] & ~(bsrr >> 16)) | (bsrr & 0xffff);
+        gpio_bsrr[gpioport] = 0;
+    }
+    return &gpio_odr[gpioport];
+}
+volatile uint32_t* sim_gpio_bsrr(uint32_t gpioport) {
+    port_odr(gpioport);
+    return &gpio_bsrr[gpioport];
+}
+
+void gpio_set_mode(uint32_t gpioport, uint8_t mode, uint8_t cnf, uint16_t gpios) {
+    (void)gpioport; (void)mode; (void)cnf; (void)gpios;
+}
+void gpio_set(uint32_t gpioport, uint16_t gpios) {*port_odr(gpioport) |= gpios;}
+void gpio_clear(uint32_t gpioport, uint16_t gpios) {*port_odr(gpioport) &= ~gpios;}
+void gpio_toggle(uint32_t gpioport, uint16_t gpios) {*port_odr(gpioport) ^= gpios;}
+uint16_t gpio_port_read(uint32_t gpioport) {return *port_odr(gpioport);}
+void gpio_port_write(uint32_t gpioport, uint16_t data) {*port_odr(gpioport) = data;}
+uint16_t gpio_get(uint32_t gpioport, uint16_t gpios) {
+    // The buttons are pulled up and read low while pressed, everything else
+    // reads back the output
+    uint16_t value = *port_odr(gpioport);
+    if (gpioport == BTN_PORT) {
+        value |= BTN_INT_PIN | BTN_EXT_PIN;
+        if (sim_target_value(SIM_TARGET_BTN_INT)) {
+            value &= ~BTN_INT_PIN;
+        }
+        if (sim_target_value(SIM_TARGET_BTN_EXT)) {
+            value &= ~BTN_EXT_PIN;
+        }
+    }
+    return value & gpios;
+}
+
+bool sim_output_on(int out) {
+    return *port_odr(OUTPUT_PORT[out]) & OUTPUT_PIN[out];
+}
+
+// Currents drawn from the outputs and the battery, in mA
+static int32_t output_draw(int out) {
+    if (!sim_output_on(out)) {
+        return 0;
+    }
+    int32_t current = sim_target_value(out);
+    return (current < 0) ? 0 : current;
+}
+int32_t sim_battery_current(void) {
+    if (sim_target_assigned(SIM_TARGET_IBATT)) {
+        return sim_target_value(SIM_TARGET_IBATT);
+    }
+
+    int32_t total = QUIESCENT_CURRENT;
+    for (int out = 0; out < 6; out++) {
+        total += output_draw(out);
+    }
+    // The 5V regulator is roughly 90% efficient from a 12V input
+    total += (output_draw(SIM_TARGET_REG) * 5100) / (12000 * 9 / 10);
+    return total;
+}
+int32_t sim_battery_voltage(void) {
+    return sim_target_value(SIM_TARGET_BATT)
+        - (sim_battery_current() * sim_target_value(SIM_TARGET_RINT)) / 1000;
+}
+
+// ADC
+static uint8_t adc_channel[2];
+static uint16_t adc_result[2];
+
+static uint16_t current_to_adc(int32_t current) {
+    int32_t counts = current / ADC_MA_PER_BIT;
+    return (counts > 4095) ? 4095 : counts;
+}
+
+static uint16_t sample_channel(uint8_t channel) {
+    if (channel == 15) {
+        // 0.4V at 0 degrees, 19.5mV/degree
+        int32_t counts = 496 + (sim_target_value(SIM_TARGET_TEMP) * 6656) / 275;
+        return (counts < 0) ? 0 : ((counts > 4095) ? 4095 : counts);
+    }
+    if (channel > 1) {
+        return 0;
+    }
+
+    // Only one current sense phase is enabled at a time
+    uint16_t enabled = ~(*port_odr(CSDIS_PORT)) & CSDIS_MASK;
+    int phase = __builtin_ffs(enabled) - 1;
+
+    const sim_fault_t* glitch = sim_fault_active(FAULT_ADC, phase);
+    if (glitch) {
+        return (uint16_t)glitch->value;
+    }
+    switch (phase) {
+        case 0:  // H0 sense is split over both channels
+        case 1:
+            return current_to_adc(output_draw(phase) / 2);
+        case 2:  // L0 & L1
+            return current_to_adc(output_draw(2 + channel));
+        case 3:  // L2 & L3
+            return current_to_adc(output_draw(4 + channel));
+        default:
+            return 0;
+    }
+}
+
+void adc_power_on(uint32_t adc) {(void)adc;}
+void adc_power_off(uint32_t adc) {(void)adc;}
+void adc_set_single_conversion_mode(uint32_t adc) {(void)adc;}
+void adc_disable_external_trigger_regular(uint32_t adc) {(void)adc;}
+void adc_set_right_aligned(uint32_t adc) {(void)adc;}
+void adc_set_sample_time_on_all_channels(uint32_t adc, uint8_t time) {(void)adc; (void)time;}
+void adc_reset_calibration(uint32_t adc) {(void)adc;}
+void adc_calibrate(uint32_t adc) {(void)adc;}
+void adc_set_regular_sequence(uint32_t adc, uint8_t length, uint8_t channel[]) {
+    if (length > 0) {
+        adc_channel[adc] = channel[0];
+    }
+}
+void adc_start_conversion_direct(uint32_t adc) {
+    // Both ADCs convert at the same time, so charge for one of them
+    if (adc == ADC1) {
+        sim_charge(ADC_CONVERSION_NS);
+    }
+    adc_result[adc] = sample_channel(adc_channel[adc]);
+}
+bool adc_eoc(uint32_t adc) {(void)adc; return true;}
+uint32_t adc_read_regular(uint32_t adc) {return adc_result[adc];}
+
+// I2C with two INA219s attached
+#define INA219_BATT 0x40
+#define INA219_REG 0x41
+
+static uint32_t i2c_regs[3];
+static uint8_t i2c_addr;
+static bool i2c_reading;
+static uint8_t i2c_tx[4];
+static uint8_t i2c_tx_len;
+static uint8_t i2c_rx[2];
+static uint8_t i2c_rx_len;
+static uint8_t i2c_rx_pos;
+static uint8_t ina219_pointer[2];
+
+static bool ina219_present(uint8_t addr) {
+    return (addr == INA219_BATT) || (addr == INA219_REG);
+}
+
+static uint16_t ina219_read(uint8_t addr, uint8_t reg) {
+    bool batt = (addr == INA219_BATT);
+    switch (reg) {
+        case 0x02: {  // bus voltage, 4mV LSB in bits 15:3
+            int32_t mv = batt ? sim_battery_voltage() : (sim_output_on(SIM_TARGET_REG) ? 5100 : 0);
+            if (mv < 0) { mv = 0; }
+            return (uint16_t)((mv / 4) << 3);
+        }
+        case 0x04:  // current, calibrated to 10mA LSB for the battery and 1mA for the regulator
+            return (uint16_t)(int16_t)(batt ? sim_battery_current() / 10 : output_draw(SIM_TARGET_REG));
+        default:
+            return 0;
+    }
+}
+
+static void i2c_update_status(void) {
+    uint32_t sr1 = i2c_regs[SIM_I2C_SR1] & (I2C_SR1_SB | I2C_SR1_ADDR | I2C_SR1_AF);
+    if (i2c_reading) {
+        if (i2c_rx_pos < i2c_rx_len) {
+            sr1 |= I2C_SR1_RxNE;
+        }
+        if ((i2c_rx_len - i2c_rx_pos) >= 2) {
+            sr1 |= I2C_SR1_BTF;
+        }
+    } else if (i2c_regs[SIM_I2C_SR2] & I2C_SR2_MSL) {
+        sr1 |= I2C_SR1_TxE | I2C_SR1_BTF;
+    }
+    i2c_regs[SIM_I2C_SR1] = sr1;
+}
+
+// Write transfers set the register pointer and optionally write the register
+static void i2c_commit_write(void) {
+    if (!i2c_reading && (i2c_tx_len > 0) && ina219_present(i2c_addr)) {
+        ina219_pointer[i2c_addr & 1] = i2c_tx[0];
+    }
+    i2c_tx_len = 0;
+}
+
+volatile uint32_t* sim_i2c_reg(uint32_t i2c, enum sim_i2c_reg_id reg) {
+    (void)i2c;
+    sim_charge(REG_POLL_NS);
+    switch (reg) {
+        case SIM_I2C_CR1:
+            // Only used to toggle PE, which resets the peripheral state
+            i2c_regs[SIM_I2C_SR1] = 0;
+            i2c_regs[SIM_I2C_SR2] = 0;
+            i2c_reading = false;
+            i2c_tx_len = 0;
+            break;
+        case SIM_I2C_SR1:
+            i2c_update_status();
+            if (sim_fault_active(FAULT_I2C_BUSY, 0)) {
+                // Nothing on the bus makes progress
+                i2c_regs[SIM_I2C_SR1] &= I2C_SR1_AF;
+            }
+            break;
+        case SIM_I2C_SR2:
+            // Reading SR2 clears ADDR
+            i2c_regs[SIM_I2C_SR1] &= ~I2C_SR1_ADDR;
+            break;
+    }
+    return &i2c_regs[reg];
+}
+
+void i2c_reset(uint32_t i2c) {(void)i2c; memset(i2c_regs, 0, sizeof(i2c_regs));}
+void i2c_peripheral_enable(uint32_t i2c) {(void)i2c; i2c_regs[SIM_I2C_CR1] |= I2C_CR1_PE;}
+void i2c_set_speed(uint32_t i2c, enum i2c_speeds speed, uint32_t clock_megahz) {
+    (void)i2c; (void)speed; (void)clock_megahz;
+}
+void i2c_enable_ack(uint32_t i2c) {(void)i2c;}
+void i2c_disable_ack(uint32_t i2c) {(void)i2c;}
+void i2c_nack_next(uint32_t i2c) {(void)i2c;}
+void i2c_nack_current(uint32_t i2c) {(void)i2c;}
+
+void i2c_send_start(uint32_t i2c) {
+    (void)i2c;
+    // A repeated start ends the previous write
+    i2c_commit_write();
+    i2c_reading = false;
+    i2c_regs[SIM_I2C_SR2] |= I2C_SR2_BUSY;
+    if (sim_fault_active(FAULT_I2C_BUSY, 0)) {
+        return;
+    }
+    i2c_regs[SIM_I2C_SR1] |= I2C_SR1_SB;
+    i2c_regs[SIM_I2C_SR2] |= I2C_SR2_MSL;
+}
+
+void i2c_send_stop(uint32_t i2c) {
+    (void)i2c;
+    i2c_commit_write();
+    i2c_reading = false;
+    i2c_regs[SIM_I2C_SR2] &= ~(I2C_SR2_MSL | I2C_SR2_BUSY);
+}
+
+void i2c_send_7bit_address(uint32_t i2c, uint8_t slave, uint8_t readwrite) {
+    (void)i2c;
+    sim_charge(I2C_BYTE_NS);
+    i2c_regs[SIM_I2C_SR1] &= ~I2C_SR1_SB;
+    i2c_addr = slave;
+    if (sim_fault_active(FAULT_I2C_BUSY, 0)) {
+        return;
+    }
+    if (!ina219_present(slave) || sim_fault_active(FAULT_I2C_NACK, slave)) {
+        i2c_regs[SIM_I2C_SR1] |= I2C_SR1_AF;
+        return;
+    }
+    i2c_regs[SIM_I2C_SR1] |= I2C_SR1_ADDR;
+
+    if (readwrite == I2C_READ) {
+        uint16_t value = ina219_read(slave, ina219_pointer[slave & 1]);
+        i2c_reading = true;
+        i2c_rx[0] = value >> 8;
+        i2c_rx[1] = value & 0xff;
+        i2c_rx_len = 2;
+        i2c_rx_pos = 0;
+    }
+}
+
+void i2c_send_data(uint32_t i2c, uint8_t data) {
+    (void)i2c;
+    sim_charge(I2C_BYTE_NS);
+    if (sim_fault_active(FAULT_I2C_NACK, i2c_addr)) {
+        i2c_regs[SIM_I2C_SR1] |= I2C_SR1_AF;
+        return;
+    }
+    if (i2c_tx_len < sizeof(i2c_tx)) {
+        i2c_tx[i2c_tx_len++] = data;
+    }
+}
+
+uint8_t i2c_get_data(uint32_t i2c) {
+    (void)i2c;
+    sim_charge(I2C_BYTE_NS);
+    if (i2c_rx_pos < i2c_rx_len) {
+        return i2c_rx[i2c_rx_pos++];
+    }
+    return 0xff;
+}
+
+// Timers, only used to drive the buzzer and the fan
+void timer_set_mode(uint32_t timer_peripheral, uint32_t clock_div, uint32_t alignment, uint32_t direction) {
+    (void)timer_peripheral; (void)clock_div; (void)alignment; (void)direction;
+}
+void timer_set_prescaler(uint32_t timer_peripheral, uint32_t value) {(void)timer_peripheral; (void)value;}
+void timer_set_period(uint32_t timer_peripheral, uint32_t period) {(void)timer_peripheral; (void)period;}
+void timer_continuous_mode(uint32_t timer_peripheral) {(void)timer_peripheral;}
+void timer_set_oc_mode(uint32_t timer_peripheral, enum tim_oc_id oc_id, enum tim_oc_mode oc_mode) {
+    (void)timer_peripheral; (void)oc_id; (void)oc_mode;
+}
+void timer_set_oc_value(uint32_t timer_peripheral, enum tim_oc_id oc_id, uint32_t value) {
+    (void)timer_peripheral; (void)oc_id; (void)value;
+}
+void timer_enable_oc_output(uint32_t timer_peripheral, enum tim_oc_id oc_id) {(void)timer_peripheral; (void)oc_id;}
+void timer_enable_oc_preload(uint32_t timer_peripheral, enum tim_oc_id oc_id) {(void)timer_peripheral; (void)oc_id;}
+void timer_enable_preload(uint32_t timer_peripheral) {(void)timer_peripheral;}
+void timer_enable_break_main_output(uint32_t timer_peripheral) {(void)timer_peripheral;}
+void timer_enable_counter(uint32_t timer_peripheral) {(void)timer_peripheral;}
+void timer_disable_counter(uint32_t timer_peripheral) {(void)timer_peripheral;}
+void timer_set_counter(uint32_t timer_peripheral, uint32_t count) {(void)timer_peripheral; (void)count;}
+
+// Watchdog
+void iwdg_set_period_ms(uint32_t period) {(void)period;}
+void iwdg_start(void) {
+    iwdg_running = true;
+    iwdg_last_reset = sim_now_ns;
+}
+void iwdg_reset(void) {
+    iwdg_last_reset = sim_now_ns;
+}
+
+// Systick
+void systick_set_clocksource(uint8_t clocksource) {(void)clocksource;}
+void systick_set_reload(uint32_t value) {(void)value;}
+void systick_interrupt_enable(void) {}
+void systick_counter_enable(void) {systick_enabled = true;}
+void systick_counter_disable(void) {
+    systick_enabled = false;
+    halt_handler();
+}
@@ -0,0 +1,6 @@
+#pragma once
+// Simulated libopencm3 for building the firmware on a Linux host.
+// Only the parts of the API used by the firmware are provided.
+
+#include <stdint.h>
+#include <stdbool.h>
@@ -0,0 +1,5 @@
+#pragma once
+#include <libopencm3/cm3/common.h>
+
+bool dwt_enable_cycle_counter(void);
+uint32_t dwt_read_cycle_counter(void);
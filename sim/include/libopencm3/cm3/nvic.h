@@ -0,0 +1,4 @@
+#pragma once
+#include <libopencm3/cm3/common.h>
+
+void sys_tick_handler(void);
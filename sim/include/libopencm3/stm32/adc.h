@@ -0,0 +1,22 @@
+#pragma once
+#include <libopencm3/cm3/common.h>
+
+#define ADC1 0
+#define ADC2 1
+
+#define ADC_SMPR_SMP_1DOT5CYC 0x0
+#define ADC_SMPR_SMP_28DOT5CYC 0x3
+#define ADC_SMPR_SMP_239DOT5CYC 0x7
+
+void adc_power_on(uint32_t adc);
+void adc_power_off(uint32_t adc);
+void adc_set_single_conversion_mode(uint32_t adc);
+void adc_disable_external_trigger_regular(uint32_t adc);
+void adc_set_right_aligned(uint32_t adc);
+void adc_set_sample_time_on_all_channels(uint32_t adc, uint8_t time);
+void adc_reset_calibration(uint32_t adc);
+void adc_calibrate(uint32_t adc);
+void adc_set_regular_sequence(uint32_t adc, uint8_t length, uint8_t channel[]);
+void adc_start_conversion_direct(uint32_t adc);
+bool adc_eoc(uint32_t adc);
+uint32_t adc_read_regular(uint32_t adc);
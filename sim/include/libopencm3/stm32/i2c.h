@@ -0,0 +1,47 @@
+#pragma once
+#include <libopencm3/cm3/common.h>
+
+#define I2C1 0
+
+// Register accesses go through the simulator so it can update the bus state
+#define I2C_CR1(i2c_base) (*sim_i2c_reg(i2c_base, SIM_I2C_CR1))
+#define I2C_SR1(i2c_base) (*sim_i2c_reg(i2c_base, SIM_I2C_SR1))
+#define I2C_SR2(i2c_base) (*sim_i2c_reg(i2c_base, SIM_I2C_SR2))
+
+#define I2C_CR1_PE (1 << 0)
+
+#define I2C_SR1_SB (1 << 0)
+#define I2C_SR1_ADDR (1 << 1)
+#define I2C_SR1_BTF (1 << 2)
+#define I2C_SR1_RxNE (1 << 6)
+#define I2C_SR1_TxE (1 << 7)
+#define I2C_SR1_AF (1 << 10)
+
+#define I2C_SR2_MSL (1 << 0)
+#define I2C_SR2_BUSY (1 << 1)
+
+#define I2C_WRITE 0
+#define I2C_READ 1
+
+enum sim_i2c_reg_id {SIM_I2C_CR1, SIM_I2C_SR1, SIM_I2C_SR2};
+volatile uint32_t* sim_i2c_reg(uint32_t i2c, enum sim_i2c_reg_id reg);
+
+enum i2c_speeds {
+    i2c_speed_sm_100k,
+    i2c_speed_fm_400k,
+    i2c_speed_fmp_1m,
+    i2c_speed_unknown
+};
+
+void i2c_reset(uint32_t i2c);
+void i2c_peripheral_enable(uint32_t i2c);
+void i2c_set_speed(uint32_t i2c, enum i2c_speeds speed, uint32_t clock_megahz);
+void i2c_send_start(uint32_t i2c);
+void i2c_send_stop(uint32_t i2c);
+void i2c_send_7bit_address(uint32_t i2c, uint8_t slave, uint8_t readwrite);
+void i2c_send_data(uint32_t i2c, uint8_t data);
+uint8_t i2c_get_data(uint32_t i2c);
+void i2c_enable_ack(uint32_t i2c);
+void i2c_disable_ack(uint32_t i2c);
+void i2c_nack_next(uint32_t i2c);
+void i2c_nack_current(uint32_t i2c);
@@ -0,0 +1,6 @@
+#pragma once
+#include <libopencm3/cm3/common.h>
+
+void iwdg_set_period_ms(uint32_t period);
+void iwdg_start(void);
+void iwdg_reset(void);
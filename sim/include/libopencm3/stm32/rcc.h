@@ -0,0 +1,14 @@
+#pragma once
+#include <libopencm3/cm3/common.h>
+
+enum rcc_periph_clken {
+    RCC_GPIOA, RCC_GPIOB, RCC_GPIOC, RCC_GPIOD, RCC_AFIO,
+    RCC_ADC1, RCC_ADC2, RCC_I2C1, RCC_TIM1, RCC_TIM2, RCC_TIM3, RCC_TIM4,
+};
+
+enum rcc_periph_rst {
+    RST_TIM1, RST_TIM2, RST_TIM3, RST_TIM4,
+};
+
+void rcc_periph_clock_enable(enum rcc_periph_clken clken);
+void rcc_periph_reset_pulse(enum rcc_periph_rst rst);
@@ -0,0 +1,31 @@
+#pragma once
+#include <libopencm3/usb/usbstd.h>
+
+#define DFU_FUNCTIONAL 0x21
+
+#define USB_DFU_CAN_DOWNLOAD 0x01
+#define USB_DFU_CAN_UPLOAD 0x02
+#define USB_DFU_MANIFEST_TOLERANT 0x04
+#define USB_DFU_WILL_DETACH 0x08
+
+enum dfu_req {
+    DFU_DETACH, DFU_DNLOAD, DFU_UPLOAD, DFU_GETSTATUS,
+    DFU_CLRSTATUS, DFU_GETSTATE, DFU_ABORT,
+};
+
+enum dfu_status {
+    DFU_STATUS_OK,
+};
+
+enum dfu_state {
+    STATE_APP_IDLE, STATE_APP_DETACH, STATE_DFU_IDLE,
+};
+
+struct usb_dfu_descriptor {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint8_t bmAttributes;
+    uint16_t wDetachTimeout;
+    uint16_t wTransferSize;
+    uint16_t bcdDFUVersion;
+} __attribute__((packed));
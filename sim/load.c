@@ -0,0 +1,189 @@
+// Scripted load models applied to the simulated outputs and battery
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "sim.h"
+
+#define MAX_SCRIPT_EVENTS 256
+
+typedef struct {
+    uint64_t time;
+    int target;
+    sim_load_t load;
+} script_event_t;
+
+static sim_load_t loads[SIM_NUM_TARGETS] = {
+    [SIM_TARGET_BATT] = {LOAD_CONST, 12400, 0, 0},
+    [SIM_TARGET_RINT] = {LOAD_CONST, 20, 0, 0},
+    [SIM_TARGET_TEMP] = {LOAD_CONST, 25, 0, 0},
+};
+static int32_t trace_values[SIM_NUM_TARGETS];
+static bool assigned[SIM_NUM_TARGETS];
+// Time each output was last switched on, used by inrush models
+static uint64_t on_since[SIM_NUM_TARGETS];
+static bool was_on[SIM_NUM_TARGETS];
+
+static script_event_t script[MAX_SCRIPT_EVENTS];
+static int script_len;
+static int script_pos;
+
+static const char* TARGET_NAMES[SIM_NUM_TARGETS] = {
+    "0", "1", "2", "3", "4", "5", "reg", "batt", "rint", "temp", "ibatt",
+    "btn_int", "btn_ext"
+};
+static const char* MODEL_NAMES[] = {
+    [LOAD_CONST] = "const",
+    [LOAD_SQUARE] = "square",
+    [LOAD_RAMP] = "ramp",
+    [LOAD_INRUSH] = "inrush",
+    [LOAD_NOISE] = "noise",
+    [LOAD_TRACE] = "trace",
+};
+
+void sim_set_load(int target, sim_load_t load) {
+    loads[target] = load;
+    assigned[target] = true;
+}
+
+void sim_set_value(int target, int32_t value) {
+    loads[target].type = LOAD_TRACE;
+    trace_values[target] = value;
+    assigned[target] = true;
+}
+
+bool sim_target_assigned(int target) {
+    return assigned[target];
+}
+
+int32_t sim_target_value(int target) {
+    const sim_load_t* load = &loads[target];
+    uint64_t t = sim_time_ms;
+
+    if (target <= SIM_TARGET_REG) {
+        // Output loads are timed from when the output was switched on
+        t = sim_time_ms - on_since[target];
+    }
+
+    switch (load->type) {
+        case LOAD_CONST:
+            return load->a;
+        case LOAD_SQUARE:
+            if (load->period == 0) {
+                return load->a;
+            }
+            return ((t % load->period) < (load->period / 2)) ? load->a : load->b;
+        case LOAD_RAMP:
+            if (t >= load->period) {
+                return load->b;
+            }
+            return load->a + (int32_t)(((int64_t)(load->b - load->a) * (int64_t)t) / load->period);
+        case LOAD_INRUSH:
+            if (load->period == 0) {
+                return load->b;
+            }
+            return load->b + (int32_t)((load->a - load->b) * exp(-(double)t / load->period));
+        case LOAD_NOISE:
+            if (load->b == 0) {
+                return load->a;
+            }
+            return load->a + (rand() % (2 * load->b + 1)) - load->b;
+        case LOAD_TRACE:
+            return trace_values[target];
+    }
+    return 0;
+}
+
+// Parse "<target> <model> [a] [b] [period]"
+bool sim_parse_load(const char* spec, int* target, sim_load_t* load) {
+    char target_name[16];
+    char model_name[16];
+    long a = 0, b = 0, period = 0;
+
+    if (sscanf(spec, "%15s %15s %ld %ld %ld", target_name, model_name, &a, &b, &period) < 3) {
+        return false;
+    }
+
+    *target = -1;
+    for (int i = 0; i < SIM_NUM_TARGETS; i++) {
+        if (strcmp(target_name, TARGET_NAMES[i]) == 0) {
+            *target = i;
+        }
+    }
+    if (*target < 0) {
+        return false;
+    }
+
+    for (size_t i = 0; i < sizeof(MODEL_NAMES) / sizeof(MODEL_NAMES[0]); i++) {
+        if (strcmp(model_name, MODEL_NAMES[i]) == 0) {
+            load->type = i;
+            load->a = a;
+            load->b = b;
+            load->period = period;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool sim_load_script(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+
+    char line[128];
+    int line_num = 0;
+    while (fgets(line, sizeof(line), f)) {
+        line_num++;
+        char* comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+
+        char* spec;
+        unsigned long long time = strtoull(line, &spec, 10);
+        if (spec == line) {
+            continue;  // blank line
+        }
+        if (script_len == MAX_SCRIPT_EVENTS) {
+            fprintf(stderr, "%s:%d: too many events\n", path, line_num);
+            fclose(f);
+            return false;
+        }
+
+        script_event_t* event = &script[script_len];
+        if (!sim_parse_load(spec, &event->target, &event->load)) {
+            fprintf(stderr, "%s:%d: invalid load\n", path, line_num);
+            fclose(f);
+            return false;
+        }
+        if ((script_len > 0) && (time < script[script_len - 1].time)) {
+            fprintf(stderr, "%s:%d: events must be in time order\n", path, line_num);
+            fclose(f);
+            return false;
+        }
+        event->time = time;
+        script_len++;
+    }
+    fclose(f);
+    return true;
+}
+
+void sim_update_loads(void) {
+    for (int out = 0; out <= SIM_TARGET_REG; out++) {
+        bool on = sim_output_on(out);
+        if (on && !was_on[out]) {
+            on_since[out] = sim_time_ms;
+        }
+        was_on[out] = on;
+    }
+
+    while ((script_pos < script_len) && (script[script_pos].time <= sim_time_ms)) {
+        sim_set_load(script[script_pos].target, script[script_pos].load);
+        script_pos++;
+    }
+}
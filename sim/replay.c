@@ -0,0 +1,336 @@
+// Replays recorded current and voltage traces through the firmware's protection
+// logic for a set of holdoff configurations, reporting when each one trips
+#define _GNU_SOURCE
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libopencm3/stm32/iwdg.h>
+
+#include "sim.h"
+#include "../src/global_vars.h"
+#include "../src/output.h"
+#include "../src/led.h"
+
+#define MAX_CONFIGS 1024
+
+// Trace columns that can be present, matching the sim targets
+static const char* COLUMN_NAMES[SIM_NUM_TARGETS] = {
+    "h0", "h1", "l0", "l1", "l2", "l3", "reg", "vbatt", NULL, NULL, "ibatt"
+};
+static const char* OUTPUT_NAMES[7] = {"H0", "H1", "L0", "L1", "L2", "L3", "5V"};
+
+typedef struct {
+    uint64_t time;
+    int32_t values[SIM_NUM_TARGETS];
+} trace_row_t;
+
+typedef struct {
+    uint16_t adc_oc;
+    uint16_t batt_oc;
+    uint16_t reg_oc;
+    uint16_t uvlo;
+    uint16_t neg_batt_oc;
+} config_t;
+
+static trace_row_t* trace;
+static size_t trace_len;
+static int trace_columns[SIM_NUM_TARGETS];
+static int num_columns;
+
+static config_t configs[MAX_CONFIGS];
+static int num_configs;
+
+static jmp_buf halted;
+
+static void usage(const char* name) {
+    fprintf(stderr,
+        "Usage: %s [-j jobs] [-c adc:batt:reg:uvlo:neg]... [-p file] trace.csv\n"
+        "  -c  holdoff configuration in ms, as for *SYS:DELAY_COEFF:SET, may be repeated\n"
+        "  -p  file of configurations, one per line\n"
+        "  -j  number of configurations to run in parallel\n"
+        "The trace is CSV with a header row. A 't' column in ms is required, other\n"
+        "columns are any of h0,h1,l0,l1,l2,l3,reg (mA), ibatt (mA) and vbatt (mV).\n"
+        "Each row's values are held until the next row.\n",
+        name);
+}
+
+static bool parse_config(const char* str, config_t* config) {
+    unsigned int values[5];
+    if (sscanf(str, "%u:%u:%u:%u:%u", &values[0], &values[1], &values[2],
+               &values[3], &values[4]) != 5) {
+        return false;
+    }
+    for (int i = 0; i < 5; i++) {
+        if (values[i] > (UINT16_MAX - 1)) {
+            return false;
+        }
+    }
+    *config = (config_t){values[0], values[1], values[2], values[3], values[4]};
+    return true;
+}
+
+static bool add_config(const char* str) {
+    if (num_configs == MAX_CONFIGS) {
+        fprintf(stderr, "replay: too many configurations\n");
+        return false;
+    }
+    if (!parse_config(str, &configs[num_configs])) {
+        fprintf(stderr, "replay: invalid configuration '%s'\n", str);
+        return false;
+    }
+    num_configs++;
+    return true;
+}
+
+static bool load_configs(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+    char line[128];
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "#\r\n")] = '\0';
+        if ((line[0] != '\0') && !add_config(line)) {
+            fclose(f);
+            return false;
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+static bool load_trace(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return false;
+    }
+
+    char line[512];
+    if (!fgets(line, sizeof(line), f)) {
+        fprintf(stderr, "%s: missing header\n", path);
+        fclose(f);
+        return false;
+    }
+    line[strcspn(line, "\r\n")] = '\0';
+
+    bool have_time = false;
+    for (char* name = strtok(line, ","); name; name = strtok(NULL, ",")) {
+        int target = -2;
+        if (strcmp(name, "t") == 0) {
+            target = -1;
+            have_time = (num_columns == 0);
+        }
+        for (int i = 0; i < SIM_NUM_TARGETS; i++) {
+            if (COLUMN_NAMES[i] && (strcmp(name, COLUMN_NAMES[i]) == 0)) {
+                target = i;
+            }
+        }
+        if (target == -2) {
+            fprintf(stderr, "%s: unknown column '%s'\n", path, name);
+            fclose(f);
+            return false;
+        }
+        trace_columns[num_columns++] = target;
+        if (num_columns == SIM_NUM_TARGETS) {
+            break;
+        }
+    }
+    if (!have_time) {
+        fprintf(stderr, "%s: the first column must be 't'\n", path);
+        fclose(f);
+        return false;
+    }
+
+    size_t capacity = 0;
+    int line_num = 1;
+    while (fgets(line, sizeof(line), f)) {
+        line_num++;
+        if (trace_len == capacity) {
+            capacity = capacity ? capacity * 2 : 4096;
+            trace = realloc(trace, capacity * sizeof(trace_row_t));
+        }
+        trace_row_t* row = &trace[trace_len];
+        char* field = line;
+        for (int col = 0; col < num_columns; col++) {
+            char* end;
+            long long value = strtoll(field, &end, 10);
+            if (end == field) {
+                fprintf(stderr, "%s:%d: missing value\n", path, line_num);
+                fclose(f);
+                return false;
+            }
+            if (col == 0) {
+                row->time = value;
+            } else {
+                row->values[trace_columns[col]] = value;
+            }
+            field = end + 1;
+        }
+        if ((trace_len > 0) && (row->time < trace[trace_len - 1].time)) {
+            fprintf(stderr, "%s:%d: rows must be in time order\n", path, line_num);
+            fclose(f);
+            return false;
+        }
+        trace_len++;
+    }
+    fclose(f);
+    return trace_len > 0;
+}
+
+static void halt_handler(void) {
+    longjmp(halted, 1);
+}
+
+static void report(FILE* out, int idx, uint64_t time, const char* event) {
+    const config_t* c = &configs[idx];
+    fprintf(out, "%d,%u,%u,%u,%u,%u,%llu,%s\n", idx, c->adc_oc, c->batt_oc,
+            c->reg_oc, c->uvlo, c->neg_batt_oc, (unsigned long long)time, event);
+}
+
+// Runs in a child process, so the firmware state starts fresh for each configuration
+static void run_config(int idx, FILE* out) {
+    sim_set_halt_handler(halt_handler);
+    sim_set_load(SIM_TARGET_RINT, (sim_load_t){LOAD_CONST, 0, 0, 0});
+    sim_firmware_init();
+
+    ADC_OVERCURRENT_DELAY = configs[idx].adc_oc;
+    BATT_OVERCURRENT_DELAY = configs[idx].batt_oc;
+    REG_OVERCURRENT_DELAY = configs[idx].reg_oc;
+    UVLO_DELAY = configs[idx].uvlo;
+    NEG_CURRENT_DELAY = configs[idx].neg_batt_oc;
+
+    // Let the sensors settle, then switch on every output
+    for (int i = 0; i < 20; i++) {
+        sim_tick();
+        iwdg_reset();
+    }
+    for (output_t out = OUT_H0; out <= OUT_5V; out++) {
+        enable_output(out, true);
+    }
+
+    bool tripped[7] = {false};
+    bool any_trip = false;
+    uint64_t time = 0;
+    size_t row = 0;
+
+    if (setjmp(halted)) {
+        report(out, idx, time, (get_led_state(LED_FLAT) == 1) ?
+               "latched off: undervoltage" : "latched off: global overcurrent");
+        return;
+    }
+
+    for (time = trace[0].time; time <= trace[trace_len - 1].time; time++) {
+        while ((row < trace_len) && (trace[row].time <= time)) {
+            for (int col = 1; col < num_columns; col++) {
+                int target = trace_columns[col];
+                sim_set_value(target, trace[row].values[target]);
+            }
+            row++;
+        }
+        sim_tick();
+        if (sim_main_loop_runs()) {
+            iwdg_reset();
+        }
+
+        for (output_t out_num = OUT_H0; out_num <= OUT_5V; out_num++) {
+            if (output_inhibited[out_num] && !tripped[out_num]) {
+                char event[32];
+                snprintf(event, sizeof(event), "trip %s", OUTPUT_NAMES[out_num]);
+                report(out, idx, time, event);
+                tripped[out_num] = true;
+                any_trip = true;
+            }
+        }
+    }
+    if (!any_trip) {
+        report(out, idx, time - 1, "none");
+    }
+}
+
+int main(int argc, char** argv) {
+    int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:p:j:h")) != -1) {
+        switch (opt) {
+            case 'c':
+                if (!add_config(optarg)) {
+                    return 1;
+                }
+                break;
+            case 'p':
+                if (!load_configs(optarg)) {
+                    return 1;
+                }
+                break;
+            case 'j': jobs = atoi(optarg); break;
+            default:
+                usage(argv[0]);
+                return (opt == 'h') ? 0 : 1;
+        }
+    }
+    if (optind != (argc - 1)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (jobs < 1) {
+        jobs = 1;
+    }
+    if (num_configs == 0) {
+        // Default to the firmware's power-on values
+        add_config("100:100:20:40:2000");
+    }
+    if (!load_trace(argv[optind])) {
+        return 1;
+    }
+
+    FILE* results[MAX_CONFIGS];
+    int running = 0;
+    struct timespec wall_start, wall_end;
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+
+    for (int idx = 0; idx < num_configs; idx++) {
+        if (running == jobs) {
+            wait(NULL);
+            running--;
+        }
+        results[idx] = tmpfile();
+        fflush(NULL);
+        pid_t pid = fork();
+        if (pid == 0) {
+            run_config(idx, results[idx]);
+            fclose(results[idx]);
+            _exit(0);
+        } else if (pid < 0) {
+            perror("replay: fork");
+            return 1;
+        }
+        running++;
+    }
+    while (wait(NULL) > 0) {}
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+
+    printf("config,adc_oc,batt_oc,reg_oc,uvlo,neg_batt_oc,time_ms,event\n");
+    for (int idx = 0; idx < num_configs; idx++) {
+        char line[256];
+        rewind(results[idx]);
+        while (fgets(line, sizeof(line), results[idx])) {
+            fputs(line, stdout);
+        }
+        fclose(results[idx]);
+    }
+
+    double wall_s = (wall_end.tv_sec - wall_start.tv_sec)
+        + (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+    double trace_s = (trace[trace_len - 1].time - trace[0].time + 1) / 1e3;
+    fprintf(stderr, "replay: %d configurations of %.1fs in %.2fs, %.0fx real time\n",
+            num_configs, trace_s, wall_s, (trace_s * num_configs) / wall_s);
+    return 0;
+}
@@ -0,0 +1,108 @@
+#pragma once
+// Interface between the simulated hardware and the host programs driving it
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Targets that can have a load model applied
+// 0-5 are the outputs in output_t order
+enum {
+    SIM_TARGET_REG = 6,  // load on the 5V regulator, mA
+    SIM_TARGET_BATT,  // battery open-circuit voltage, mV
+    SIM_TARGET_RINT,  // battery internal resistance, mOhm
+    SIM_TARGET_TEMP,  // board temperature, degrees C
+    SIM_TARGET_IBATT,  // battery current, mA, computed from the loads unless set
+    SIM_TARGET_BTN_INT,  // internal start button, nonzero while pressed
+    SIM_TARGET_BTN_EXT,  // external start button, nonzero while pressed
+    SIM_NUM_TARGETS
+};
+
+typedef enum {
+    LOAD_CONST,  // a
+    LOAD_SQUARE,  // a for half of period, then b for the other half
+    LOAD_RAMP,  // linearly from a to b over period, then holds b
+    LOAD_INRUSH,  // a decaying exponentially to b, time constant period
+    LOAD_NOISE,  // a with uniform noise of +/- b
+    LOAD_TRACE,  // value set externally each tick by sim_set_value
+} sim_load_type_t;
+
+typedef struct {
+    sim_load_type_t type;
+    int32_t a;
+    int32_t b;
+    uint32_t period;
+} sim_load_t;
+
+// Run the firmware's init sequence
+void sim_firmware_init(void);
+// Run one pass of the firmware's main loop
+void sim_main_loop(void);
+
+// Simulated time in ms since the simulation started
+extern uint64_t sim_time_ms;
+// Simulated time in ns, also advanced by the time taken by hardware accesses
+extern uint64_t sim_now_ns;
+// Longest time spent in the systick handler
+extern uint64_t sim_max_handler_ns;
+
+// Advance one 1ms USB frame, running the systick handler if it is enabled
+void sim_tick(void);
+bool sim_systick_running(void);
+// Whether the systick handler left time for the main loop to run before the next tick
+bool sim_main_loop_runs(void);
+// Account for time spent by the CPU
+void sim_charge(uint64_t ns);
+// Called when the main loop hasn't reset the watchdog for its 50ms period.
+// The default handler reports it and exits.
+void sim_set_watchdog_handler(void (*handler)(void));
+
+// Called when the firmware disables systick, which only happens once it has
+// latched itself off. The default handler reports the reason and exits.
+void sim_set_halt_handler(void (*handler)(void));
+// Print the state of the outputs, useful when reporting a halt
+void sim_print_state(void);
+
+// Place the asset tag where the bootloader would have written it
+void sim_flash_init(const char* asset_tag);
+
+void sim_set_load(int target, sim_load_t load);
+void sim_set_value(int target, int32_t value);
+bool sim_parse_load(const char* spec, int* target, sim_load_t* load);
+// Apply a file of "<time ms> <target> <model> [args...]" lines as time passes
+bool sim_load_script(const char* path);
+// Apply due script events and track output switching, called every tick
+void sim_update_loads(void);
+
+bool sim_output_on(int out);
+// Battery current, mA, and terminal voltage, mV, with the present loads
+int32_t sim_battery_current(void);
+int32_t sim_battery_voltage(void);
+int32_t sim_target_value(int target);
+bool sim_target_assigned(int target);
+
+typedef enum {
+    FAULT_I2C_NACK,  // the device at address arg doesn't acknowledge, 0 for all devices
+    FAULT_I2C_BUSY,  // the bus is held busy and no transfer makes progress
+    FAULT_ADC,  // current sense phase arg reads raw value value, -1 for all phases
+    FAULT_USB_STALL,  // the host stops moving packets on the data endpoints
+    FAULT_NUM_TYPES
+} sim_fault_type_t;
+
+typedef struct {
+    sim_fault_type_t type;
+    uint64_t start;  // ms
+    uint64_t duration;  // ms
+    int32_t arg;
+    int32_t value;
+} sim_fault_t;
+
+// Parse "<start ms> <duration ms> <fault> [arg] [value]"
+bool sim_parse_fault(const char* spec, sim_fault_t* fault);
+bool sim_add_fault(sim_fault_t fault);
+bool sim_load_faults(const char* path);
+// Returns the matching fault active at the current time, or NULL
+const sim_fault_t* sim_fault_active(sim_fault_type_t type, int32_t arg);
+
+// USB device backed by a file descriptor
+void sim_usb_attach(int fd);
+void sim_usb_frame(void);
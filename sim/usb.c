@@ -0,0 +1,151 @@
+// Simulated USB device, the CDC data endpoints are backed by a file descriptor
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libopencm3/usb/usbd.h>
+
+#include "sim.h"
+
+#define PACKET_SIZE 64
+#define NUM_ENDPOINTS 4
+
+struct _usbd_driver {
+    int unused;
+};
+const usbd_driver st_usbfs_v1_usb_driver = {0};
+
+struct _usbd_device {
+    bool configured;
+    usbd_set_config_callback set_config;
+    usbd_endpoint_callback rx_callback[NUM_ENDPOINTS];
+    // Bulk endpoints can move one packet each way per frame
+    bool out_done;
+    bool out_nak;
+    bool in_busy[NUM_ENDPOINTS];
+    uint8_t packet[PACKET_SIZE];
+    int packet_len;
+};
+
+static usbd_device device;
+static int usb_fd = -1;
+
+void sim_usb_attach(int fd) {
+    usb_fd = fd;
+}
+
+void sim_usb_frame(void) {
+    device.out_done = false;
+    memset(device.in_busy, 0, sizeof(device.in_busy));
+}
+
+usbd_device* usbd_init(const usbd_driver *driver,
+        const struct usb_device_descriptor *dev,
+        const struct usb_config_descriptor *conf,
+        const char * const *strings, int num_strings,
+        uint8_t *control_buffer, uint16_t control_buffer_size) {
+    (void)driver; (void)dev; (void)conf; (void)strings; (void)num_strings;
+    (void)control_buffer; (void)control_buffer_size;
+    memset(&device, 0, sizeof(device));
+    return &device;
+}
+
+void usbd_register_reset_callback(usbd_device *usbd_dev, void (*callback)(void)) {
+    (void)usbd_dev; (void)callback;
+}
+void usbd_register_suspend_callback(usbd_device *usbd_dev, void (*callback)(void)) {
+    (void)usbd_dev; (void)callback;
+}
+void usbd_register_resume_callback(usbd_device *usbd_dev, void (*callback)(void)) {
+    (void)usbd_dev; (void)callback;
+}
+void usbd_register_sof_callback(usbd_device *usbd_dev, void (*callback)(void)) {
+    (void)usbd_dev; (void)callback;
+}
+int usbd_register_set_config_callback(usbd_device *usbd_dev, usbd_set_config_callback callback) {
+    usbd_dev->set_config = callback;
+    return 0;
+}
+int usbd_register_control_callback(usbd_device *usbd_dev, uint8_t type,
+        uint8_t type_mask, usbd_control_callback callback) {
+    (void)usbd_dev; (void)type; (void)type_mask; (void)callback;
+    return 0;
+}
+void usbd_disconnect(usbd_device *usbd_dev, bool disconnected) {
+    (void)usbd_dev; (void)disconnected;
+}
+
+void usbd_ep_setup(usbd_device *usbd_dev, uint8_t addr, uint8_t type,
+        uint16_t max_size, usbd_endpoint_callback callback) {
+    (void)type; (void)max_size;
+    if (!(addr & 0x80)) {
+        usbd_dev->rx_callback[addr & 0x7f] = callback;
+    }
+}
+void usbd_ep_stall_set(usbd_device *usbd_dev, uint8_t addr, uint8_t stall) {
+    (void)usbd_dev; (void)addr; (void)stall;
+}
+void usbd_ep_nak_set(usbd_device *usbd_dev, uint8_t addr, uint8_t nak) {
+    if (addr == 0x01) {
+        usbd_dev->out_nak = nak;
+    }
+}
+
+void usbd_poll(usbd_device *usbd_dev) {
+    if (!usbd_dev->configured) {
+        // The host enumerates us on the first poll
+        usbd_dev->configured = true;
+        if (usbd_dev->set_config) {
+            usbd_dev->set_config(usbd_dev, 1);
+        }
+    }
+    if ((usb_fd < 0) || usbd_dev->out_done || usbd_dev->out_nak || (usbd_dev->rx_callback[1] == NULL)
+        || sim_fault_active(FAULT_USB_STALL, 0)) {
+        return;
+    }
+
+    ssize_t len = read(usb_fd, usbd_dev->packet, PACKET_SIZE);
+    if (len <= 0) {
+        return;
+    }
+    usbd_dev->out_done = true;
+    usbd_dev->packet_len = len;
+    usbd_dev->rx_callback[1](usbd_dev, 0x01);
+    // Any part of the packet the firmware didn't read is lost
+    usbd_dev->packet_len = 0;
+}
+
+uint16_t usbd_ep_read_packet(usbd_device *usbd_dev, uint8_t addr, void *buf, uint16_t len) {
+    (void)addr;
+    if (len > usbd_dev->packet_len) {
+        len = usbd_dev->packet_len;
+    }
+    memcpy(buf, usbd_dev->packet, len);
+    usbd_dev->packet_len = 0;
+    return len;
+}
+
+uint16_t usbd_ep_write_packet(usbd_device *usbd_dev, uint8_t addr, const void *buf, uint16_t len) {
+    uint8_t ep = addr & 0x7f;
+    if (usbd_dev->in_busy[ep] || sim_fault_active(FAULT_USB_STALL, 0)) {
+        return 0;
+    }
+    if (len > PACKET_SIZE) {
+        len = PACKET_SIZE;
+    }
+    usbd_dev->in_busy[ep] = true;
+
+    if ((ep != 2) || (usb_fd < 0)) {
+        // Only the data endpoint reaches the host
+        return len;
+    }
+    ssize_t written = write(usb_fd, buf, len);
+    if ((written < 0) && (errno == EAGAIN)) {
+        // Nothing is collecting data from the endpoint
+        usbd_dev->in_busy[ep] = false;
+        return 0;
+    }
+    return len;
+}
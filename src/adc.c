@@ -1,5 +1,6 @@
 #include "adc.h"
 #include "output.h"
+#include "global_vars.h"
 
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/stm32/adc.h>
@@ -51,7 +52,7 @@ uint16_t get_adc_measurement(uint8_t channel) {
     return (uint16_t)(adc_read_regular(ADC1) & 0xffff);
 }
 
-void read_next_current_phase(uint8_t phase) {
+RAMFUNC void read_next_current_phase(uint8_t phase) {
     // Select the channel we want to convert.
     uint8_t adc1_channel_array[1] = {0};
     uint8_t adc2_channel_array[1] = {1};
@@ -89,7 +90,12 @@ int16_t adc_to_temp(uint16_t adc_val) {
     int32_t raw_val = ((int32_t)adc_val - offset);
     return (int16_t)((raw_val * 275) / 6656);
 }
-uint16_t adc_to_current(uint16_t adc_val) {
+int16_t adc_to_temp_x10(uint32_t adc_sum, uint16_t samples) {
+    // As adc_to_temp, on the mean of oversampled readings in 0.1 degrees
+    int32_t raw_val = (int32_t)((adc_sum * 10) / samples) - 4964;
+    return (int16_t)((raw_val * 275) / 6656);
+}
+RAMFUNC uint16_t adc_to_current(uint16_t adc_val) {
     // ADC LSB: 3.3/(2^12) = 805.66e-6 V/bit
     // (1/5100)*560 = 109.8e-3 V/A
     // 805.66/109800 * 1e3 = 7.34 mA/bit = 7 + 9671/28672
@@ -11,4 +11,5 @@ uint16_t get_adc_measurement(uint8_t channel);
 void read_next_current_phase(uint8_t phase);
 
 int16_t adc_to_temp(uint16_t adc_val);
+int16_t adc_to_temp_x10(uint32_t adc_sum, uint16_t samples);
 uint16_t adc_to_current(uint16_t adc_val);
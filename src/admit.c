@@ -0,0 +1,102 @@
+#include "admit.h"
+#include "global_vars.h"
+
+volatile bool admit_enabled = false;
+
+// A guess at each output's draw until it has been seen on
+static admit_state_t admit_state = {
+    .available = ADMIT_BUDGET,
+    .expected = {5000, 5000, 2000, 2000, 2000, 2000, 1000},
+};
+
+// Written by the main loop only
+static int32_t admit_reserved = 0;
+static uint8_t admit_reserved_outputs = 0;  // a bit for each output
+static uint32_t admit_reserved_at = 0;
+// Draw of the outputs a batch being validated enables, checked but not reserved yet
+static int32_t admit_batch = 0;
+static uint8_t admit_batch_outputs = 0;  // a bit for each output
+
+void admit_update(void) {
+    // The same load as the global current limit sees
+    int32_t load = 0;
+    for (output_t out=OUT_H0; out <= OUT_5V; out++) {
+        uint16_t current = output_current[out];
+        if (out == OUT_5V) {
+            current = (reg_5v.success && (reg_5v.current > 0))?reg_5v.current:0;
+        }
+        load += current;
+
+        if (!output_enabled(out)) {continue;}
+        uint16_t* expected = &admit_state.expected[out];
+        if (current >= *expected) {
+            *expected = current;
+        } else {
+            *expected -= (*expected - current) >> ADMIT_DECAY_SHIFT;
+        }
+    }
+    if ((battery.success) && (battery.current > load)) {
+        load = battery.current;
+    }
+    admit_state.available = ADMIT_BUDGET - load;
+}
+
+void admit_get(admit_state_t* state) {
+    *state = admit_state;
+}
+
+static bool reservation_expired(void) {
+    return (uptime_ms - admit_reserved_at) > ADMIT_SETTLE_TIME;
+}
+
+// Whether an output's draw is counted against the budget when it's enabled
+static bool admit_counted(output_t out) {
+    return admit_enabled && !output_enabled(out);
+}
+
+int32_t admit_available(const admit_state_t* state) {
+    return state->available - (reservation_expired()?0:admit_reserved);
+}
+
+bool admit_fits(output_t out, const admit_state_t* state) {
+    if (!admit_counted(out) || (admit_batch_outputs & (1 << out))) {
+        return true;
+    }
+    return (admit_batch + state->expected[out]) <= admit_available(state);
+}
+
+void admit_reserve(output_t out, const admit_state_t* state) {
+    if (!admit_counted(out)) {
+        return;
+    }
+    if (reservation_expired()) {
+        admit_reserved = 0;
+        admit_reserved_outputs = 0;
+    }
+    if (!(admit_reserved_outputs & (1 << out))) {
+        admit_reserved += state->expected[out];
+        admit_reserved_outputs |= 1 << out;
+    }
+    admit_reserved_at = uptime_ms;
+}
+
+void admit_release(output_t out, const admit_state_t* state) {
+    if (reservation_expired() || !(admit_reserved_outputs & (1 << out))) {
+        return;
+    }
+    admit_reserved -= state->expected[out];
+    admit_reserved_outputs &= ~(1 << out);
+}
+
+void admit_batch_clear(void) {
+    admit_batch = 0;
+    admit_batch_outputs = 0;
+}
+
+void admit_batch_claim(output_t out, const admit_state_t* state) {
+    if (!admit_counted(out) || (admit_batch_outputs & (1 << out))) {
+        return;
+    }
+    admit_batch += state->expected[out];
+    admit_batch_outputs |= 1 << out;
+}
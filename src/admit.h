@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "output.h"
+
+// Admission control: an output is only enabled if the draw it's expected to
+// add fits in the headroom below the load shedding limit
+
+#define ADMIT_BUDGET SHED_CURRENT_LIMIT  // mA
+// An output's expected draw follows its peaks, decaying over ~64 updates
+#define ADMIT_DECAY_SHIFT 6
+// Admitted draw is reserved until the measurements include it
+#define ADMIT_SETTLE_TIME 100  // ms
+
+typedef struct {
+    int32_t available;  // budget not used by the present load, mA
+    uint16_t expected[7];  // draw of each output when last on, mA
+} admit_state_t;
+
+extern volatile bool admit_enabled;
+
+// Only to be called from the systick handler, after each battery measurement
+#ifdef FEATURE_ADMIT
+void admit_update(void);
+#else
+static inline void admit_update(void) {}
+#endif
+// Only to be called from the systick handler, the host reads it from the telemetry frame
+void admit_get(admit_state_t* state);
+
+// The rest are only to be called from the main loop
+// Whether enabling the output fits in the budget left by the reservations
+// and the claims of the batch being validated. Outputs already on, or any
+// output while admission is disabled, always fit.
+bool admit_fits(output_t out, const admit_state_t* state);
+// Count an admitted output's draw against later checks until the
+// measurements include it, or give it back if the enable didn't happen
+void admit_reserve(output_t out, const admit_state_t* state);
+void admit_release(output_t out, const admit_state_t* state);
+// Count an output a batch would enable against the rest of the batch while
+// it's validated, nothing is reserved until the batch runs. The claims are
+// cleared once the batch has been validated.
+void admit_batch_claim(output_t out, const admit_state_t* state);
+#ifdef FEATURE_ADMIT
+void admit_batch_clear(void);
+#else
+static inline void admit_batch_clear(void) {}
+#endif
+// The budget left after reservations
+int32_t admit_available(const admit_state_t* state);
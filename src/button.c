@@ -1,5 +1,7 @@
 #include "button.h"
 #include "global_vars.h"
+#include "events.h"
+#include "macro.h"
 
 volatile bool int_button_pressed = false;
 volatile bool ext_button_pressed = false;
@@ -20,12 +22,80 @@ bool button_ext_read(void) {
     return !gpio_get(EXT_BTN_PORT, EXT_BTN_PIN);
 }
 
+typedef struct {
+    bool state;  // debounced state
+    bool candidate;  // raw state waiting to be accepted
+    uint8_t count;  // ms the raw state has differed from the debounced one
+    uint32_t change_time;  // uptime when the raw state first differed
+} debounce_t;
+
+static debounce_t debounce[2] = {0};
+
+// Written by the systick handler at the head, read by the main loop at the tail
+static button_event_t button_events[BUTTON_EVENT_QUEUE_LEN];
+static volatile uint8_t button_event_head = 0;
+static volatile uint8_t button_event_tail = 0;
+
+static void button_event_push(button_t button, bool pressed, uint32_t timestamp) {
+    uint8_t next_head = (button_event_head + 1) & (BUTTON_EVENT_QUEUE_LEN - 1);
+    if (next_head == button_event_tail) {
+        // Keep the older events, the start of a press matters most
+        return;
+    }
+    button_events[button_event_head].timestamp = timestamp;
+    button_events[button_event_head].button = button;
+    button_events[button_event_head].pressed = pressed;
+    __asm__ volatile("" ::: "memory");  // write the event before publishing it
+    button_event_head = next_head;
+}
+
+// Returns true when the button's debounced state changes
+static bool debounce_button(debounce_t* btn, bool raw) {
+    if (raw == btn->state) {
+        btn->count = 0;
+        return false;
+    }
+    if ((btn->count == 0) || (raw != btn->candidate)) {
+        btn->candidate = raw;
+        btn->change_time = uptime_ms;
+        btn->count = 0;
+    }
+    if (++btn->count < BUTTON_DEBOUNCE_MS) {
+        return false;
+    }
+    btn->state = raw;
+    btn->count = 0;
+    return true;
+}
+
 void sample_buttons(void) {
-    // latch in button presses
-    if (button_int_read()) {
-        int_button_pressed = true;
+    if (debounce_button(&debounce[BUTTON_INT], button_int_read())) {
+        bool pressed = debounce[BUTTON_INT].state;
+        // latch in button presses
+        if (pressed) {
+            int_button_pressed = true;
+            macro_trigger_button();
+        }
+        button_event_push(BUTTON_INT, pressed, debounce[BUTTON_INT].change_time);
+        event_push(EVENT_BUTTON_INT, pressed);
     }
-    if (button_ext_read()) {
-        ext_button_pressed = true;
+    if (debounce_button(&debounce[BUTTON_EXT], button_ext_read())) {
+        bool pressed = debounce[BUTTON_EXT].state;
+        if (pressed) {
+            ext_button_pressed = true;
+            macro_trigger_button();
+        }
+        button_event_push(BUTTON_EXT, pressed, debounce[BUTTON_EXT].change_time);
+        event_push(EVENT_BUTTON_EXT, pressed);
+    }
+}
+
+bool button_event_pop(button_event_t* event) {
+    if (button_event_tail == button_event_head) {
+        return false;
     }
+    *event = button_events[button_event_tail];
+    __asm__ volatile("" ::: "memory");  // read the event before releasing its slot
+    button_event_tail = (button_event_tail + 1) & (BUTTON_EVENT_QUEUE_LEN - 1);
+    return true;
 }
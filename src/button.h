@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdint.h>
 #include <stdbool.h>
 #include <libopencm3/stm32/gpio.h>
 
@@ -8,9 +9,27 @@
 #define EXT_BTN_PORT GPIOC
 #define EXT_BTN_PIN GPIO15
 
+// ms a button must hold a new state before it's accepted
+#define BUTTON_DEBOUNCE_MS 20
+// Must be a power of 2
+#define BUTTON_EVENT_QUEUE_LEN 8
+
+typedef enum {
+    BUTTON_INT,
+    BUTTON_EXT,
+} button_t;
+
+typedef struct {
+    uint32_t timestamp;  // uptime in ms when the press or release started
+    button_t button;
+    bool pressed;
+} button_event_t;
+
 void button_init(void);
 
 bool button_int_read(void);
 bool button_ext_read(void);
 
 void sample_buttons(void);
+// Take the oldest button event, returns false if there are none
+bool button_event_pop(button_event_t* event);
@@ -5,9 +5,24 @@
 #include <libopencm3/stm32/gpio.h>
 
 
+// Prevent the compiler moving memory accesses across this point
+#define compiler_barrier() __asm__ volatile("" ::: "memory")
+
 volatile uint32_t buzzer_ticks_remaining = 0;
 uint16_t buzzer_frequency = 0;
 
+#ifdef FEATURE_SEQUENCES
+// The sequence is written by the main loop and played by buzzer_tick. Notes
+// are only appended while playing, so the systick never sees a partial note.
+static buzzer_seq_note_t buzzer_seq[BUZZER_SEQ_LEN];
+static volatile uint8_t buzzer_seq_len = 0;
+static volatile uint8_t buzzer_seq_pos = 0;
+static volatile bool buzzer_seq_playing = false;
+static volatile bool buzzer_seq_loop = false;
+static volatile uint16_t buzzer_seq_loops = 0;
+static volatile uint16_t buzzer_rest_remaining = 0;
+#endif
+
 void buzzer_init(void) {
     // Enable TIM3 clock
     rcc_periph_clock_enable(RCC_TIM3);
@@ -15,7 +30,7 @@ void buzzer_init(void) {
     // Reset TIM3 peripheral.
     rcc_periph_reset_pulse(RST_TIM3);
     timer_set_prescaler(TIM3, 72);  // 72Mhz -> 1Mhz
-    timer_set_period(TIM1, UINT16_MAX);  // default value, will be overridden
+    timer_set_period(TIM3, UINT16_MAX);  // default value, will be overridden
 
     // Up counting, edge triggered no divider
     timer_set_mode(TIM3, TIM_CR1_CKD_CK_INT, TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
@@ -28,11 +43,15 @@ void buzzer_init(void) {
     gpio_set_mode(GPIOB, GPIO_MODE_OUTPUT_10_MHZ, GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, GPIO0);
 }
 
-void buzzer_note(uint16_t freq, uint32_t duration) {
-    if ((freq == 0) || (duration == 0)) {
-        buzzer_stop();
-        return;
-    }
+static void buzzer_silence(void) {
+    // Disable timer
+    timer_disable_counter(TIM3);
+    timer_set_counter(TIM3, 0);
+
+    buzzer_ticks_remaining = 0;
+}
+
+static void buzzer_start_note(uint16_t freq, uint32_t duration) {
     if (freq > 10000) {
         // bound frequency to 10kHz, the resonator isn't designed for above this
         freq = 10000;
@@ -47,25 +66,116 @@ void buzzer_note(uint16_t freq, uint32_t duration) {
     buzzer_ticks_remaining = duration;
 }
 
-void buzzer_stop(void) {
-    // Disable timer
-    timer_disable_counter(TIM3);
-    timer_set_counter(TIM3, 0);
+void buzzer_note(uint16_t freq, uint32_t duration) {
+#ifdef FEATURE_SEQUENCES
+    // A single note replaces any sequence
+    buzzer_seq_playing = false;
+#endif
 
-    buzzer_ticks_remaining = 0;
+    if ((freq == 0) || (duration == 0)) {
+        buzzer_stop();
+        return;
+    }
+    buzzer_start_note(freq, duration);
+}
+
+void buzzer_stop(void) {
+#ifdef FEATURE_SEQUENCES
+    buzzer_seq_playing = false;
+#endif
+    buzzer_silence();
 }
 
 bool buzzer_running(void) {
-    return (buzzer_ticks_remaining != 0);
+#ifdef FEATURE_SEQUENCES
+    if (buzzer_seq_playing) {
+        return true;
+    }
+#endif
+    return buzzer_ticks_remaining != 0;
 }
 
+#ifdef FEATURE_SEQUENCES
+static void buzzer_seq_next(void) {
+    if (buzzer_seq_pos >= buzzer_seq_len) {
+        if (!buzzer_seq_loop || (buzzer_seq_len == 0)) {
+            buzzer_seq_playing = false;
+            return;
+        }
+        buzzer_seq_pos = 0;
+        buzzer_seq_loops++;
+    }
+
+    const buzzer_seq_note_t* note = &buzzer_seq[buzzer_seq_pos++];
+    buzzer_rest_remaining = note->rest;
+    if ((note->freq == 0) || (note->duration == 0)) {
+        // A rest for the note's duration
+        buzzer_rest_remaining += note->duration;
+    } else {
+        buzzer_start_note(note->freq, note->duration);
+    }
+}
+#endif
+
 void buzzer_tick(void) {
     if (buzzer_ticks_remaining != 0) {
         if (--buzzer_ticks_remaining == 0) {
-            buzzer_stop();
+            buzzer_silence();
         }
+        return;
     }
+#ifdef FEATURE_SEQUENCES
+    if (!buzzer_seq_playing) {
+        return;
+    }
+    if (buzzer_rest_remaining != 0) {
+        buzzer_rest_remaining--;
+        return;
+    }
+    buzzer_seq_next();
+#endif
+}
+
+#ifdef FEATURE_SEQUENCES
+void buzzer_seq_clear(void) {
+    buzzer_stop();
+    buzzer_seq_len = 0;
+}
+
+bool buzzer_seq_add(uint16_t freq, uint16_t duration, uint16_t rest) {
+    if (buzzer_seq_len >= BUZZER_SEQ_LEN) {
+        return false;
+    }
+    buzzer_seq[buzzer_seq_len].freq = freq;
+    buzzer_seq[buzzer_seq_len].duration = duration;
+    buzzer_seq[buzzer_seq_len].rest = rest;
+    compiler_barrier();  // write the note before the sequence includes it
+    buzzer_seq_len++;
+    return true;
+}
+
+uint8_t buzzer_seq_space(void) {
+    return BUZZER_SEQ_LEN - buzzer_seq_len;
+}
+
+void buzzer_seq_play(bool loop) {
+    buzzer_stop();
+    compiler_barrier();  // the systick ignores the sequence until it's reset
+    buzzer_seq_pos = 0;
+    buzzer_seq_loops = 0;
+    buzzer_rest_remaining = 0;
+    buzzer_seq_loop = loop;
+    compiler_barrier();
+    buzzer_seq_playing = true;
+}
+
+void buzzer_seq_state(bool* playing, uint8_t* pos, uint8_t* len, uint16_t* loops) {
+    *playing = buzzer_seq_playing;
+    *pos = buzzer_seq_pos;
+    *len = buzzer_seq_len;
+    *loops = buzzer_seq_loops;
 }
+#endif
 
 uint16_t buzzer_get_freq(void) {
     if (buzzer_running()) {
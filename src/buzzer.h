@@ -2,11 +2,27 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+// Notes that can be queued in a sequence
+#define BUZZER_SEQ_LEN 32
+
+typedef struct {
+    uint16_t freq;  // Hz, 0 for a rest
+    uint16_t duration;  // ms
+    uint16_t rest;  // ms of silence after the note
+} buzzer_seq_note_t;
+
 void buzzer_init(void);
 void buzzer_note(uint16_t freq, uint32_t duration);
 void buzzer_stop(void);
 bool buzzer_running(void);
 void buzzer_tick(void);
 
+// Only to be called from the main loop, the sequence is played by buzzer_tick
+void buzzer_seq_clear(void);
+bool buzzer_seq_add(uint16_t freq, uint16_t duration, uint16_t rest);
+uint8_t buzzer_seq_space(void);
+void buzzer_seq_play(bool loop);
+void buzzer_seq_state(bool* playing, uint8_t* pos, uint8_t* len, uint16_t* loops);
+
 uint16_t buzzer_get_freq(void);
 uint32_t buzzer_remaining(void);
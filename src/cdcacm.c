@@ -30,6 +30,8 @@
 #include "output.h"
 #include "global_vars.h"
 #include "led.h"
+#include "events.h"
+#include "nack.h"
 
 static usbd_device *g_usbd_dev;
 bool re_enter_bootloader = false;
@@ -253,11 +255,98 @@ static enum usbd_request_return_codes cdcacm_control_request(usbd_device *usbd_d
     return USBD_REQ_NOTSUPP;
 }
 
-#define USB_MSG_MAXLEN 64
 #define USB_BUFFER_SIZE 64
+// Room for the longest line, plus a packet carrying its end
+#define USB_MSG_MAXLEN (MSG_MAX_LEN + USB_BUFFER_SIZE + 1)
+// Must be a power of 2
+#define USB_TX_BUFFER_SIZE 512
 char usb_msg_buffer[USB_MSG_MAXLEN];
 int usb_msg_len = 0;
 
+// Responses are queued here and sent one packet per poll, so a packet full of
+// commands can be answered with more than one packet of responses
+static char usb_tx_buffer[USB_TX_BUFFER_SIZE];
+static uint16_t usb_tx_head = 0;
+static uint16_t usb_tx_tail = 0;
+// The OUT endpoint NAKs the host while there isn't room for another packet
+static bool usb_rx_paused = false;
+// The start of the current line didn't fit in the buffer and was dropped
+static bool usb_msg_overflow = false;
+
+static uint16_t usb_tx_free(void) {
+    return (USB_TX_BUFFER_SIZE - 1) - ((usb_tx_head - usb_tx_tail) & (USB_TX_BUFFER_SIZE - 1));
+}
+
+static void usb_tx_push(const char* data, int len) {
+    for (int i = 0; i < len; i++) {
+        usb_tx_buffer[usb_tx_head] = data[i];
+        usb_tx_head = (usb_tx_head + 1) & (USB_TX_BUFFER_SIZE - 1);
+    }
+}
+
+static void usb_tx_flush(usbd_device *usbd_dev) {
+    char packet[USB_BUFFER_SIZE];
+    uint16_t len = 0;
+    uint16_t idx = usb_tx_tail;
+
+    while ((idx != usb_tx_head) && (len < USB_BUFFER_SIZE)) {
+        packet[len++] = usb_tx_buffer[idx];
+        idx = (idx + 1) & (USB_TX_BUFFER_SIZE - 1);
+    }
+    // The write fails while the previous packet is still waiting for the host
+    if (len && usbd_ep_write_packet(usbd_dev, 0x82, packet, len)) {
+        usb_tx_tail = idx;
+    }
+}
+
+static void usb_process_msgs(void) {
+    char* end_of_msg = strchr(usb_msg_buffer, '\n');  // test if \n in buffer
+
+    // Leave commands in the buffer until there's room for their response
+    while ((end_of_msg != NULL) && (usb_tx_free() >= MSG_RESPONSE_MAX_LEN + 1)) {
+        char response_buffer[MSG_RESPONSE_MAX_LEN + 1];
+
+        *end_of_msg = '\0';  // replace newline with null terminator
+        char* carriage_return = strchr(usb_msg_buffer, '\r');
+        if (carriage_return) {
+            *carriage_return = '\0';  // remove a \r
+        }
+
+        int msg_len = end_of_msg - usb_msg_buffer + 1;
+
+        if (usb_msg_overflow) {
+            response_buffer[0] = '\0';
+            nack_append(response_buffer, NACK_COMMAND_TOO_LONG, MSG_RESPONSE_MAX_LEN);
+            usb_msg_overflow = false;
+        } else {
+            handle_msg(usb_msg_buffer, response_buffer, MSG_RESPONSE_MAX_LEN);
+        }
+        int usb_response_len = strlen(response_buffer);
+        response_buffer[usb_response_len++] = '\n';  // replace null-terminator with newline
+        usb_tx_push(response_buffer, usb_response_len);
+
+        usb_msg_len -= msg_len;
+        if (usb_msg_len > 0) {
+            // move remaining data, including the null terminator, to start of buffer
+            memmove(usb_msg_buffer, end_of_msg + 1, usb_msg_len + 1);
+        } else {
+            usb_msg_len = 0;
+            usb_msg_buffer[0] = '\0';
+        }
+
+        // repeat if \n in buffer
+        end_of_msg = strchr(usb_msg_buffer, '\n');
+    }
+
+    // drop a line that's too long to handle, it's answered with a NACK once
+    // its end arrives
+    if ((end_of_msg == NULL) && (usb_msg_len > MSG_MAX_LEN)) {
+        usb_msg_len = 0;
+        usb_msg_buffer[0] = '\0';
+        usb_msg_overflow = true;
+    }
+}
+
 static void cdcacm_data_rx_cb(usbd_device *usbd_dev, uint8_t ep) {
     (void)ep;
 
@@ -270,47 +359,14 @@ static void cdcacm_data_rx_cb(usbd_device *usbd_dev, uint8_t ep) {
         usb_msg_len += len;
         usb_msg_buffer[usb_msg_len] = '\0'; // add null terminator to make it a string
 
-        char* end_of_msg = strchr(usb_msg_buffer, '\n');  // test if \n in buffer
-        char response_buffer[USB_BUFFER_SIZE];
-        char* response_ptr = response_buffer;
-        int full_response_len = 0;
-
-        while (end_of_msg != NULL) {
-            *end_of_msg = '\0';  // replace newline with null terminator
-            char* carriage_return = strchr(usb_msg_buffer, '\r');
-            if (carriage_return) {
-                *carriage_return = '\0';  // remove a \r
-            }
-
-            int msg_len = end_of_msg - usb_msg_buffer + 1;
-
-            handle_msg(usb_msg_buffer, response_ptr, (USB_BUFFER_SIZE - 1) - full_response_len);
-            int usb_response_len = strlen(response_ptr);
-            response_ptr[usb_response_len++] = '\n';  // replace null-terminator with newline
-            full_response_len += usb_response_len;
-            response_ptr += usb_response_len;
-
-            usb_msg_len -= msg_len;
-            if (usb_msg_len < 0) {
-                usb_msg_len = 0;
-            }
-            if (usb_msg_len > 0) {
-                // move remaining data to start of buffer
-                memmove(usb_msg_buffer, end_of_msg + 1, usb_msg_len);
-            }
-
-            // repeat if \n in buffer
-            end_of_msg = strchr(usb_msg_buffer, '\n');  // test if \n in buffer
-        }
-
-        // drop a full buffer without newlines
-        if (usb_msg_len == (USB_MSG_MAXLEN - 1)) {
-            usb_msg_len = 0;
-        }
+        usb_process_msgs();
+        usb_tx_flush(usbd_dev);
+    }
 
-        if (full_response_len > 0) {
-            usbd_ep_write_packet(usbd_dev, 0x82, response_buffer, full_response_len);
-        }
+    // Hold off the host until a full packet will fit in the buffer
+    if ((USB_MSG_MAXLEN - 1) - usb_msg_len < USB_BUFFER_SIZE) {
+        usbd_ep_nak_set(usbd_dev, 0x01, 1);
+        usb_rx_paused = true;
     }
 }
 
@@ -327,6 +383,17 @@ static void cdcacm_set_config(usbd_device *usbd_dev, uint16_t wValue) {
                 USB_REQ_TYPE_TYPE | USB_REQ_TYPE_RECIPIENT,
                 cdcacm_control_request);
 
+    // Discard anything left from a previous connection
+    usb_msg_len = 0;
+    usb_tx_head = usb_tx_tail = 0;
+    usb_rx_paused = false;
+    usb_msg_overflow = false;
+    // A new host won't be expecting events or numeric NACKs
+#ifdef FEATURE_EVENTS
+    events_enabled = false;
+#endif
+    nack_numeric = false;
+
     // Indicate we've enumerated
     clear_led(LED_ERROR);
 }
@@ -361,4 +428,25 @@ void usb_deinit(void) {
 
 void usb_poll(void) {
     usbd_poll(g_usbd_dev);
+
+    // Handle any commands that were waiting for room in the TX buffer
+    usb_process_msgs();
+
+    // Send events after the responses that are already queued
+    char event_line[EVENT_MAX_LEN];
+    while (usb_tx_free() >= EVENT_MAX_LEN) {
+        uint8_t event_len = event_pop_line(event_line);
+        if (event_len == 0) {
+            break;
+        }
+        usb_tx_push(event_line, event_len);
+    }
+    usb_tx_flush(g_usbd_dev);
+
+    if (usb_rx_paused) {
+        if ((USB_MSG_MAXLEN - 1) - usb_msg_len >= USB_BUFFER_SIZE) {
+            usb_rx_paused = false;
+            usbd_ep_nak_set(g_usbd_dev, 0x01, 0);
+        }
+    }
 }
@@ -0,0 +1,85 @@
+#include "events.h"
+#include "global_vars.h"
+
+// Must be a power of 2
+#define EVENT_QUEUE_LEN 16
+
+// Prevent the compiler moving memory accesses across this point
+#define compiler_barrier() __asm__ volatile("" ::: "memory")
+
+static const char* const EVENT_NAMES[] = {
+    [EVENT_OVERCURRENT] = "OC",
+    [EVENT_UVLO] = "UVLO",
+    [EVENT_BATT_OVERCURRENT] = "BATT_OC",
+    [EVENT_BUTTON_INT] = "BTN_INT",
+    [EVENT_BUTTON_EXT] = "BTN_EXT",
+    [EVENT_FAN] = "FAN",
+    [EVENT_SHED] = "SHED",
+    [EVENT_SHED_CLEAR] = "SHED_CLEAR",
+    [EVENT_RECLOSE] = "RECLOSE",
+    [EVENT_STALL] = "STALL",
+    [EVENT_STALL_CLEAR] = "STALL_CLEAR",
+};
+
+volatile bool events_enabled = false;
+volatile uint16_t events_dropped = 0;
+
+// Written by the systick handler at the head, read by the main loop at the tail
+static event_t event_queue[EVENT_QUEUE_LEN];
+static volatile uint8_t event_head = 0;
+static volatile uint8_t event_tail = 0;
+
+void event_push(event_type_t type, uint8_t arg) {
+    if (!events_enabled) {
+        return;
+    }
+
+    uint8_t next_head = (event_head + 1) & (EVENT_QUEUE_LEN - 1);
+    if (next_head == event_tail) {
+        // The host isn't keeping up, keep the older events
+        events_dropped++;
+        return;
+    }
+    event_queue[event_head].timestamp = uptime_ms;
+    event_queue[event_head].type = type;
+    event_queue[event_head].arg = arg;
+    compiler_barrier();  // write the event before publishing it
+    event_head = next_head;
+}
+
+static char* append_uint(char* buf, uint32_t value) {
+    char tmp[10];
+    uint8_t len = 0;
+
+    do {
+        tmp[len++] = '0' + (value % 10);
+        value /= 10;
+    } while (value);
+
+    while (len) {
+        *buf++ = tmp[--len];
+    }
+    return buf;
+}
+
+uint8_t event_pop_line(char* buf) {
+    if (event_tail == event_head) {
+        return 0;
+    }
+    event_t event = event_queue[event_tail];
+    compiler_barrier();  // read the event before releasing its slot
+    event_tail = (event_tail + 1) & (EVENT_QUEUE_LEN - 1);
+
+    // Unsolicited lines start with '!', as no response does: !<name>:<arg>:<timestamp>
+    char* ptr = buf;
+    *ptr++ = '!';
+    for (const char* name = EVENT_NAMES[event.type]; *name; name++) {
+        *ptr++ = *name;
+    }
+    *ptr++ = ':';
+    ptr = append_uint(ptr, event.arg);
+    *ptr++ = ':';
+    ptr = append_uint(ptr, event.timestamp);
+    *ptr++ = '\n';
+    return ptr - buf;
+}
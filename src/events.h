@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {
+    EVENT_OVERCURRENT,  // arg: the output that tripped
+    EVENT_UVLO,  // arg: 1 when undervoltage is first seen, 0 when it clears
+    EVENT_BATT_OVERCURRENT,  // arg: 1 when global overcurrent is first seen, 0 when it clears
+    EVENT_BUTTON_INT,  // arg: 1 pressed, 0 released
+    EVENT_BUTTON_EXT,  // arg: 1 pressed, 0 released
+    EVENT_FAN,  // arg: 1 started, 0 stopped
+    EVENT_SHED,  // arg: the output switched off to shed load
+    EVENT_SHED_CLEAR,  // arg: bitmask of the shed outputs that can be enabled again
+    EVENT_RECLOSE,  // arg: the output re-enabled after an overcurrent
+    EVENT_STALL,  // arg: the output flagged by the stall detector
+    EVENT_STALL_CLEAR,  // arg: the output whose stall cleared
+} event_type_t;
+
+typedef struct {
+    uint32_t timestamp;  // uptime in ms
+    event_type_t type;
+    uint8_t arg;
+} event_t;
+
+// Longest formatted event, including the newline
+#define EVENT_MAX_LEN 32
+
+#ifdef FEATURE_EVENTS
+extern volatile bool events_enabled;
+extern volatile uint16_t events_dropped;
+
+// Only to be called from the systick handler, does nothing while events are disabled
+void event_push(event_type_t type, uint8_t arg);
+// Take the oldest event and format it as a line, returning its length or 0 if
+// there are no events. buf must be at least EVENT_MAX_LEN long.
+uint8_t event_pop_line(char* buf);
+#else
+static inline void event_push(event_type_t type, uint8_t arg) {(void)type; (void)arg;}
+static inline uint8_t event_pop_line(char* buf) {(void)buf; return 0;}
+#endif
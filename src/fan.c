@@ -1,18 +1,89 @@
 #include "fan.h"
 
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/timer.h>
+#include "global_vars.h"
+
+static fan_curve_t fan_curve = {
+    .start_temp = FAN_THRESHOLD * 10,
+    .full_temp = (FAN_THRESHOLD + 20) * 10,
+    .min_duty = 30,
+    .hysteresis = 20,
+};
+static volatile uint8_t fan_duty = 0;
+
+static void fan_set_duty(uint8_t duty) {
+    fan_duty = duty;
+    // A compare value past the period holds the output high
+    timer_set_oc_value(TIM1, TIM_OC3, ((uint32_t)duty * FAN_PWM_PERIOD) / 100);
+}
+
 void fan_init(void) {
     gpio_clear(FAN_PORT, FAN_PIN);
     gpio_set_mode(FAN_PORT, GPIO_MODE_OUTPUT_10_MHZ, GPIO_CNF_OUTPUT_PUSHPULL, FAN_PIN);
+
+    rcc_periph_clock_enable(RCC_TIM1);
+    rcc_periph_reset_pulse(RST_TIM1);
+    timer_set_prescaler(TIM1, 0);
+    timer_set_period(TIM1, FAN_PWM_PERIOD - 1);
+    timer_set_mode(TIM1, TIM_CR1_CKD_CK_INT, TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
+    timer_continuous_mode(TIM1);
+    timer_enable_preload(TIM1);
+
+    // With only the N output enabled it follows the PWM without inversion
+    timer_set_oc_mode(TIM1, TIM_OC3, TIM_OCM_PWM1);
+    timer_enable_oc_preload(TIM1, TIM_OC3);
+    fan_set_duty(0);
+    timer_enable_oc_output(TIM1, TIM_OC3N);
+    timer_enable_break_main_output(TIM1);
+    timer_enable_counter(TIM1);
+
+    // TIM1_CH3N is on PB1 with the partial remap. The SWJ bits read as 0 so
+    // are written again, keeping JTAG off.
+    AFIO_MAPR |= AFIO_MAPR_SWJ_CFG_JTAG_OFF_SW_ON | AFIO_MAPR_TIM1_REMAP_PARTIAL_REMAP;
+    gpio_set_mode(FAN_PORT, GPIO_MODE_OUTPUT_10_MHZ, GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, FAN_PIN);
 }
 
 void fan_enable(const bool enable) {
-    if (enable) {
-        gpio_set(FAN_PORT, FAN_PIN);
-    } else {
-        gpio_clear(FAN_PORT, FAN_PIN);
-    }
+    fan_set_duty(enable?100:0);
 }
 
 bool fan_running(void) {
-    return gpio_get(FAN_PORT, FAN_PIN);
+    return fan_duty != 0;
+}
+
+uint8_t fan_get_duty(void) {
+    return fan_duty;
+}
+
+bool fan_set_curve(const fan_curve_t* curve) {
+    if ((curve->full_temp <= curve->start_temp) || (curve->min_duty > 100)) {
+        return false;
+    }
+    fan_curve = *curve;
+    return true;
+}
+
+void fan_get_curve(fan_curve_t* curve) {
+    *curve = fan_curve;
+}
+
+void fan_update(int16_t temp, bool override) {
+    const fan_curve_t* curve = &fan_curve;
+    uint8_t duty = fan_duty;
+
+    if (override || (temp >= curve->full_temp)) {
+        duty = 100;
+    } else if (temp >= curve->start_temp) {
+        // Proportional between the start and full temperatures
+        int32_t span = curve->full_temp - curve->start_temp;
+        duty = curve->min_duty
+            + ((100 - curve->min_duty) * (int32_t)(temp - curve->start_temp)) / span;
+    } else if (temp < (curve->start_temp - curve->hysteresis)) {
+        duty = 0;
+    } else if (duty != 0) {
+        // Within the hysteresis band a running fan stays at its minimum
+        duty = curve->min_duty;
+    }
+    fan_set_duty(duty);
 }
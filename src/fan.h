@@ -1,12 +1,33 @@
 #pragma once
 
+#include <stdint.h>
 #include <stdbool.h>
 #include <libopencm3/stm32/gpio.h>
 
 #define FAN_PORT GPIOB
 #define FAN_PIN GPIO1
 
+// TIM3, whose channel 4 is on the fan pin, drives the buzzer, so the fan
+// uses TIM1's channel 3N on the same pin through the partial remap
+// 72MHz / 2880 => 25kHz, above hearing
+#define FAN_PWM_PERIOD 2880
+
+// Temperatures in 0.1 degrees C, duties in percent
+typedef struct {
+    int16_t start_temp;  // the fan starts here at min_duty
+    int16_t full_temp;  // the fan reaches 100% here
+    uint8_t min_duty;
+    uint8_t hysteresis;  // how far below start_temp the fan stops
+} fan_curve_t;
+
 void fan_init(void);
 
+// Run the fan at full speed or stop it, also when the systick is stopped
 void fan_enable(const bool enable);
 bool fan_running(void);
+uint8_t fan_get_duty(void);
+
+bool fan_set_curve(const fan_curve_t* curve);
+void fan_get_curve(fan_curve_t* curve);
+// Set the duty from the curve, called from the systick with the filtered temperature
+void fan_update(int16_t temp, bool override);
@@ -13,6 +13,15 @@
             "nop;nop;nop;nop;nop;"); \
     } while(0)
 
+// Place a function in RAM so it runs without flash wait states. It's copied
+// there with .data at startup, so it takes the same space in both. Calls
+// between RAM and flash go through veneers added by the linker.
+#ifdef RAMFUNCS
+#define RAMFUNC __attribute__((section(".ramtext"), noinline))
+#else
+#define RAMFUNC
+#endif
+
 #define SERIALNUM_BOOTLOADER_LOC 0x08001FE0
 #define REENTER_BOOTLOADER_RENDEZVOUS 0x08001FFC
 #define BOARD_NAME_SHORT "PBv4B"
@@ -20,6 +29,7 @@
 #define FAN_THRESHOLD 40
 #define BRAIN_OUTPUT OUT_L2
 
+extern volatile uint32_t uptime_ms;
 extern volatile INA219_meas_t battery;
 extern volatile INA219_meas_t reg_5v;
 extern volatile int16_t board_temp;
@@ -12,6 +12,17 @@ static inline bool i2c_transaction_in_progress(void) {return I2C_SR2(I2C1) & I2C
 #define I2C_FAIL_AND_RETURN_ON_NACK(x) if(nack_received()) { \
     i2c_timed_out = true; \
     if (i2c_transaction_in_progress()) {i2c_send_stop(I2C1);} return x;}
+// A stuck bus never sets the flags we wait on, so give up after roughly 0.5ms
+// rather than hanging until the watchdog resets us
+#define I2C_MAX_POLLS 4000
+#define I2C_WAIT_FOR(cond, x) do { \
+    uint16_t polls = 0; \
+    while (!(cond)) { \
+        if (++polls > I2C_MAX_POLLS) { \
+            i2c_timed_out = true; \
+            if (i2c_transaction_in_progress()) {i2c_send_stop(I2C1);} return x; \
+        } \
+    }} while(0)
 
 
 volatile bool i2c_timed_out = false;
@@ -45,14 +56,14 @@ void i2c_start_message(uint8_t addr) {
     i2c_send_start(I2C1);
 
     // Waiting for START to send and switch to controller mode.
-    while (!((I2C_SR1(I2C1) & I2C_SR1_SB)
-        && (I2C_SR2(I2C1) & (I2C_SR2_MSL | I2C_SR2_BUSY))));
+    I2C_WAIT_FOR((I2C_SR1(I2C1) & I2C_SR1_SB)
+        && (I2C_SR2(I2C1) & (I2C_SR2_MSL | I2C_SR2_BUSY)), );
 
     // Say to what address we want to talk to.
     i2c_send_7bit_address(I2C1, addr, I2C_WRITE);
 
     // Waiting for address to transfer.
-    while (!(I2C_SR1(I2C1) & (I2C_SR1_ADDR | I2C_SR1_AF)));
+    I2C_WAIT_FOR(I2C_SR1(I2C1) & (I2C_SR1_ADDR | I2C_SR1_AF), );
     I2C_FAIL_AND_RETURN_ON_NACK();
 
     // Cleaning ADDR condition sequence.
@@ -63,7 +74,7 @@ void i2c_stop_message(void) {
     I2C_RETURN_IF_FAILED();
 
     // Wait for the data register to be empty or a NACK to be generated.
-    while (!(I2C_SR1(I2C1) & (I2C_SR1_TxE | I2C_SR1_AF)));
+    I2C_WAIT_FOR(I2C_SR1(I2C1) & (I2C_SR1_TxE | I2C_SR1_AF), );
     I2C_FAIL_AND_RETURN_ON_NACK();  /// TODO Is a NACK expected here?
 
     // Send STOP condition.
@@ -75,7 +86,7 @@ void i2c_send_byte(char c) {
 
     i2c_send_data(I2C1, c);
     // Wait for byte to complete transferring
-    while (!(I2C_SR1(I2C1) & (I2C_SR1_BTF | I2C_SR1_AF)));
+    I2C_WAIT_FOR(I2C_SR1(I2C1) & (I2C_SR1_BTF | I2C_SR1_AF), );
     I2C_FAIL_AND_RETURN_ON_NACK();
 }
 
@@ -94,8 +105,8 @@ bool i2c_recv_bytes(uint8_t addr, uint8_t* buf, uint8_t len) {
     i2c_send_start(I2C1);
 
     // Waiting for START to send and switch to controller mode.
-    while (!((I2C_SR1(I2C1) & I2C_SR1_SB)
-        && (I2C_SR2(I2C1) & (I2C_SR2_MSL | I2C_SR2_BUSY))));
+    I2C_WAIT_FOR((I2C_SR1(I2C1) & I2C_SR1_SB)
+        && (I2C_SR2(I2C1) & (I2C_SR2_MSL | I2C_SR2_BUSY)), false);
 
     // Say to what address we want to read from.
     i2c_send_7bit_address(I2C1, addr, I2C_READ);
@@ -105,7 +116,7 @@ bool i2c_recv_bytes(uint8_t addr, uint8_t* buf, uint8_t len) {
         i2c_disable_ack(I2C1);
 
         // Waiting for address to transfer.
-        while (!(I2C_SR1(I2C1) & (I2C_SR1_ADDR | I2C_SR1_AF)));
+        I2C_WAIT_FOR(I2C_SR1(I2C1) & (I2C_SR1_ADDR | I2C_SR1_AF), false);
         I2C_FAIL_AND_RETURN_ON_NACK(false);
 
         // Clear ADDR
@@ -115,7 +126,7 @@ bool i2c_recv_bytes(uint8_t addr, uint8_t* buf, uint8_t len) {
         i2c_send_stop(I2C1);
 
         // Read the data after the RxNE flag is set.
-        while (!(I2C_SR1(I2C1) & I2C_SR1_RxNE));
+        I2C_WAIT_FOR(I2C_SR1(I2C1) & I2C_SR1_RxNE, false);
 
         buf[0] = i2c_get_data(I2C1);
     } else if (len == 2) {
@@ -124,7 +135,7 @@ bool i2c_recv_bytes(uint8_t addr, uint8_t* buf, uint8_t len) {
         i2c_nack_next(I2C1);
 
         // Waiting for address to transfer.
-        while (!(I2C_SR1(I2C1) & (I2C_SR1_ADDR | I2C_SR1_AF)));
+        I2C_WAIT_FOR(I2C_SR1(I2C1) & (I2C_SR1_ADDR | I2C_SR1_AF), false);
         I2C_FAIL_AND_RETURN_ON_NACK(false);
 
         // Clear ADDR
@@ -134,7 +145,7 @@ bool i2c_recv_bytes(uint8_t addr, uint8_t* buf, uint8_t len) {
         i2c_disable_ack(I2C1);
 
         // Wait for BTF to be set
-        while (!(I2C_SR1(I2C1) & I2C_SR1_BTF));
+        I2C_WAIT_FOR(I2C_SR1(I2C1) & I2C_SR1_BTF, false);
 
         // Program STOP
         i2c_send_stop(I2C1);
@@ -144,14 +155,14 @@ bool i2c_recv_bytes(uint8_t addr, uint8_t* buf, uint8_t len) {
         buf[1] = i2c_get_data(I2C1);
 
         // Wait for transaction to complete
-        while (I2C_SR2(I2C1) & I2C_SR2_BUSY);
+        I2C_WAIT_FOR(!(I2C_SR2(I2C1) & I2C_SR2_BUSY), false);
         // Reset NACK control
         i2c_nack_current(I2C1);
     } else {
         i2c_enable_ack(I2C1);
 
         // Waiting for address to transfer.
-        while (!(I2C_SR1(I2C1) & (I2C_SR1_ADDR | I2C_SR1_AF)));
+        I2C_WAIT_FOR(I2C_SR1(I2C1) & (I2C_SR1_ADDR | I2C_SR1_AF), false);
         I2C_FAIL_AND_RETURN_ON_NACK(false);
 
         // Clear ADDR
@@ -160,7 +171,7 @@ bool i2c_recv_bytes(uint8_t addr, uint8_t* buf, uint8_t len) {
         uint8_t idx;
         for (idx = 0; idx < (len - 3); idx++) {
             // Read the data after the RxNE flag is set.
-            while (!(I2C_SR1(I2C1) & I2C_SR1_RxNE));
+            I2C_WAIT_FOR(I2C_SR1(I2C1) & I2C_SR1_RxNE, false);
 
             // Reading the data register clears RxNE
             buf[idx] = i2c_get_data(I2C1);
@@ -168,9 +179,9 @@ bool i2c_recv_bytes(uint8_t addr, uint8_t* buf, uint8_t len) {
 
         // DataN-2
         // Wait for DataN-2 to be received (RxNE = 1)
-        while (!(I2C_SR1(I2C1) & I2C_SR1_RxNE));
+        I2C_WAIT_FOR(I2C_SR1(I2C1) & I2C_SR1_RxNE, false);
         // Wait for DataN-1 to be received (BTF = 1)
-        while (!(I2C_SR1(I2C1) & I2C_SR1_BTF));
+        I2C_WAIT_FOR(I2C_SR1(I2C1) & I2C_SR1_BTF, false);
 
         // Now DataN-2 is in DR and DataN-1 is in the shift register
         // Clear ACK bit
@@ -181,7 +192,7 @@ bool i2c_recv_bytes(uint8_t addr, uint8_t* buf, uint8_t len) {
 
         // DataN-1
         // Wait for DataN to be received (BTF = 1)
-        while (!(I2C_SR1(I2C1) & I2C_SR1_BTF));
+        I2C_WAIT_FOR(I2C_SR1(I2C1) & I2C_SR1_BTF, false);
 
         // Program STOP bit
         i2c_send_stop(I2C1);
@@ -191,7 +202,7 @@ bool i2c_recv_bytes(uint8_t addr, uint8_t* buf, uint8_t len) {
 
         // DataN
         // Wait for the receive register to not be empty
-        while (!(I2C_SR1(I2C1) & I2C_SR1_RxNE));
+        I2C_WAIT_FOR(I2C_SR1(I2C1) & I2C_SR1_RxNE, false);
 
         // read byte from DR (DataN)
         buf[idx++] = i2c_get_data(I2C1);
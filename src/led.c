@@ -2,178 +2,175 @@
 
 #include <libopencm3/stm32/gpio.h>
 
-volatile bool led_run_flashing = false;
-volatile bool led_error_flashing = false;
-volatile bool led_flat_flashing = false;
+// Prevent the compiler moving memory accesses across this point
+#define compiler_barrier() __asm__ volatile("" ::: "memory")
+
+typedef struct {
+    uint32_t port;
+    uint16_t pin;
+    bool active_low;
+} led_pin_t;
+
+typedef struct {
+    led_pattern_t pattern;
+    volatile bool running;  // pattern is driven by led_tick
+    uint16_t phase;  // ms into the current flash or gap
+    uint8_t flash;  // flashes given since the last gap
+} led_pattern_state_t;
+
+static const led_pin_t LEDS[] = {
+    {GPIOB, LED_RUN, true},
+    {GPIOB, LED_ERROR, true},
+    {GPIOD, LED_FLAT, true},
+    {GPIOC, LED_STATH0, false},
+    {GPIOC, LED_STATH1, false},
+    {GPIOB, LED_STATL0, false},
+    {GPIOB, LED_STATL1, false},
+    {GPIOB, LED_STATL2, false},
+    {GPIOB, LED_STATL3, false},
+};
+#define NUM_LEDS (sizeof(LEDS) / sizeof(LEDS[0]))
+
+// Ports that have LEDs, the patterns are applied with one write to each
+static const uint32_t LED_PORTS[] = {GPIOB, GPIOC, GPIOD};
+#define NUM_LED_PORTS (sizeof(LED_PORTS) / sizeof(LED_PORTS[0]))
+
+static led_pattern_state_t led_patterns[NUM_LEDS];
+
+
+static int8_t led_index(uint32_t pin) {
+    for (uint8_t i = 0; i < NUM_LEDS; i++) {
+        if (LEDS[i].pin == pin) {
+            return i;
+        }
+    }
+    return -1;
+}
 
+// Drive the pin of LED i, lit or not, without touching its pattern
+static void led_write(uint8_t i, bool lit) {
+    if (lit != LEDS[i].active_low) {
+        gpio_set(LEDS[i].port, LEDS[i].pin);
+    } else {
+        gpio_clear(LEDS[i].port, LEDS[i].pin);
+    }
+}
 
 void led_init(void) {
-    // set pins B8-9, B12-15, C10-11 & D2 to outputs
-    gpio_set_mode(GPIOB, GPIO_MODE_OUTPUT_10_MHZ,
-                  GPIO_CNF_OUTPUT_PUSHPULL, 0xf300);
-    gpio_set_mode(GPIOC, GPIO_MODE_OUTPUT_10_MHZ,
-                  GPIO_CNF_OUTPUT_PUSHPULL, 0x0C00);
-    gpio_set_mode(GPIOD, GPIO_MODE_OUTPUT_10_MHZ,
-                  GPIO_CNF_OUTPUT_PUSHPULL, LED_FLAT);
-
-    // set LEDs to off state
-    gpio_set(GPIOB, LED_RUN|LED_ERROR);  // active low LEDs
-    gpio_set(GPIOD, LED_FLAT);  // active low LEDs
-    gpio_clear(GPIOC, LED_STATH0|LED_STATH1);  // active high LEDs
-    gpio_clear(GPIOB, 0xf000);  // active high LEDs
+    for (uint8_t i = 0; i < NUM_LEDS; i++) {
+        gpio_set_mode(LEDS[i].port, GPIO_MODE_OUTPUT_10_MHZ,
+                      GPIO_CNF_OUTPUT_PUSHPULL, LEDS[i].pin);
+        // set LEDs to off state
+        led_write(i, false);
+    }
 }
 
 void set_led(uint32_t pin) {
-    switch (pin) {
-        // active-low LEDs
-        case LED_RUN:
-        case LED_ERROR:
-            if (pin == LED_RUN) {
-                led_run_flashing = false;
-            } else {
-                led_error_flashing = false;
-            }
-            gpio_clear(GPIOB, pin);
-            break;
-
-        case LED_FLAT:
-            led_flat_flashing = false;
-            gpio_clear(GPIOD, pin);
-            break;
-
-        // active-high LEDs
-        case LED_STATH0:
-        case LED_STATH1:
-            gpio_set(GPIOC, pin);
-            break;
-        case LED_STATL0:
-        case LED_STATL1:
-        case LED_STATL2:
-        case LED_STATL3:
-            gpio_set(GPIOB, pin);
-            break;
-    }
+    int8_t i = led_index(pin);
+    if (i < 0) {return;}
+    led_patterns[i].running = false;
+    led_write(i, true);
 }
 
 void clear_led(uint32_t pin) {
-    switch (pin) {
-        // active-low LEDs
-        case LED_RUN:
-        case LED_ERROR:
-            if (pin == LED_RUN) {
-                led_run_flashing = false;
-            } else {
-                led_error_flashing = false;
-            }
-            gpio_set(GPIOB, pin);
-            break;
-
-        case LED_FLAT:
-            led_flat_flashing = false;
-            gpio_set(GPIOD, pin);
-            break;
-
-        // active-high LEDs
-        case LED_STATH0:
-        case LED_STATH1:
-            gpio_clear(GPIOC, pin);
-            break;
-        case LED_STATL0:
-        case LED_STATL1:
-        case LED_STATL2:
-        case LED_STATL3:
-            gpio_clear(GPIOB, pin);
-            break;
-    }
+    int8_t i = led_index(pin);
+    if (i < 0) {return;}
+    led_patterns[i].running = false;
+    led_write(i, false);
 }
 
 void toggle_led(uint32_t pin) {
-    switch (pin) {
-        case LED_RUN:
-        case LED_ERROR:
-            if (pin == LED_RUN) {
-                led_run_flashing = false;
-            } else {
-                led_error_flashing = false;
-            }
-            gpio_toggle(GPIOB, pin);
-            break;
-
-        case LED_FLAT:
-            led_flat_flashing = false;
-            gpio_toggle(GPIOD, pin);
-            break;
-
-        case LED_STATH0:
-        case LED_STATH1:
-            gpio_toggle(GPIOC, pin);
-            break;
-        case LED_STATL0:
-        case LED_STATL1:
-        case LED_STATL2:
-        case LED_STATL3:
-            gpio_toggle(GPIOB, pin);
-            break;
-    }
+    int8_t i = led_index(pin);
+    if (i < 0) {return;}
+    led_patterns[i].running = false;
+    gpio_toggle(LEDS[i].port, LEDS[i].pin);
 }
 
 uint8_t get_led_state(uint32_t pin) {
-    switch (pin) {
-        // active-low LEDs
-        case LED_RUN:
-            if (led_run_flashing) {
-                return 2;
-            }
-            return (gpio_get(GPIOB, pin)?0:1);
-        case LED_ERROR:
-            if (led_error_flashing) {
-                return 2;
-            }
-            return (gpio_get(GPIOB, pin)?0:1);
-        case LED_FLAT:
-            if (led_flat_flashing) {
-                return 2;
-            }
-            return (gpio_get(GPIOD, pin)?0:1);
-
-        // active-high LEDs
-        case LED_STATH0:
-        case LED_STATH1:
-            return (gpio_get(GPIOC, pin)?1:0);
-        case LED_STATL0:
-        case LED_STATL1:
-        case LED_STATL2:
-        case LED_STATL3:
-            return (gpio_get(GPIOB, pin)?1:0);
-        default:
-            return 0;
+    // 0 off, 1 on, 2 running a pattern
+    int8_t i = led_index(pin);
+    if (i < 0) {return 0;}
+    if (led_patterns[i].running) {
+        return 2;
     }
+    bool high = gpio_get(LEDS[i].port, LEDS[i].pin);
+    return (high != LEDS[i].active_low)?1:0;
 }
 
 void set_led_flash(uint32_t pin) {
-    switch (pin) {
-        case LED_RUN:
-            led_run_flashing = true;
-            break;
-        case LED_ERROR:
-            led_error_flashing = true;
-            break;
-        case LED_FLAT:
-            led_flat_flashing = true;
-            break;
-
-        default:
-            break;
+    const led_pattern_t flash = {
+        .period = LED_FLASH_PERIOD,
+        .on_time = LED_FLASH_PERIOD / 2,
+    };
+    set_led_pattern(pin, &flash);
+}
+
+bool set_led_pattern(uint32_t pin, const led_pattern_t* pattern) {
+    int8_t i = led_index(pin);
+    if ((i < 0) || (pattern->period == 0) || (pattern->on_time > pattern->period)) {
+        return false;
     }
+    led_pattern_state_t* state = &led_patterns[i];
+
+    // Stop the tick using the pattern while it's replaced
+    state->running = false;
+    compiler_barrier();
+    state->pattern = *pattern;
+    state->phase = 0;
+    state->flash = 0;
+    led_write(i, pattern->on_time != 0);
+    compiler_barrier();
+    state->running = true;
+    return true;
 }
-void handle_led_flash(void) {
-    if (led_run_flashing) {
-        gpio_toggle(GPIOB, LED_RUN);
+
+bool get_led_pattern(uint32_t pin, led_pattern_t* pattern) {
+    int8_t i = led_index(pin);
+    if ((i < 0) || !led_patterns[i].running) {
+        return false;
     }
-    if (led_error_flashing) {
-        gpio_toggle(GPIOB, LED_ERROR);
+    *pattern = led_patterns[i].pattern;
+    return true;
+}
+
+// Called every ms from the systick
+void led_tick(void) {
+    uint16_t set[NUM_LED_PORTS] = {0};
+    uint16_t clear[NUM_LED_PORTS] = {0};
+
+    for (uint8_t i = 0; i < NUM_LEDS; i++) {
+        led_pattern_state_t* state = &led_patterns[i];
+        if (!state->running) {continue;}
+        const led_pattern_t* pattern = &state->pattern;
+
+        state->phase++;
+        bool in_gap = (pattern->count != 0) && (state->flash >= pattern->count);
+        if (in_gap) {
+            if (state->phase >= pattern->gap) {
+                state->phase = 0;
+                state->flash = 0;
+                in_gap = false;
+            }
+        } else if (state->phase >= pattern->period) {
+            state->phase = 0;
+            state->flash++;
+            in_gap = (pattern->count != 0) && (state->flash >= pattern->count);
+        }
+        bool lit = !in_gap && (state->phase < pattern->on_time);
+
+        for (uint8_t p = 0; p < NUM_LED_PORTS; p++) {
+            if (LED_PORTS[p] != LEDS[i].port) {continue;}
+            if (lit != LEDS[i].active_low) {
+                set[p] |= LEDS[i].pin;
+            } else {
+                clear[p] |= LEDS[i].pin;
+            }
+        }
     }
-    if (led_flat_flashing) {
-        gpio_toggle(GPIOB, LED_FLAT);
+
+    for (uint8_t p = 0; p < NUM_LED_PORTS; p++) {
+        if (set[p] | clear[p]) {
+            GPIO_BSRR(LED_PORTS[p]) = set[p] | ((uint32_t)clear[p] << 16);
+        }
     }
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #define LED_RUN GPIO8
 #define LED_ERROR GPIO9
@@ -12,6 +13,18 @@
 #define LED_STATL2 GPIO14
 #define LED_STATL3 GPIO15
 
+// The pattern used for LED:<name>:SET:F
+#define LED_FLASH_PERIOD 2000
+
+// A repeating blink pattern, all times in ms. With count set the LED gives
+// count flashes then stays off for gap, so faults can be told apart by eye.
+typedef struct {
+    uint16_t period;  // length of one flash, 0 for no pattern
+    uint16_t on_time;  // time lit in each flash
+    uint8_t count;  // flashes before the gap, 0 to flash continuously
+    uint16_t gap;  // time off after count flashes
+} led_pattern_t;
+
 
 void led_init(void);
 
@@ -21,4 +34,6 @@ void toggle_led(uint32_t pin);
 uint8_t get_led_state(uint32_t pin);
 
 void set_led_flash(uint32_t pin);
-void handle_led_flash(void);
+bool set_led_pattern(uint32_t pin, const led_pattern_t* pattern);
+bool get_led_pattern(uint32_t pin, led_pattern_t* pattern);
+void led_tick(void);
@@ -0,0 +1,172 @@
+#include <string.h>
+
+#include "macro.h"
+
+typedef struct {
+    macro_trigger_t trigger;
+    uint16_t arg;
+    char commands[MACRO_MAX_LEN + 1];
+    // Incremented by the systick handler and the main loop respectively,
+    // the macro is due to run when they differ
+    volatile uint8_t triggered;
+    uint8_t handled;
+    bool run_requested;
+    bool batt_armed;
+    uint16_t runs;
+    uint16_t failures;
+} macro_t;
+
+static macro_t macros[MACRO_COUNT] = {0};
+
+bool macro_set_trigger(uint8_t macro, macro_trigger_t trigger, uint16_t arg) {
+    if (macro >= MACRO_COUNT) {
+        return false;
+    }
+    // Disable the trigger while it's changed, so the systick doesn't see half of it
+    macros[macro].trigger = MACRO_TRIG_NONE;
+    macros[macro].arg = arg;
+    macros[macro].batt_armed = false;
+    macros[macro].handled = macros[macro].triggered;
+    macros[macro].trigger = trigger;
+    return true;
+}
+
+bool macro_add(uint8_t macro, const char* command) {
+    if ((macro >= MACRO_COUNT) || (command[0] == MSG_TAG_PREFIX)
+            || (strchr(command, BATCH_SEPARATOR) != NULL) || (strncmp(command, "MACRO", 5) == 0)) {
+        return false;
+    }
+    char* commands = macros[macro].commands;
+    size_t len = strlen(commands);
+    if (macro_added_len(len, command) > MACRO_MAX_LEN) {
+        return false;
+    }
+    if (len > 0) {
+        commands[len++] = BATCH_SEPARATOR;
+    }
+    strcpy(commands + len, command);
+    return true;
+}
+
+size_t macro_added_len(size_t len, const char* command) {
+    // Commands after the first follow a separator
+    return len + ((len > 0) ? 1 : 0) + strlen(command);
+}
+
+void macro_clear(uint8_t macro) {
+    if (macro >= MACRO_COUNT) {
+        return;
+    }
+    macro_set_trigger(macro, MACRO_TRIG_NONE, 0);
+    macros[macro].commands[0] = '\0';
+    macros[macro].run_requested = false;
+    macros[macro].runs = 0;
+    macros[macro].failures = 0;
+}
+
+void macro_clear_all(void) {
+    for (uint8_t i = 0; i < MACRO_COUNT; i++) {
+        macro_clear(i);
+    }
+}
+
+macro_trigger_t macro_get_trigger(uint8_t macro, uint16_t* arg) {
+    *arg = macros[macro].arg;
+    return macros[macro].trigger;
+}
+const char* macro_get_commands(uint8_t macro) {
+    return macros[macro].commands;
+}
+uint16_t macro_get_runs(uint8_t macro) {
+    return macros[macro].runs;
+}
+uint16_t macro_get_failures(uint8_t macro) {
+    return macros[macro].failures;
+}
+
+void macro_trigger_button(void) {
+    for (uint8_t i = 0; i < MACRO_COUNT; i++) {
+        if (macros[i].trigger == MACRO_TRIG_BTN) {
+            macros[i].triggered++;
+        }
+    }
+}
+
+void macro_trigger_overcurrent(uint8_t out) {
+    for (uint8_t i = 0; i < MACRO_COUNT; i++) {
+        if (
+            (macros[i].trigger == MACRO_TRIG_OC)
+            && ((macros[i].arg == MACRO_ANY_OUTPUT) || (macros[i].arg == out))
+        ) {
+            macros[i].triggered++;
+        }
+    }
+}
+
+void macro_check_battery(uint16_t voltage) {
+    for (uint8_t i = 0; i < MACRO_COUNT; i++) {
+        if (macros[i].trigger != MACRO_TRIG_BATT) {
+            continue;
+        }
+        // Fire once on falling below the threshold, re-arm once well above it
+        if (voltage > macros[i].arg + MACRO_BATT_HYSTERESIS) {
+            macros[i].batt_armed = true;
+        } else if (macros[i].batt_armed && (voltage < macros[i].arg)) {
+            macros[i].batt_armed = false;
+            macros[i].triggered++;
+        }
+    }
+}
+
+// Whether any command of a batch's response, or a single response, NACKed
+static bool response_failed(const char* response) {
+    if (response[0] == MSG_TAG_PREFIX) {
+        const char* space = strchr(response, ' ');
+        response = (space != NULL) ? space + 1 : "";
+    }
+    const char* field = response;
+    while (strncmp(field, "NACK", 4) != 0) {
+        field = strchr(field, BATCH_SEPARATOR);
+        if (field == NULL) {
+            return false;
+        }
+        field++;
+    }
+    return true;
+}
+
+static void macro_execute(uint8_t macro) {
+    char line[MACRO_MAX_LEN + 1];
+    char response[MSG_RESPONSE_MAX_LEN + 1];
+
+    if (macros[macro].commands[0] == '\0') {
+        return;
+    }
+    // handle_msg modifies the line as it parses it
+    strcpy(line, macros[macro].commands);
+    handle_msg(line, response, MSG_RESPONSE_MAX_LEN);
+
+    macros[macro].runs++;
+    if (response_failed(response)) {
+        macros[macro].failures++;
+    }
+}
+
+void macro_run(uint8_t macro) {
+    // Deferred so handle_msg isn't reentered
+    if (macro < MACRO_COUNT) {
+        macros[macro].run_requested = true;
+    }
+}
+
+void macro_poll(void) {
+    for (uint8_t i = 0; i < MACRO_COUNT; i++) {
+        uint8_t triggered = macros[i].triggered;
+        if ((triggered != macros[i].handled) || macros[i].run_requested) {
+            // Triggers that arrive before the macro runs are merged into one run
+            macros[i].handled = triggered;
+            macros[i].run_requested = false;
+            macro_execute(i);
+        }
+    }
+}
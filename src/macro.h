@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "msg_handler.h"
+
+#define MACRO_COUNT 4
+// Longest macro, the commands are run as one batch line
+#define MACRO_MAX_LEN MSG_MAX_LEN
+// The battery must rise this far above a macro's threshold to re-arm it, mV
+#define MACRO_BATT_HYSTERESIS 200
+
+typedef enum {
+    MACRO_TRIG_NONE,
+    MACRO_TRIG_BTN,  // either start button is pressed
+    MACRO_TRIG_OC,  // an output trips, arg is the output or MACRO_ANY_OUTPUT
+    MACRO_TRIG_BATT,  // the battery voltage falls below arg mV
+} macro_trigger_t;
+
+#define MACRO_ANY_OUTPUT 0xffff
+
+// Commands are added one at a time and run as a batch, so either they all
+// take effect or none do. All return false if the macro can't be changed,
+// a macro can't contain MACRO commands, and each command is added untagged
+// and without separators.
+bool macro_set_trigger(uint8_t macro, macro_trigger_t trigger, uint16_t arg);
+bool macro_add(uint8_t macro, const char* command);
+void macro_clear(uint8_t macro);
+// Length of commands of length len once command is added, which macro_add
+// only allows up to MACRO_MAX_LEN
+size_t macro_added_len(size_t len, const char* command);
+
+macro_trigger_t macro_get_trigger(uint8_t macro, uint16_t* arg);
+const char* macro_get_commands(uint8_t macro);
+uint16_t macro_get_runs(uint8_t macro);
+uint16_t macro_get_failures(uint8_t macro);
+
+#ifdef FEATURE_MACROS
+void macro_clear_all(void);
+
+// Only to be called from the systick handler
+void macro_trigger_button(void);
+void macro_trigger_overcurrent(uint8_t out);
+void macro_check_battery(uint16_t voltage);
+
+// Run triggered macros, and those requested with macro_run. Only to be called
+// from the main loop, outside handle_msg.
+void macro_poll(void);
+void macro_run(uint8_t macro);
+#else
+static inline void macro_clear_all(void) {}
+static inline void macro_trigger_button(void) {}
+static inline void macro_trigger_overcurrent(uint8_t out) {(void)out;}
+static inline void macro_check_battery(uint16_t voltage) {(void)voltage;}
+static inline void macro_poll(void) {}
+#endif
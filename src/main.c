@@ -13,6 +13,9 @@
 #include "adc.h"
 #include "output.h"
 #include "buzzer.h"
+#include "sched.h"
+#include "macro.h"
+#include "spectrum.h"
 #include "global_vars.h"
 
 void init(void);
@@ -38,6 +41,8 @@ int main(void) {
 
     while (1) {
         usb_poll();
+        macro_poll();
+        spectrum_poll();
         if (re_enter_bootloader) {
             jump_to_bootloader();
         }
@@ -69,6 +74,7 @@ void init(void) {
     adc_init();
     outputs_init();
     buzzer_init();
+    sched_init();
     systick_init();
 
     // Configure watchdog. Period: 50ms
@@ -4,35 +4,684 @@
 #include <ctype.h>
 
 #include "msg_handler.h"
+#include "nack.h"
 #include "global_vars.h"
 #include "output.h"
 #include "led.h"
 #include "fan.h"
 #include "buzzer.h"
+#include "telemetry.h"
+#include "events.h"
+#include "button.h"
+#include "sched.h"
+#include "macro.h"
+#include "soc.h"
+#include "admit.h"
+#include "reclose.h"
+#include "stall.h"
+#include "scope.h"
+#include "rollup.h"
+#include "systick.h"
+#include "spectrum.h"
 
 static char* itoa(int value, char* string);
+static char* utoa(unsigned int value, char* string);
+
+#ifdef FEATURE_MACROS
+static const char* const MACRO_TRIGGER_NAMES[] = {
+    [MACRO_TRIG_NONE] = "NONE",
+    [MACRO_TRIG_BTN] = "BTN",
+    [MACRO_TRIG_OC] = "OC",
+    [MACRO_TRIG_BATT] = "BATT",
+};
+#endif
+#ifdef FEATURE_SCOPE
+static const char* const SCOPE_STATE_NAMES[] = {
+    [SCOPE_IDLE] = "IDLE",
+    [SCOPE_ARMED] = "ARMED",
+    [SCOPE_TRIGGERED] = "TRIGGERED",
+    [SCOPE_DONE] = "DONE",
+};
+// Samples in each SCOPE:DATA? response, 4 hex digits each
+#define SCOPE_DATA_CHUNK 31
+#endif
+#ifdef FEATURE_STALL
+static const char* const STALL_REASON_NAMES[] = {
+    [STALL_NONE] = "NONE",
+    [STALL_STEP] = "STEP",
+    [STALL_PLATEAU] = "PLATEAU",
+};
+#endif
+#ifdef FEATURE_SPECTRUM
+static const char* const SPECTRUM_STATE_NAMES[] = {
+    [SPECTRUM_IDLE] = "IDLE",
+    [SPECTRUM_CAPTURING] = "CAPTURING",
+    [SPECTRUM_COMPUTING] = "COMPUTING",
+};
+#endif
+
+static void handle_cmd(char* buf, char* response, int max_len, bool execute);
+static void handle_batch(char* buf, char* response, int max_len);
 
 static void append_str(char* dest, const char* src, int dest_max_len) {
     strncat(dest, src, dest_max_len - strlen(dest));
 }
-static char* get_next_arg(char* response, const char* err_msg, int max_len) {
+#if defined(FEATURE_SCOPE) || defined(FEATURE_ROLLUP)
+// Append value as 4 hex digits
+static void append_hex16(char* response, uint16_t value, int max_len) {
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+    char hex[5];
+    for (uint8_t digit = 0; digit < 4; digit++) {
+        hex[digit] = HEX_DIGITS[(value >> (12 - 4 * digit)) & 0xf];
+    }
+    hex[4] = '\0';
+    append_str(response, hex, max_len);
+}
+#endif
+static char* get_next_arg(char* response, nack_t missing, int max_len) {
     char* next_arg = strtok(NULL, ":");
     if (next_arg == NULL) {
-        strncat(response, err_msg, max_len);
+        nack_append(response, missing, max_len);
         return NULL;
     }
     return next_arg;
 }
 
+#ifdef FEATURE_ADMIT
+// Whether an enable fits in the current budget, reserving the output's draw
+// if it's going to be executed, or claiming it for the rest of the batch
+// while validating
+static bool admit_enable(output_t out, char* response, int max_len, bool execute) {
+    telemetry_t telemetry;
+    telemetry_read(&telemetry);
+    if (!admit_fits(out, &telemetry.admit)) {
+        nack_append(response, NACK_OVER_CURRENT_BUDGET, max_len);
+        return false;
+    }
+    if (execute) {
+        admit_reserve(out, &telemetry.admit);
+    } else {
+        admit_batch_claim(out, &telemetry.admit);
+    }
+    return true;
+}
+
+// Give back the draw reserved by admit_enable when the enable didn't happen
+static void admit_refund(output_t out) {
+    telemetry_t telemetry;
+    telemetry_read(&telemetry);
+    admit_release(out, &telemetry.admit);
+}
+#else
+// Without admission control every enable fits
+static bool admit_enable(output_t out, char* response, int max_len, bool execute) {
+    (void)out; (void)response; (void)max_len; (void)execute;
+    return true;
+}
+
+static void admit_refund(output_t out) {(void)out;}
+#endif
+
+#ifdef FEATURE_SCHED
+// Scheduled changes needed by the commands of a batch validated so far, so
+// the batch is rejected up front if it wouldn't all fit
+static uint8_t batch_sched = 0;
+#endif
+
+#ifdef FEATURE_MACROS
+// Length of each macro the commands of a batch validated so far change, so
+// an ADD that won't fit is rejected before any of the batch runs
+static uint8_t batch_macro_len[MACRO_COUNT];
+static uint8_t batch_macros = 0;  // a bit for each macro changed
+
+// Length of a macro's commands, as the batch being validated has left them
+static size_t macro_len(uint8_t macro, bool execute) {
+    if (!execute && (batch_macros & (1 << macro))) {
+        return batch_macro_len[macro];
+    }
+    return strlen(macro_get_commands(macro));
+}
+
+static void batch_macro_set_len(uint8_t macro, size_t len) {
+    batch_macro_len[macro] = len;
+    batch_macros |= 1 << macro;
+}
+#endif
+
+#ifdef FEATURE_SCHED
+// Whether a change can be scheduled, claiming it for the rest of the batch
+// while validating
+static bool sched_claim(bool execute) {
+    if (execute) {
+        return sched_available(1);
+    }
+    if (!sched_available(batch_sched + 1)) {
+        return false;
+    }
+    batch_sched++;
+    return true;
+}
+#endif
+
+// Handle a <state>[@<uptime>] argument, switching the output now or
+// scheduling it to switch when the uptime reaches the given ms
+static void set_output_state(
+    output_t out, const char* arg, nack_t invalid,
+    char* response, int max_len, bool execute
+) {
+    if ((arg[0] != '0') && (arg[0] != '1')) {
+        nack_append(response, invalid, max_len);
+        return;
+    }
+    bool state = (arg[0] == '1');
+    if (state && output_shed[out]) {
+        nack_append(response, NACK_OUTPUT_SHED, max_len);
+        return;
+    }
+
+    const char* at = strchr(arg, '@');
+    if (at == NULL) {
+        // Checked while validating, so a batch doesn't run with one of its enables failing
+        if (state && output_inhibited[out]) {
+            nack_append(response, NACK_OUTPUT_TRIPPED, max_len);
+            return;
+        }
+        if (state && !admit_enable(out, response, max_len, execute)) {return;}
+        if (execute) {
+            // An explicit change overrides anything scheduled or a pending reclose
+            sched_cancel(out);
+            if (!state) {
+                reclose_cancel(out);
+            }
+            if (!enable_output(out, state) && state) {
+                // Tripped since it was checked
+                admit_refund(out);
+                nack_append(response, NACK_OUTPUT_TRIPPED, max_len);
+                return;
+            }
+        }
+        append_str(response, "ACK", max_len);
+        return;
+    }
+
+#ifdef FEATURE_SCHED
+    if (!isdigit((int)at[1])) {
+        nack_append(response, NACK_INVALID_SCHEDULED_TIME, max_len);
+        return;
+    }
+    uint32_t due = strtoul(at + 1, NULL, 10);
+    if ((int32_t)(due - uptime_ms) <= 0) {
+        nack_append(response, NACK_SCHEDULED_TIME_HAS_PASSED, max_len);
+        return;
+    }
+    if (!sched_claim(execute) || (execute && !sched_output(out, state, due))) {
+        nack_append(response, NACK_TOO_MANY_SCHEDULED_CHANGES, max_len);
+        return;
+    }
+    append_str(response, "ACK", max_len);
+#else
+    // Changes can't be scheduled without the scheduler
+    nack_append(response, invalid, max_len);
+#endif
+}
+
+#ifdef FEATURE_SCHED
+// Switch the output to state now, and back after the duration in ms given by arg
+static void pulse_output(
+    output_t out, const char* arg, bool state,
+    char* response, int max_len, bool execute
+) {
+    if (!isdigit((int)arg[0])) {
+        nack_append(response, NACK_INVALID_PULSE_DURATION, max_len);
+        return;
+    }
+    unsigned long duration = strtoul(arg, NULL, 10);
+    if ((duration == 0) || (duration > INT32_MAX)) {
+        nack_append(response, NACK_INVALID_PULSE_DURATION, max_len);
+        return;
+    }
+    if (state && output_shed[out]) {
+        nack_append(response, NACK_OUTPUT_SHED, max_len);
+        return;
+    }
+    if (state && output_inhibited[out]) {
+        nack_append(response, NACK_OUTPUT_TRIPPED, max_len);
+        return;
+    }
+    if (!sched_claim(execute)) {
+        nack_append(response, NACK_TOO_MANY_SCHEDULED_CHANGES, max_len);
+        return;
+    }
+    if (state && !admit_enable(out, response, max_len, execute)) {return;}
+    if (execute) {
+        sched_cancel(out);
+        if (!state) {
+            reclose_cancel(out);
+        }
+        if (!enable_output(out, state) && state) {
+            admit_refund(out);
+            nack_append(response, NACK_OUTPUT_TRIPPED, max_len);
+            return;
+        }
+        sched_output(out, !state, uptime_ms + duration);
+    }
+    append_str(response, "ACK", max_len);
+}
+#endif
+
+// Parse a uint16_t argument, returning false if it's missing or invalid
+static bool parse_u16(const char* arg, uint16_t* value) {
+    if ((arg == NULL) || !isdigit((int)arg[0])) {
+        return false;
+    }
+    unsigned long parsed = strtoul(arg, NULL, 10);
+    if (parsed > UINT16_MAX) {
+        return false;
+    }
+    *value = parsed;
+    return true;
+}
+
+#ifdef FEATURE_SCOPE
+static void handle_scope(char* response, int max_len, bool execute) {
+    char temp_str[12];
+    char* next_arg = get_next_arg(response, NACK_MISSING_SCOPE_COMMAND, max_len);
+    if(next_arg == NULL) {return;}
+
+    if (strcmp(next_arg, "ARM") == 0) {
+        // <source>:<threshold>[:<pre-trigger samples>]
+        next_arg = get_next_arg(response, NACK_MISSING_SCOPE_SOURCE, max_len);
+        if(next_arg == NULL) {return;}
+
+        uint16_t source;
+        if (strcmp(next_arg, "BATT") == 0) {
+            source = SCOPE_SOURCE_BATT;
+        } else if (!parse_u16(next_arg, &source) || (source > OUT_5V)) {
+            nack_append(response, NACK_INVALID_SCOPE_SOURCE, max_len);
+            return;
+        }
+        uint16_t threshold;
+        if (!parse_u16(strtok(NULL, ":"), &threshold)) {
+            nack_append(response, NACK_INVALID_SCOPE_THRESHOLD, max_len);
+            return;
+        }
+        uint16_t pre = SCOPE_LEN / 4;
+        next_arg = strtok(NULL, ":");
+        if ((next_arg != NULL) && (!parse_u16(next_arg, &pre) || (pre >= SCOPE_LEN))) {
+            nack_append(response, NACK_INVALID_SCOPE_PRE_TRIGGER, max_len);
+            return;
+        }
+        if (execute) {scope_arm(source, threshold, pre);}
+        append_str(response, "ACK", max_len);
+        return;
+    } else if (strcmp(next_arg, "STOP") == 0) {
+        if (execute) {scope_stop();}
+        append_str(response, "ACK", max_len);
+        return;
+    } else if (strcmp(next_arg, "GET?") == 0) {
+        // <state>:<source>:<pre-trigger samples>:<trigger uptime>:<interval>
+        uint8_t source = scope_source();
+        append_str(response, SCOPE_STATE_NAMES[scope_get_state()], max_len);
+        append_str(response, ":", max_len);
+        if (source == SCOPE_SOURCE_BATT) {
+            append_str(response, "BATT", max_len);
+        } else {
+            append_str(response, utoa(source, temp_str), max_len);
+        }
+        append_str(response, ":", max_len);
+        append_str(response, utoa(scope_pre_trigger(), temp_str), max_len);
+        append_str(response, ":", max_len);
+        append_str(response, utoa(scope_trigger_time(), temp_str), max_len);
+        append_str(response, ":", max_len);
+        append_str(response, utoa(scope_interval(source), temp_str), max_len);
+        return;
+    } else if (strcmp(next_arg, "DATA?") == 0) {
+        // Samples from <offset> in time order, as 4 hex digits each
+        uint16_t offset;
+        if (!parse_u16(strtok(NULL, ":"), &offset) || (offset >= SCOPE_LEN)) {
+            nack_append(response, NACK_INVALID_SCOPE_OFFSET, max_len);
+            return;
+        }
+        if (scope_get_state() != SCOPE_DONE) {
+            nack_append(response, NACK_CAPTURE_NOT_DONE, max_len);
+            return;
+        }
+        uint16_t samples[SCOPE_DATA_CHUNK];
+        uint16_t count = (max_len - strlen(response)) / 4;
+        if (count > SCOPE_DATA_CHUNK) {
+            count = SCOPE_DATA_CHUNK;
+        }
+        count = scope_read(offset, samples, count);
+        for (uint16_t i = 0; i < count; i++) {
+            append_hex16(response, samples[i], max_len);
+        }
+        return;
+    }
+    nack_append(response, NACK_INVALID_SCOPE_COMMAND, max_len);
+}
+#endif
+
+#ifdef FEATURE_ROLLUP
+static void handle_rollup(char* response, int max_len) {
+    char temp_str[12];
+    char* next_arg = get_next_arg(response, NACK_MISSING_ROLLUP_COMMAND, max_len);
+    if(next_arg == NULL) {return;}
+
+    bool data = (strcmp(next_arg, "DATA?") == 0);
+    if (!data && (strcmp(next_arg, "GET?") != 0)) {
+        nack_append(response, NACK_INVALID_ROLLUP_COMMAND, max_len);
+        return;
+    }
+    uint16_t tier;
+    if (!parse_u16(strtok(NULL, ":"), &tier) || (tier >= ROLLUP_TIERS)) {
+        nack_append(response, NACK_INVALID_ROLLUP_TIER, max_len);
+        return;
+    }
+
+    if (!data) {
+        // <buckets written>:<bucket length>:<buckets kept>
+        append_str(response, utoa(rollup_written(tier), temp_str), max_len);
+        append_str(response, ":", max_len);
+        append_str(response, utoa(rollup_interval(tier), temp_str), max_len);
+        append_str(response, ":", max_len);
+        append_str(response, utoa(ROLLUP_LEN, temp_str), max_len);
+        return;
+    }
+
+    // <channel>:<first bucket>, returning <timestamp of the first>:<min><mean><max>...
+    uint16_t channel;
+    if (!parse_u16(strtok(NULL, ":"), &channel) || (channel >= ROLLUP_CHANNELS)) {
+        nack_append(response, NACK_INVALID_ROLLUP_CHANNEL, max_len);
+        return;
+    }
+    next_arg = get_next_arg(response, NACK_MISSING_ROLLUP_BUCKET, max_len);
+    if(next_arg == NULL) {return;}
+    if (!isdigit((int)next_arg[0])) {
+        nack_append(response, NACK_INVALID_ROLLUP_BUCKET, max_len);
+        return;
+    }
+    uint32_t seq = strtoul(next_arg, NULL, 10);
+
+    rollup_bucket_t bucket;
+    if (!rollup_read(tier, seq, &bucket)) {
+        nack_append(response, NACK_BUCKET_NOT_HELD, max_len);
+        return;
+    }
+    append_str(response, utoa(bucket.timestamp, temp_str), max_len);
+    append_str(response, ":", max_len);
+    do {
+        if ((max_len - (int)strlen(response)) < 12) {break;}
+        append_hex16(response, bucket.min[channel], max_len);
+        append_hex16(response, bucket.mean[channel], max_len);
+        append_hex16(response, bucket.max[channel], max_len);
+        seq++;
+    } while (rollup_read(tier, seq, &bucket));
+}
+#endif
+
+#ifdef FEATURE_SPECTRUM
+static void handle_spectrum(char* response, int max_len, bool execute) {
+    char temp_str[12];
+    char* next_arg = get_next_arg(response, NACK_MISSING_SPECTRUM_COMMAND, max_len);
+    if(next_arg == NULL) {return;}
+
+    if (strcmp(next_arg, "START") == 0) {
+        // <source>[:<decimate>]
+        next_arg = get_next_arg(response, NACK_MISSING_SPECTRUM_SOURCE, max_len);
+        if(next_arg == NULL) {return;}
+
+        uint16_t source;
+        if (strcmp(next_arg, "BATT") == 0) {
+            source = SPECTRUM_SOURCE_BATT;
+        } else if (!parse_u16(next_arg, &source) || (source > OUT_5V)) {
+            nack_append(response, NACK_INVALID_SPECTRUM_SOURCE, max_len);
+            return;
+        }
+        uint16_t decimate = 1;
+        next_arg = strtok(NULL, ":");
+        if ((next_arg != NULL) && (!parse_u16(next_arg, &decimate)
+                || (decimate == 0) || (decimate > SPECTRUM_MAX_DECIMATE))) {
+            nack_append(response, NACK_INVALID_SPECTRUM_DECIMATION, max_len);
+            return;
+        }
+        if (execute) {spectrum_start(source, decimate);}
+        append_str(response, "ACK", max_len);
+        return;
+    } else if (strcmp(next_arg, "STOP") == 0) {
+        if (execute) {spectrum_stop();}
+        append_str(response, "ACK", max_len);
+        return;
+    } else if (strcmp(next_arg, "GET?") == 0) {
+        // <state>:<source>:<interval>:<blocks>
+        uint8_t source = spectrum_source();
+        append_str(response, SPECTRUM_STATE_NAMES[spectrum_get_state()], max_len);
+        append_str(response, ":", max_len);
+        if (source == SPECTRUM_SOURCE_BATT) {
+            append_str(response, "BATT", max_len);
+        } else {
+            append_str(response, utoa(source, temp_str), max_len);
+        }
+        append_str(response, ":", max_len);
+        append_str(response, utoa(spectrum_interval(), temp_str), max_len);
+        append_str(response, ":", max_len);
+        append_str(response, utoa(spectrum_blocks(), temp_str), max_len);
+        return;
+    }
+
+    bool peaks = (strcmp(next_arg, "PEAK?") == 0);
+    if (!peaks && (strcmp(next_arg, "BAND?") != 0)) {
+        nack_append(response, NACK_INVALID_SPECTRUM_COMMAND, max_len);
+        return;
+    }
+    if (spectrum_blocks() == 0) {
+        nack_append(response, NACK_NO_SPECTRUM_YET, max_len);
+        return;
+    }
+    const spectrum_result_t* result = spectrum_result();
+    append_str(response, utoa(result->timestamp, temp_str), max_len);
+    if (peaks) {
+        // <time>:<mean>:<freq>:<amplitude>... largest first
+        append_str(response, ":", max_len);
+        append_str(response, utoa(result->mean, temp_str), max_len);
+        for (uint8_t i = 0; i < SPECTRUM_PEAKS; i++) {
+            append_str(response, ":", max_len);
+            append_str(response, utoa(result->peak_freq[i], temp_str), max_len);
+            append_str(response, ":", max_len);
+            append_str(response, utoa(result->peak_amp[i], temp_str), max_len);
+        }
+    } else {
+        // <time>:<rms>:<band rms>...
+        append_str(response, ":", max_len);
+        append_str(response, utoa(result->rms, temp_str), max_len);
+        for (uint8_t i = 0; i < SPECTRUM_BANDS; i++) {
+            append_str(response, ":", max_len);
+            append_str(response, utoa(result->band_rms[i], temp_str), max_len);
+        }
+    }
+}
+#endif
+
+#ifdef FEATURE_SEQUENCES
+static void handle_note_seq(char* response, int max_len, bool execute) {
+    char temp_str[12];
+    char* next_arg = get_next_arg(response, NACK_MISSING_SEQUENCE_COMMAND, max_len);
+    if(next_arg == NULL) {return;}
+
+    if (strcmp(next_arg, "ADD") == 0) {
+        // One or more <freq>:<duration>:<rest> notes, added all or none
+        buzzer_seq_note_t notes[BUZZER_SEQ_LEN];
+        uint8_t num_notes = 0;
+        while ((next_arg = strtok(NULL, ":")) != NULL) {
+            if (num_notes >= buzzer_seq_space()) {
+                nack_append(response, NACK_SEQUENCE_FULL, max_len);
+                return;
+            }
+            buzzer_seq_note_t* note = &notes[num_notes++];
+            if (!parse_u16(next_arg, &note->freq)
+                    || !parse_u16(strtok(NULL, ":"), &note->duration)
+                    || !parse_u16(strtok(NULL, ":"), &note->rest)) {
+                nack_append(response, NACK_INVALID_SEQUENCE_NOTE, max_len);
+                return;
+            }
+        }
+        if (num_notes == 0) {
+            nack_append(response, NACK_MISSING_SEQUENCE_NOTE, max_len);
+            return;
+        }
+        if (execute) {
+            for (uint8_t i = 0; i < num_notes; i++) {
+                buzzer_seq_add(notes[i].freq, notes[i].duration, notes[i].rest);
+            }
+        }
+        append_str(response, "ACK", max_len);
+        return;
+    } else if (strcmp(next_arg, "CLEAR") == 0) {
+        if (execute) {buzzer_seq_clear();}
+        append_str(response, "ACK", max_len);
+        return;
+    } else if ((strcmp(next_arg, "PLAY") == 0) || (strcmp(next_arg, "LOOP") == 0)) {
+        if (execute) {buzzer_seq_play(next_arg[0] == 'L');}
+        append_str(response, "ACK", max_len);
+        return;
+    } else if (strcmp(next_arg, "STOP") == 0) {
+        if (execute) {buzzer_stop();}
+        append_str(response, "ACK", max_len);
+        return;
+    } else if (strcmp(next_arg, "GET?") == 0) {
+        // <playing>:<notes started>:<length>:<loops completed>
+        bool playing;
+        uint8_t pos, len;
+        uint16_t loops;
+        buzzer_seq_state(&playing, &pos, &len, &loops);
+        append_str(response, playing?"1:":"0:", max_len);
+        append_str(response, utoa(pos, temp_str), max_len);
+        append_str(response, ":", max_len);
+        append_str(response, utoa(len, temp_str), max_len);
+        append_str(response, ":", max_len);
+        append_str(response, utoa(loops, temp_str), max_len);
+        return;
+    }
+    nack_append(response, NACK_INVALID_SEQUENCE_COMMAND, max_len);
+}
+#endif
+
 void handle_msg(char* buf, char* response, int max_len) {
     // max_len is the maximum length of the string that can be fitted in buf
     // so the buffer must be at least max_len+1 long
+    if (buf[0] == MSG_TAG_PREFIX) {
+        // Echo the tag ahead of the response, so the host can match them
+        char* cmd = strchr(buf, ' ');
+        if (cmd != NULL) {
+            *cmd = '\0';
+            cmd++;
+        } else {
+            cmd = buf + strlen(buf);
+        }
+
+        if (strlen(buf) > MSG_TAG_MAX_LEN) {
+            response[0] = '\0';
+            nack_append(response, NACK_TAG_TOO_LONG, max_len);
+            return;
+        }
+
+        strcpy(response, buf);
+        strcat(response, " ");
+        int tag_len = strlen(response);
+        response += tag_len;
+        max_len -= tag_len;
+        buf = cmd;
+    }
+
+    if (strchr(buf, BATCH_SEPARATOR) != NULL) {
+        handle_batch(buf, response, max_len);
+    } else {
+        handle_cmd(buf, response, max_len, true);
+    }
+}
+
+static void handle_batch(char* buf, char* response, int max_len) {
+    char validate_buf[MSG_MAX_LEN + 1];
+    char temp_str[12] = {0};  // for doing itoa conversions
+    uint8_t cmd_idx = 0;
+
+    if (strlen(buf) > MSG_MAX_LEN) {
+        response[0] = '\0';
+        nack_append(response, NACK_BATCH_TOO_LONG, max_len);
+        return;
+    }
+
+    // Parse every command without acting on it first, so that either all of
+    // the batch is applied or none of it is
+#ifdef FEATURE_SCHED
+    batch_sched = 0;
+#endif
+#ifdef FEATURE_MACROS
+    batch_macros = 0;
+#endif
+    admit_batch_clear();
+    strcpy(validate_buf, buf);
+    char* cmd = validate_buf;
+    while (cmd != NULL) {
+        char* separator = strchr(cmd, BATCH_SEPARATOR);
+        if (separator) {
+            *separator = '\0';
+        }
+
+        handle_cmd(cmd, response, max_len, false);
+        if (strncmp(response, "NACK:", 5) == 0) {
+            // Report the failing command as NACK:<index>:<reason>
+            itoa(cmd_idx, temp_str);
+            int prefix_len = strlen(temp_str) + 1;
+            int reason_len = strlen(response + 5);
+            if (5 + prefix_len + reason_len > max_len) {
+                reason_len = max_len - 5 - prefix_len;
+            }
+            memmove(response + 5 + prefix_len, response + 5, reason_len);
+            memcpy(response + 5, temp_str, prefix_len - 1);
+            response[4 + prefix_len] = ':';
+            response[5 + prefix_len + reason_len] = '\0';
+            admit_batch_clear();
+            return;
+        }
+
+        cmd = separator ? separator + 1 : NULL;
+        cmd_idx++;
+    }
+    admit_batch_clear();
+
+    // Run the batch, joining the responses
+    response[0] = '\0';
+    cmd = buf;
+    while (cmd != NULL) {
+        char* separator = strchr(cmd, BATCH_SEPARATOR);
+        if (separator) {
+            *separator = '\0';
+        }
+
+        int response_len = strlen(response);
+        if (cmd != buf) {
+            append_str(response, ";", max_len);
+            response_len = strlen(response);
+        }
+        handle_cmd(cmd, response + response_len, max_len - response_len, true);
+
+        cmd = separator ? separator + 1 : NULL;
+    }
+}
+
+static void handle_cmd(char* buf, char* response, int max_len, bool execute) {
+    // When execute is false the command is only checked, its response
+    // reports any error but nothing is changed
     char temp_str[12] = {0};  // for doing itoa conversions
     response[0] = '\0';  // make a blank string
 
     char* next_arg = strtok(buf, ":");
+    if (next_arg == NULL) {
+        nack_append(response, NACK_EMPTY_COMMAND, max_len);
+        return;
+    }
     if (strcmp(next_arg, "OUT") == 0) {
-        next_arg = get_next_arg(response, "NACK:Missing output number", max_len);
+        next_arg = get_next_arg(response, NACK_MISSING_OUTPUT_NUMBER, max_len);
         if(next_arg == NULL) {return;}
 
         unsigned long int output_num;
@@ -41,57 +690,171 @@ void handle_msg(char* buf, char* response, int max_len) {
             output_num = strtoul(next_arg, NULL, 10);
             // bounds check
             if (output_num > OUT_5V) {
-                append_str(response, "NACK:Invalid output number", max_len);
+                nack_append(response, NACK_INVALID_OUTPUT_NUMBER, max_len);
                 return;
             }
         } else {
-            append_str(response, "NACK:Missing output number", max_len);
+            nack_append(response, NACK_MISSING_OUTPUT_NUMBER, max_len);
             return;
         }
 
-        next_arg = get_next_arg(response, "NACK:Missing output command", max_len);
+        next_arg = get_next_arg(response, NACK_MISSING_OUTPUT_COMMAND, max_len);
         if(next_arg == NULL) {return;}
 
         if (strcmp(next_arg, "SET") == 0) {
             // inhibit setting brain port
             if (output_num == BRAIN_OUTPUT) {
-                append_str(response, "NACK:Brain output cannot be controlled", max_len);
+                nack_append(response, NACK_BRAIN_OUTPUT_CANNOT_BE_CONTROLLED, max_len);
                 return;
             }
-            next_arg = get_next_arg(response, "NACK:Missing output enable argument", max_len);
+            next_arg = get_next_arg(response, NACK_MISSING_OUTPUT_ENABLE_ARGUMENT, max_len);
             if(next_arg == NULL) {return;}
 
-            // Enable output
-            if (next_arg[0] == '1') {
-                enable_output(output_num, true);
-
-                append_str(response, "ACK", max_len);
-                return;
-            } else if (next_arg[0] == '0') {
-                enable_output(output_num, false);
-
-                append_str(response, "ACK", max_len);
+            set_output_state(
+                output_num, next_arg, NACK_INVALID_OUTPUT_ENABLE_ARGUMENT,
+                response, max_len, execute);
+            return;
+#ifdef FEATURE_SCHED
+        } else if (strcmp(next_arg, "PULSE") == 0) {
+            if (output_num == BRAIN_OUTPUT) {
+                nack_append(response, NACK_BRAIN_OUTPUT_CANNOT_BE_CONTROLLED, max_len);
                 return;
             }
+            next_arg = get_next_arg(response, NACK_MISSING_PULSE_DURATION, max_len);
+            if(next_arg == NULL) {return;}
 
-            append_str(response, "NACK:Invalid output enable argument", max_len);
+            pulse_output(output_num, next_arg, true, response, max_len, execute);
             return;
+#endif
         } else if (strcmp(next_arg, "GET?") == 0) {
             append_str(response, output_enabled(output_num)?"1":"0", max_len);
             return;
+        } else if (strcmp(next_arg, "PRIO") == 0) {
+            next_arg = get_next_arg(response, NACK_MISSING_OUTPUT_PRIORITY, max_len);
+            if(next_arg == NULL) {return;}
+
+            uint16_t priority;
+            if (!parse_u16(next_arg, &priority) || (priority > SHED_PRIORITY_KEEP)) {
+                nack_append(response, NACK_INVALID_OUTPUT_PRIORITY, max_len);
+                return;
+            }
+            if (execute) {output_set_priority(output_num, priority);}
+            append_str(response, "ACK", max_len);
+            return;
+        } else if (strcmp(next_arg, "CLEAR") == 0) {
+            // Clear this output's overcurrent, leaving it off
+            if (execute) {reclose_clear(output_num);}
+            append_str(response, "ACK", max_len);
+            return;
+#ifdef FEATURE_RECLOSE
+        } else if (strcmp(next_arg, "RECLOSE") == 0) {
+            // <retries>:<backoff>[:<max backoff>]
+            reclose_policy_t policy;
+            uint16_t retries;
+            if (!parse_u16(strtok(NULL, ":"), &retries) || (retries > UINT8_MAX)) {
+                nack_append(response, NACK_INVALID_RECLOSE_RETRIES, max_len);
+                return;
+            }
+            policy.retries = retries;
+            policy.backoff = 0;
+            policy.max_backoff = 0;
+            if (retries != 0) {
+                if (!parse_u16(strtok(NULL, ":"), &policy.backoff) || (policy.backoff == 0)) {
+                    nack_append(response, NACK_INVALID_RECLOSE_BACKOFF, max_len);
+                    return;
+                }
+                policy.max_backoff = policy.backoff;
+                next_arg = strtok(NULL, ":");
+                if ((next_arg != NULL) && (!parse_u16(next_arg, &policy.max_backoff)
+                        || (policy.max_backoff < policy.backoff))) {
+                    nack_append(response, NACK_INVALID_RECLOSE_BACKOFF, max_len);
+                    return;
+                }
+            }
+            if (execute) {reclose_set_policy(output_num, &policy);}
+            append_str(response, "ACK", max_len);
+            return;
+        } else if (strcmp(next_arg, "RECLOSE?") == 0) {
+            // <retries>:<backoff>:<max backoff>:<attempts>:<pending>
+            reclose_policy_t policy;
+            bool pending;
+            reclose_get_policy(output_num, &policy);
+            uint8_t attempts = reclose_attempts(output_num, &pending);
+            append_str(response, utoa(policy.retries, temp_str), max_len);
+            append_str(response, ":", max_len);
+            append_str(response, utoa(policy.backoff, temp_str), max_len);
+            append_str(response, ":", max_len);
+            append_str(response, utoa(policy.max_backoff, temp_str), max_len);
+            append_str(response, ":", max_len);
+            append_str(response, utoa(attempts, temp_str), max_len);
+            append_str(response, pending?":1":":0", max_len);
+            return;
+#endif
+#ifdef FEATURE_STALL
+        } else if (strcmp(next_arg, "STALL") == 0) {
+            // <rise>:<rise time>:<hold>[:<plateau>]
+            stall_config_t config;
+            uint16_t plateau = 0;
+            if (!parse_u16(strtok(NULL, ":"), &config.rise)
+                    || !parse_u16(strtok(NULL, ":"), &config.rise_time)
+                    || ((config.rise != 0) && (config.rise_time == 0))) {
+                nack_append(response, NACK_INVALID_STALL_RISE, max_len);
+                return;
+            }
+            if (!parse_u16(strtok(NULL, ":"), &config.hold)) {
+                nack_append(response, NACK_INVALID_STALL_HOLD, max_len);
+                return;
+            }
+            next_arg = strtok(NULL, ":");
+            if ((next_arg != NULL) && (!parse_u16(next_arg, &plateau) || (plateau > 100))) {
+                nack_append(response, NACK_INVALID_STALL_PLATEAU, max_len);
+                return;
+            }
+            config.plateau = plateau;
+            if (((config.rise != 0) || (config.plateau != 0)) && (config.hold == 0)) {
+                nack_append(response, NACK_INVALID_STALL_HOLD, max_len);
+                return;
+            }
+            if (execute) {stall_set_config(output_num, &config);}
+            append_str(response, "ACK", max_len);
+            return;
+        } else if (strcmp(next_arg, "STALL?") == 0) {
+            // <rise>:<rise time>:<hold>:<plateau>:<reason>:<since>
+            stall_config_t config;
+            uint32_t since;
+            stall_get_config(output_num, &config);
+            stall_reason_t reason = stall_get_state(output_num, &since);
+            append_str(response, utoa(config.rise, temp_str), max_len);
+            append_str(response, ":", max_len);
+            append_str(response, utoa(config.rise_time, temp_str), max_len);
+            append_str(response, ":", max_len);
+            append_str(response, utoa(config.hold, temp_str), max_len);
+            append_str(response, ":", max_len);
+            append_str(response, utoa(config.plateau, temp_str), max_len);
+            append_str(response, ":", max_len);
+            append_str(response, STALL_REASON_NAMES[reason], max_len);
+            append_str(response, ":", max_len);
+            append_str(response, utoa(since, temp_str), max_len);
+            return;
+#endif
+        } else if (strcmp(next_arg, "PRIO?") == 0) {
+            append_str(response, utoa(output_priority[output_num], temp_str), max_len);
+            return;
         } else if (strcmp(next_arg, "I?") == 0) {
+            telemetry_t telemetry;
+            telemetry_read(&telemetry);
             if (output_num == OUT_5V) {
-                append_str(response, itoa(reg_5v.current, temp_str), max_len);
+                append_str(response, itoa(telemetry.reg_5v.current, temp_str), max_len);
             } else {
-                append_str(response, itoa(output_current[output_num], temp_str), max_len);
+                append_str(response, itoa(telemetry.output_current[output_num], temp_str), max_len);
             }
             return;
         } else {
-            append_str(response, "NACK:Unknown output command", max_len);
+            nack_append(response, NACK_UNKNOWN_OUTPUT_COMMAND, max_len);
             return;
         }
     } else if (strcmp(next_arg, "LED") == 0) {
-        next_arg = get_next_arg(response, "NACK:Missing LED name", max_len);
+        next_arg = get_next_arg(response, NACK_MISSING_LED_NAME, max_len);
         if(next_arg == NULL) {return;}
 
         uint32_t led;
@@ -101,34 +864,68 @@ void handle_msg(char* buf, char* response, int max_len) {
         } else if (strcmp(next_arg, "ERR") == 0) {
             led = LED_ERROR;
         } else {
-            append_str(response, "NACK:Invalid LED name", max_len);
+            nack_append(response, NACK_INVALID_LED_NAME, max_len);
             return;
         }
 
-        next_arg = get_next_arg(response, "NACK:Missing LED argument", max_len);
+        next_arg = get_next_arg(response, NACK_MISSING_LED_ARGUMENT, max_len);
         if(next_arg == NULL) {return;}
 
         if (strcmp(next_arg, "SET") == 0) {
-            next_arg = get_next_arg(response, "NACK:Missing LED value", max_len);
+            next_arg = get_next_arg(response, NACK_MISSING_LED_VALUE, max_len);
             if(next_arg == NULL) {return;}
 
             if (strcmp(next_arg, "0") == 0) {
-                clear_led(led);
+                if (execute) {clear_led(led);}
                 append_str(response, "ACK", max_len);
                 return;
             } else if (strcmp(next_arg, "1") == 0) {
-                set_led(led);
+                if (execute) {set_led(led);}
                 append_str(response, "ACK", max_len);
                 return;
             } else if (strcmp(next_arg, "F") == 0) {
-                toggle_led(led);
-                set_led_flash(led);
+                if (execute) {set_led_flash(led);}
                 append_str(response, "ACK", max_len);
                 return;
             }
 
-            append_str(response, "NACK:Invalid LED value", max_len);
+            nack_append(response, NACK_INVALID_LED_VALUE, max_len);
+            return;
+#ifdef FEATURE_LED_PATTERNS
+        } else if (strcmp(next_arg, "PAT") == 0) {
+            // <period>:<on time>[:<count>:<gap>]
+            led_pattern_t pattern = {0};
+            uint16_t count = 0;
+            if (!parse_u16(strtok(NULL, ":"), &pattern.period)
+                    || !parse_u16(strtok(NULL, ":"), &pattern.on_time)
+                    || (pattern.period == 0) || (pattern.on_time > pattern.period)) {
+                nack_append(response, NACK_INVALID_LED_PATTERN, max_len);
+                return;
+            }
+            next_arg = strtok(NULL, ":");
+            if (next_arg != NULL) {
+                if (!parse_u16(next_arg, &count) || (count > UINT8_MAX)
+                        || !parse_u16(strtok(NULL, ":"), &pattern.gap)) {
+                    nack_append(response, NACK_INVALID_LED_PATTERN, max_len);
+                    return;
+                }
+                pattern.count = count;
+            }
+            if (execute) {set_led_pattern(led, &pattern);}
+            append_str(response, "ACK", max_len);
+            return;
+        } else if (strcmp(next_arg, "PAT?") == 0) {
+            led_pattern_t pattern = {0};
+            get_led_pattern(led, &pattern);
+            append_str(response, utoa(pattern.period, temp_str), max_len);
+            append_str(response, ":", max_len);
+            append_str(response, utoa(pattern.on_time, temp_str), max_len);
+            append_str(response, ":", max_len);
+            append_str(response, utoa(pattern.count, temp_str), max_len);
+            append_str(response, ":", max_len);
+            append_str(response, utoa(pattern.gap, temp_str), max_len);
             return;
+#endif
         } else if (strcmp(next_arg, "GET?") == 0) {
             switch(get_led_state(led)) {
                 case 0:
@@ -141,33 +938,119 @@ void handle_msg(char* buf, char* response, int max_len) {
                     append_str(response, "F", max_len);
                     return;
                 default:
-                    append_str(response, "NACK:Failed to get pin state", max_len);
+                    nack_append(response, NACK_FAILED_TO_GET_PIN_STATE, max_len);
                     return;
             }
         }
-        append_str(response, "NACK:Invalid LED argument", max_len);
+        nack_append(response, NACK_INVALID_LED_ARGUMENT, max_len);
         return;
     } else if (strcmp(next_arg, "BATT") == 0) {
-        next_arg = get_next_arg(response, "NACK:Missing argument", max_len);
+        next_arg = get_next_arg(response, NACK_MISSING_ARGUMENT, max_len);
         if(next_arg == NULL) {return;}
 
+        telemetry_t telemetry;
+        telemetry_read(&telemetry);
+
         if (strcmp(next_arg, "I?") == 0) {
             // Get stored current value
-            append_str(response, itoa(battery.current, temp_str), max_len);
+            append_str(response, itoa(telemetry.battery.current, temp_str), max_len);
             return;
         } else if (strcmp(next_arg, "V?") == 0) {
             // Get stored voltage value
-            append_str(response, itoa(battery.voltage, temp_str), max_len);
+            append_str(response, itoa(telemetry.battery.voltage, temp_str), max_len);
+            return;
+#ifdef FEATURE_ADMIT
+        } else if (strcmp(next_arg, "BUDGET?") == 0) {
+            // <available>:<expected draw of each output>
+            append_str(response, itoa(admit_available(&telemetry.admit), temp_str), max_len);
+            append_str(response, ":", max_len);
+            for (output_t out=OUT_H0; out <= OUT_5V; out++) {
+                if (out != OUT_H0) {
+                    append_str(response, ",", max_len);
+                }
+                append_str(response, utoa(telemetry.admit.expected[out], temp_str), max_len);
+            }
+            return;
+        } else if (strcmp(next_arg, "ADMIT") == 0) {
+            next_arg = get_next_arg(response, NACK_MISSING_ADMISSION_COMMAND, max_len);
+            if(next_arg == NULL) {return;}
+
+            if (strcmp(next_arg, "GET?") == 0) {
+                append_str(response, admit_enabled?"1":"0", max_len);
+                return;
+            } else if (strcmp(next_arg, "SET") == 0) {
+                next_arg = get_next_arg(response, NACK_MISSING_ADMISSION_STATE, max_len);
+                if(next_arg == NULL) {return;}
+
+                if ((strcmp(next_arg, "0") != 0) && (strcmp(next_arg, "1") != 0)) {
+                    nack_append(response, NACK_INVALID_ADMISSION_STATE, max_len);
+                    return;
+                }
+                if (execute) {admit_enabled = (next_arg[0] == '1');}
+                append_str(response, "ACK", max_len);
+                return;
+            }
+            nack_append(response, NACK_UNKNOWN_ADMISSION_COMMAND, max_len);
+            return;
+#endif
+#ifdef FEATURE_SOC
+        } else if (strcmp(next_arg, "EST?") == 0) {
+            // <ocv>:<soc>:<rint>:<runtime>
+            append_str(response, utoa(telemetry.soc.ocv, temp_str), max_len);
+            append_str(response, ":", max_len);
+            append_str(response, utoa(telemetry.soc.soc, temp_str), max_len);
+            append_str(response, ":", max_len);
+            append_str(response, utoa(telemetry.soc.rint, temp_str), max_len);
+            append_str(response, ":", max_len);
+            append_str(response, itoa(telemetry.soc.runtime, temp_str), max_len);
+            return;
+        } else if (strcmp(next_arg, "CAP") == 0) {
+            next_arg = get_next_arg(response, NACK_MISSING_CAPACITY, max_len);
+            if(next_arg == NULL) {return;}
+
+            uint16_t capacity;
+            if (strcmp(next_arg, "GET?") == 0) {
+                append_str(response, utoa(soc_capacity, temp_str), max_len);
+                return;
+            } else if ((strcmp(next_arg, "SET") != 0)
+                    || !parse_u16(strtok(NULL, ":"), &capacity) || (capacity == 0)) {
+                nack_append(response, NACK_INVALID_CAPACITY, max_len);
+                return;
+            }
+            if (execute) {soc_capacity = capacity;}
+            append_str(response, "ACK", max_len);
             return;
+        } else if (strcmp(next_arg, "UVLO") == 0) {
+            next_arg = get_next_arg(response, NACK_MISSING_UVLO_COMMAND, max_len);
+            if(next_arg == NULL) {return;}
+
+            if (strcmp(next_arg, "GET?") == 0) {
+                append_str(response, soc_uvlo_compensated?"1":"0", max_len);
+                return;
+            } else if (strcmp(next_arg, "SET") == 0) {
+                next_arg = get_next_arg(response, NACK_MISSING_UVLO_COMPENSATION, max_len);
+                if(next_arg == NULL) {return;}
+
+                if ((strcmp(next_arg, "0") != 0) && (strcmp(next_arg, "1") != 0)) {
+                    nack_append(response, NACK_INVALID_UVLO_COMPENSATION, max_len);
+                    return;
+                }
+                if (execute) {soc_uvlo_compensated = (next_arg[0] == '1');}
+                append_str(response, "ACK", max_len);
+                return;
+            }
+            nack_append(response, NACK_UNKNOWN_UVLO_COMMAND, max_len);
+            return;
+#endif
         }
-        append_str(response, "NACK:Unknown battery command", max_len);
+        nack_append(response, NACK_UNKNOWN_BATTERY_COMMAND, max_len);
         return;
     } else if (strcmp(next_arg, "BTN") == 0) {
-        next_arg = get_next_arg(response, "NACK:Missing button name", max_len);
+        next_arg = get_next_arg(response, NACK_MISSING_BUTTON_NAME, max_len);
         if(next_arg == NULL) {return;}
 
         if (strcmp(next_arg, "START") == 0) {
-            next_arg = get_next_arg(response, "NACK:Missing button command", max_len);
+            next_arg = get_next_arg(response, NACK_MISSING_BUTTON_COMMAND, max_len);
             if(next_arg == NULL) {return;}
 
             if (strcmp(next_arg, "GET?") == 0) {
@@ -176,18 +1059,38 @@ void handle_msg(char* buf, char* response, int max_len) {
                 append_str(response, ext_button_pressed?"1":"0", max_len);
 
                 // Clear button state
-                int_button_pressed = false;
-                ext_button_pressed = false;
+                if (execute) {
+                    int_button_pressed = false;
+                    ext_button_pressed = false;
+                }
+                return;
+            }
+
+            if (strcmp(next_arg, "EVT?") == 0) {
+                // Drain the press and release events oldest first, any that
+                // don't fit are left for the next call
+                button_event_t event;
+                while (
+                    execute && (max_len - (int)strlen(response) >= 14)
+                    && button_event_pop(&event)
+                ) {
+                    if (response[0] != '\0') {
+                        append_str(response, ",", max_len);
+                    }
+                    append_str(response, (event.button == BUTTON_INT)?"I":"E", max_len);
+                    append_str(response, event.pressed?"1:":"0:", max_len);
+                    append_str(response, utoa(event.timestamp, temp_str), max_len);
+                }
                 return;
             }
 
-            append_str(response, "NACK:Invalid button command", max_len);
+            nack_append(response, NACK_INVALID_BUTTON_COMMAND, max_len);
             return;
         }
-        append_str(response, "NACK:Invalid button name", max_len);
+        nack_append(response, NACK_INVALID_BUTTON_NAME, max_len);
         return;
     } else if (strcmp(next_arg, "NOTE") == 0) {
-        next_arg = get_next_arg(response, "NACK:Missing note frequency", max_len);
+        next_arg = get_next_arg(response, NACK_MISSING_NOTE_FREQUENCY, max_len);
         if(next_arg == NULL) {return;}
 
         unsigned long int note_freq;
@@ -196,7 +1099,7 @@ void handle_msg(char* buf, char* response, int max_len) {
             note_freq = strtoul(next_arg, NULL, 10);
             // bounds check
             if (note_freq > UINT16_MAX) {
-                append_str(response, "NACK:Invalid note frequency", max_len);
+                nack_append(response, NACK_INVALID_NOTE_FREQUENCY, max_len);
                 return;
             }
         } else if (strcmp(next_arg, "GET?") == 0) {
@@ -204,12 +1107,17 @@ void handle_msg(char* buf, char* response, int max_len) {
             append_str(response, ":", max_len);
             append_str(response, itoa(buzzer_remaining(), temp_str), max_len);
             return;
+#ifdef FEATURE_SEQUENCES
+        } else if (strcmp(next_arg, "SEQ") == 0) {
+            handle_note_seq(response, max_len, execute);
+            return;
+#endif
         } else {
-            append_str(response, "NACK:Invalid note frequency", max_len);
+            nack_append(response, NACK_INVALID_NOTE_FREQUENCY, max_len);
             return;
         }
 
-        next_arg = get_next_arg(response, "NACK:Missing note duration", max_len);
+        next_arg = get_next_arg(response, NACK_MISSING_NOTE_DURATION, max_len);
         if(next_arg == NULL) {return;}
 
         unsigned long int note_dur;
@@ -218,25 +1126,46 @@ void handle_msg(char* buf, char* response, int max_len) {
             note_dur = strtoul(next_arg, NULL, 10);
             // bounds check
             if (note_dur > UINT32_MAX) {
-                append_str(response, "NACK:Invalid note duration", max_len);
+                nack_append(response, NACK_INVALID_NOTE_DURATION, max_len);
                 return;
             }
         } else {
-            append_str(response, "NACK:Invalid note duration", max_len);
+            nack_append(response, NACK_INVALID_NOTE_DURATION, max_len);
             return;
         }
 
         // Generate note
-        buzzer_note(note_freq, note_dur);
+        if (execute) {buzzer_note(note_freq, note_dur);}
 
         append_str(response, "ACK", max_len);
         return;
+#ifdef FEATURE_ROLLUP
+    } else if (strcmp(next_arg, "ROLL") == 0) {
+        handle_rollup(response, max_len);
+        return;
+#endif
+#ifdef FEATURE_SCOPE
+    } else if (strcmp(next_arg, "SCOPE") == 0) {
+        handle_scope(response, max_len, execute);
+        return;
+#endif
+#ifdef FEATURE_SPECTRUM
+    } else if (strcmp(next_arg, "SPEC") == 0) {
+        handle_spectrum(response, max_len, execute);
+        return;
+#endif
     } else if (strcmp(next_arg, "*IDN?") == 0) {
         append_str(response, "Student Robotics:" BOARD_NAME_SHORT ":", max_len);
         append_str(response, (const char *)SERIALNUM_BOOTLOADER_LOC, max_len);
         append_str(response, ":" FW_VER, max_len);
         return;
+    } else if (strcmp(next_arg, "*UPTIME?") == 0) {
+        append_str(response, utoa(uptime_ms, temp_str), max_len);
+        return;
     } else if (strcmp(next_arg, "*STATUS?") == 0) {
+        telemetry_t telemetry;
+        telemetry_read(&telemetry);
+
         for (output_t out=OUT_H0; out <= OUT_5V; out++) {
             append_str(response, (output_inhibited[out])?"1,":"0,", max_len);
         }
@@ -245,22 +1174,22 @@ void handle_msg(char* buf, char* response, int max_len) {
             response[final_char] = '\0';
         }
         append_str(response, ":", max_len);
-        append_str(response, itoa(board_temp, temp_str), max_len);
+        append_str(response, itoa(telemetry.board_temp, temp_str), max_len);
         append_str(response, ":", max_len);
         append_str(response, (fan_running()?"1":"0"), max_len);
         append_str(response, ":", max_len);
-        append_str(response, itoa(reg_5v.voltage, temp_str), max_len);
+        append_str(response, itoa(telemetry.reg_5v.voltage, temp_str), max_len);
         return;
     } else if (strcmp(next_arg, "*RESET") == 0) {
-        reset_board();
+        if (execute) {reset_board();}
         append_str(response, "ACK", max_len);
         return;
     } else if (strcmp(next_arg, "*SYS") == 0) {
-        next_arg = get_next_arg(response, "NACK:Missing system command", max_len);
+        next_arg = get_next_arg(response, NACK_MISSING_SYSTEM_COMMAND, max_len);
         if(next_arg == NULL) {return;}
 
         if (strcmp(next_arg, "DELAY_COEFF") == 0) {
-            next_arg = get_next_arg(response, "NACK:Missing coefficient command", max_len);
+            next_arg = get_next_arg(response, NACK_MISSING_COEFFICIENT_COMMAND, max_len);
             if(next_arg == NULL) {return;}
 
             if (strcmp(next_arg, "SET") == 0) {
@@ -268,7 +1197,7 @@ void handle_msg(char* buf, char* response, int max_len) {
                 unsigned long coeff;
 
                 for(uint8_t i=0; i < 5; i++) {
-                    next_arg = get_next_arg(response, "NACK:Missing coefficient set argument", max_len);
+                    next_arg = get_next_arg(response, NACK_MISSING_COEFFICIENT_SET_ARGUMENT, max_len);
                     if(next_arg == NULL) {return;}
 
                     if (isdigit((int)next_arg[0])) {
@@ -276,22 +1205,24 @@ void handle_msg(char* buf, char* response, int max_len) {
 
                         // bounds check value
                         if (coeff > (UINT16_MAX - 1)) {
-                            append_str(response, "NACK:Coefficient must fit in uint16", max_len);
+                            nack_append(response, NACK_COEFFICIENT_MUST_FIT_IN_UINT16, max_len);
                             return;
                         }
                         // add value to array
                         new_coeffs[i] = coeff;
                     } else {
-                        append_str(response, "NACK:Coefficients must be positive integers", max_len);
+                        nack_append(response, NACK_COEFFICIENTS_MUST_BE_POSITIVE_INTEGERS, max_len);
                         return;
                     }
                 }
 
-                ADC_OVERCURRENT_DELAY = new_coeffs[0];
-                BATT_OVERCURRENT_DELAY = new_coeffs[1];
-                REG_OVERCURRENT_DELAY = new_coeffs[2];
-                UVLO_DELAY = new_coeffs[3];
-                NEG_CURRENT_DELAY = new_coeffs[4];
+                if (execute) {
+                    ADC_OVERCURRENT_DELAY = new_coeffs[0];
+                    BATT_OVERCURRENT_DELAY = new_coeffs[1];
+                    REG_OVERCURRENT_DELAY = new_coeffs[2];
+                    UVLO_DELAY = new_coeffs[3];
+                    NEG_CURRENT_DELAY = new_coeffs[4];
+                }
 
                 append_str(response, "ACK", max_len);
                 return;
@@ -307,101 +1238,343 @@ void handle_msg(char* buf, char* response, int max_len) {
                 append_str(response, itoa(NEG_CURRENT_DELAY, temp_str), max_len);
                 return;
             } else {
-                append_str(response, "NACK:Unknown coefficient command", max_len);
+                nack_append(response, NACK_UNKNOWN_COEFFICIENT_COMMAND, max_len);
                 return;
             }
-        } else if (strcmp(next_arg, "BRAIN") == 0) {
-            next_arg = get_next_arg(response, "NACK:Missing brain command", max_len);
+        } else if (strcmp(next_arg, "NACK") == 0) {
+            next_arg = get_next_arg(response, NACK_MISSING_NACK_COMMAND, max_len);
             if(next_arg == NULL) {return;}
+
             if (strcmp(next_arg, "SET") == 0) {
-                next_arg = get_next_arg(response, "NACK:Missing brain enable argument", max_len);
+                next_arg = get_next_arg(response, NACK_INVALID_NACK_MODE, max_len);
                 if(next_arg == NULL) {return;}
-
-                // Enable output
-                if (next_arg[0] == '1') {
-                    enable_output(BRAIN_OUTPUT, true);
-
-                    append_str(response, "ACK", max_len);
+                if ((next_arg[0] != '0') && (next_arg[0] != '1')) {
+                    nack_append(response, NACK_INVALID_NACK_MODE, max_len);
                     return;
-                } else if (next_arg[0] == '0') {
-                    enable_output(BRAIN_OUTPUT, false);
-
-                    append_str(response, "ACK", max_len);
+                }
+                if (execute) {nack_numeric = (next_arg[0] == '1');}
+                append_str(response, "ACK", max_len);
+                return;
+            } else if (strcmp(next_arg, "GET?") == 0) {
+                append_str(response, nack_numeric?"1":"0", max_len);
+                return;
+            } else if (strcmp(next_arg, "TEXT?") == 0) {
+                uint16_t code;
+                if (!parse_u16(strtok(NULL, ":"), &code) || (code >= NACK_COUNT)) {
+                    nack_append(response, NACK_INVALID_NACK_CODE, max_len);
                     return;
                 }
+                nack_append_reason(response, code, max_len);
+                return;
+            }
+            nack_append(response, NACK_UNKNOWN_NACK_COMMAND, max_len);
+            return;
+        } else if (strcmp(next_arg, "TICK?") == 0) {
+            // <mean>:<max>:<slow max> cycles
+            append_str(response, utoa(tick_cycles_mean, temp_str), max_len);
+            append_str(response, ":", max_len);
+            append_str(response, utoa(tick_cycles_max, temp_str), max_len);
+            append_str(response, ":", max_len);
+            append_str(response, utoa(tick_cycles_slow_max, temp_str), max_len);
+            return;
+        } else if (strcmp(next_arg, "TICK") == 0) {
+            next_arg = get_next_arg(response, NACK_MISSING_TICK_COMMAND, max_len);
+            if(next_arg == NULL) {return;}
+            if (strcmp(next_arg, "CLEAR") != 0) {
+                nack_append(response, NACK_UNKNOWN_TICK_COMMAND, max_len);
+                return;
+            }
+            if (execute) {systick_clear_cycles();}
+            append_str(response, "ACK", max_len);
+            return;
+        } else if (strcmp(next_arg, "SHED?") == 0) {
+            for (output_t out=OUT_H0; out <= OUT_5V; out++) {
+                if (out != OUT_H0) {
+                    append_str(response, ",", max_len);
+                }
+                append_str(response, (output_shed[out])?"1":"0", max_len);
+            }
+            return;
+        } else if (strcmp(next_arg, "BRAIN") == 0) {
+            next_arg = get_next_arg(response, NACK_MISSING_BRAIN_COMMAND, max_len);
+            if(next_arg == NULL) {return;}
+            if (strcmp(next_arg, "SET") == 0) {
+                next_arg = get_next_arg(response, NACK_MISSING_BRAIN_ENABLE_ARGUMENT, max_len);
+                if(next_arg == NULL) {return;}
 
-                append_str(response, "NACK:Invalid brain enable argument", max_len);
+                set_output_state(
+                    BRAIN_OUTPUT, next_arg, NACK_INVALID_BRAIN_ENABLE_ARGUMENT,
+                    response, max_len, execute);
                 return;
+#ifdef FEATURE_SCHED
+            } else if (strcmp(next_arg, "CYCLE") == 0) {
+                // Power cycle the brain, off for the given duration
+                next_arg = get_next_arg(response, NACK_MISSING_PULSE_DURATION, max_len);
+                if(next_arg == NULL) {return;}
+
+                pulse_output(BRAIN_OUTPUT, next_arg, false, response, max_len, execute);
+                return;
+#endif
             } else {
-                append_str(response, "NACK:Unknown brain command", max_len);
+                nack_append(response, NACK_UNKNOWN_BRAIN_COMMAND, max_len);
                 return;
             }
         } else if (strcmp(next_arg, "FAN") == 0) {
-            next_arg = get_next_arg(response, "NACK:Missing fan command", max_len);
+            next_arg = get_next_arg(response, NACK_MISSING_FAN_COMMAND, max_len);
             if(next_arg == NULL) {return;}
             if (strcmp(next_arg, "SET") == 0) {
-                next_arg = get_next_arg(response, "NACK:Missing fan override argument", max_len);
+                next_arg = get_next_arg(response, NACK_MISSING_FAN_OVERRIDE_ARGUMENT, max_len);
                 if(next_arg == NULL) {return;}
 
                 if (next_arg[0] == '1') {
-                    fan_override = true;
+                    if (execute) {fan_override = true;}
 
                     append_str(response, "ACK", max_len);
                     return;
                 } else if (next_arg[0] == '0') {
-                    fan_override = false;
+                    if (execute) {fan_override = false;}
 
                     append_str(response, "ACK", max_len);
                     return;
                 }
 
-                append_str(response, "NACK:Invalid fan override argument", max_len);
+                nack_append(response, NACK_INVALID_FAN_OVERRIDE_ARGUMENT, max_len);
+                return;
+            } else if (strcmp(next_arg, "DUTY?") == 0) {
+                append_str(response, utoa(fan_get_duty(), temp_str), max_len);
+                return;
+#ifdef FEATURE_FAN_CURVE
+            } else if (strcmp(next_arg, "CURVE") == 0) {
+                // <start temp>:<full temp>:<min duty>:<hysteresis>, in degrees and percent
+                uint16_t start, full, min_duty, hysteresis;
+                if (!parse_u16(strtok(NULL, ":"), &start)
+                        || !parse_u16(strtok(NULL, ":"), &full)
+                        || !parse_u16(strtok(NULL, ":"), &min_duty)
+                        || !parse_u16(strtok(NULL, ":"), &hysteresis)
+                        || (full > 150) || (start >= full)
+                        || (min_duty > 100) || (hysteresis > 20)) {
+                    nack_append(response, NACK_INVALID_FAN_CURVE, max_len);
+                    return;
+                }
+                const fan_curve_t curve = {
+                    .start_temp = start * 10,
+                    .full_temp = full * 10,
+                    .min_duty = min_duty,
+                    .hysteresis = hysteresis * 10,
+                };
+                if (execute) {fan_set_curve(&curve);}
+                append_str(response, "ACK", max_len);
                 return;
+            } else if (strcmp(next_arg, "CURVE?") == 0) {
+                fan_curve_t curve;
+                fan_get_curve(&curve);
+                append_str(response, itoa(curve.start_temp / 10, temp_str), max_len);
+                append_str(response, ":", max_len);
+                append_str(response, itoa(curve.full_temp / 10, temp_str), max_len);
+                append_str(response, ":", max_len);
+                append_str(response, utoa(curve.min_duty, temp_str), max_len);
+                append_str(response, ":", max_len);
+                append_str(response, utoa(curve.hysteresis / 10, temp_str), max_len);
+                return;
+#endif
             } else {
-                append_str(response, "NACK:Unknown fan command", max_len);
+                nack_append(response, NACK_UNKNOWN_FAN_COMMAND, max_len);
+                return;
+            }
+        }
+
+        nack_append(response, NACK_INVALID_SYSTEM_COMMAND, max_len);
+        return;
+#ifdef FEATURE_EVENTS
+    } else if (strcmp(next_arg, "EVT") == 0) {
+        next_arg = get_next_arg(response, NACK_MISSING_EVENT_COMMAND, max_len);
+        if(next_arg == NULL) {return;}
+
+        if (strcmp(next_arg, "SET") == 0) {
+            next_arg = get_next_arg(response, NACK_MISSING_EVENT_ENABLE_ARGUMENT, max_len);
+            if(next_arg == NULL) {return;}
+
+            if (next_arg[0] == '1') {
+                if (execute) {events_enabled = true;}
+
+                append_str(response, "ACK", max_len);
+                return;
+            } else if (next_arg[0] == '0') {
+                if (execute) {events_enabled = false;}
+
+                append_str(response, "ACK", max_len);
+                return;
+            }
+
+            nack_append(response, NACK_INVALID_EVENT_ENABLE_ARGUMENT, max_len);
+            return;
+        } else if (strcmp(next_arg, "GET?") == 0) {
+            append_str(response, events_enabled?"1":"0", max_len);
+            append_str(response, ":", max_len);
+            append_str(response, itoa(events_dropped, temp_str), max_len);
+            return;
+        }
+        nack_append(response, NACK_UNKNOWN_EVENT_COMMAND, max_len);
+        return;
+#endif
+#ifdef FEATURE_MACROS
+    } else if (strcmp(next_arg, "MACRO") == 0) {
+        next_arg = get_next_arg(response, NACK_MISSING_MACRO_NUMBER, max_len);
+        if(next_arg == NULL) {return;}
+
+        unsigned long int macro_num;
+
+        if (isdigit((int)next_arg[0])) {
+            macro_num = strtoul(next_arg, NULL, 10);
+            if (macro_num >= MACRO_COUNT) {
+                nack_append(response, NACK_INVALID_MACRO_NUMBER, max_len);
                 return;
             }
+        } else {
+            nack_append(response, NACK_MISSING_MACRO_NUMBER, max_len);
+            return;
         }
 
-        append_str(response, "NACK:Invalid system command", max_len);
+        next_arg = get_next_arg(response, NACK_MISSING_MACRO_COMMAND, max_len);
+        if(next_arg == NULL) {return;}
+
+        if (strcmp(next_arg, "TRIG") == 0) {
+            next_arg = get_next_arg(response, NACK_MISSING_MACRO_TRIGGER, max_len);
+            if(next_arg == NULL) {return;}
+
+            macro_trigger_t trigger = MACRO_TRIG_NONE;
+            while (strcmp(next_arg, MACRO_TRIGGER_NAMES[trigger]) != 0) {
+                if (++trigger > MACRO_TRIG_BATT) {
+                    nack_append(response, NACK_INVALID_MACRO_TRIGGER, max_len);
+                    return;
+                }
+            }
+
+            unsigned long int trigger_arg = 0;
+            if (trigger == MACRO_TRIG_OC || trigger == MACRO_TRIG_BATT) {
+                next_arg = strtok(NULL, ":");
+                if (next_arg != NULL && isdigit((int)next_arg[0])) {
+                    trigger_arg = strtoul(next_arg, NULL, 10);
+                } else if (next_arg != NULL || trigger == MACRO_TRIG_BATT) {
+                    nack_append(response, NACK_INVALID_MACRO_TRIGGER_ARGUMENT, max_len);
+                    return;
+                } else {
+                    trigger_arg = MACRO_ANY_OUTPUT;
+                }
+                if (
+                    (trigger == MACRO_TRIG_OC && trigger_arg > OUT_5V && trigger_arg != MACRO_ANY_OUTPUT)
+                    || (trigger == MACRO_TRIG_BATT && trigger_arg > INT16_MAX)
+                ) {
+                    nack_append(response, NACK_INVALID_MACRO_TRIGGER_ARGUMENT, max_len);
+                    return;
+                }
+            }
+
+            if (execute) {macro_set_trigger(macro_num, trigger, trigger_arg);}
+            append_str(response, "ACK", max_len);
+            return;
+        } else if (strcmp(next_arg, "ADD") == 0) {
+            // The rest of the line is the command, including its colons
+            next_arg = strtok(NULL, "");
+            if (next_arg == NULL) {
+                nack_append(response, NACK_MISSING_MACRO_COMMAND_TO_ADD, max_len);
+                return;
+            }
+            // Each step is one untagged command, so a tag or separator can't
+            // hide a MACRO command from the check below
+            if ((next_arg[0] == MSG_TAG_PREFIX) || (strchr(next_arg, BATCH_SEPARATOR) != NULL)) {
+                nack_append(response, NACK_INVALID_MACRO_COMMAND_TO_ADD, max_len);
+                return;
+            }
+            if (strncmp(next_arg, "MACRO", 5) == 0) {
+                nack_append(response, NACK_MACROS_CANNOT_CONTAIN_MACRO_COMMANDS, max_len);
+                return;
+            }
+            size_t len = macro_added_len(macro_len(macro_num, execute), next_arg);
+            if ((len > MACRO_MAX_LEN) || (execute && !macro_add(macro_num, next_arg))) {
+                nack_append(response, NACK_MACRO_TOO_LONG, max_len);
+                return;
+            }
+            if (!execute) {batch_macro_set_len(macro_num, len);}
+            append_str(response, "ACK", max_len);
+            return;
+        } else if (strcmp(next_arg, "CLEAR") == 0) {
+            if (execute) {
+                macro_clear(macro_num);
+            } else {
+                batch_macro_set_len(macro_num, 0);
+            }
+            append_str(response, "ACK", max_len);
+            return;
+        } else if (strcmp(next_arg, "RUN") == 0) {
+            if (execute) {macro_run(macro_num);}
+            append_str(response, "ACK", max_len);
+            return;
+        } else if (strcmp(next_arg, "GET?") == 0) {
+            uint16_t trigger_arg;
+            macro_trigger_t trigger = macro_get_trigger(macro_num, &trigger_arg);
+            append_str(response, MACRO_TRIGGER_NAMES[trigger], max_len);
+            append_str(response, ":", max_len);
+            if (trigger_arg == MACRO_ANY_OUTPUT) {
+                append_str(response, "-", max_len);
+            } else {
+                append_str(response, utoa(trigger_arg, temp_str), max_len);
+            }
+            append_str(response, ":", max_len);
+            append_str(response, utoa(macro_get_runs(macro_num), temp_str), max_len);
+            append_str(response, ":", max_len);
+            append_str(response, utoa(macro_get_failures(macro_num), temp_str), max_len);
+            return;
+        } else if (strcmp(next_arg, "CMD?") == 0) {
+            append_str(response, macro_get_commands(macro_num), max_len);
+            return;
+        }
+        nack_append(response, NACK_UNKNOWN_MACRO_COMMAND, max_len);
         return;
+#endif
     } else if (strcmp(next_arg, "ECHO") == 0) {
         next_arg = strtok(NULL, ":");
 
         append_str(response, next_arg, max_len);
         return;
     } else {
-        append_str(response, "NACK:Unknown command: '", max_len);
-        append_str(response, next_arg, max_len);
-        append_str(response, "'", max_len);
+        nack_append(response, NACK_UNKNOWN_COMMAND, max_len);
+        if (!nack_numeric) {
+            append_str(response, ": '", max_len);
+            append_str(response, next_arg, max_len);
+            append_str(response, "'", max_len);
+        }
         return;
     }
 
     // This should be unreachable
-    append_str(response, "NACK:Unknown error", max_len);
+    nack_append(response, NACK_UNKNOWN_ERROR, max_len);
     return;
 }
 
 static char* itoa(int value, char* string) {
     // string must be a buffer of at least 12 chars
-    // including stdio.h to get sprintf overflows the rom
-    char tmp[11];
-    char* tmp_ptr = tmp;
-    char* sp = string;
-    unsigned int digit;
-    unsigned int remaining;
-    bool sign;
-
     if ( string == NULL ) {
         return 0;
     }
 
-    sign = (value < 0);
-    if (sign) {
-        remaining = -value;
+    if (value < 0) {
+        string[0] = '-';
+        utoa(-(unsigned int)value, string + 1);
     } else {
-        remaining = (unsigned int)value;
+        utoa((unsigned int)value, string);
     }
+    return string;
+}
+
+static char* utoa(unsigned int value, char* string) {
+    // string must be a buffer of at least 11 chars
+    // including stdio.h to get sprintf overflows the rom
+    char tmp[10];
+    char* tmp_ptr = tmp;
+    char* sp = string;
+    unsigned int digit;
+    unsigned int remaining = value;
 
     while (remaining || tmp_ptr == tmp) {
         digit = remaining % 10;
@@ -410,11 +1583,6 @@ static char* itoa(int value, char* string) {
         tmp_ptr++;
     }
 
-    if (sign) {
-        *sp = '-';
-        sp++;
-    }
-
     // string is in reverse at this point
     while (tmp_ptr > tmp) {
         tmp_ptr--;
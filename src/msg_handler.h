@@ -1,3 +1,14 @@
 #pragma once
 
+// Longest line handle_msg accepts, including all the commands of a batch
+#define MSG_MAX_LEN 127
+// Longest response, a batch's responses are joined into one line
+#define MSG_RESPONSE_MAX_LEN 127
+// Separates the commands of a batch on one line
+#define BATCH_SEPARATOR ';'
+// Starts an optional tag, ended by a space, that is echoed on the response
+#define MSG_TAG_PREFIX '#'
+// Longest tag, including the prefix
+#define MSG_TAG_MAX_LEN 16
+
 void handle_msg(char* buf, char* response, int max_len);
@@ -0,0 +1,53 @@
+#include "nack.h"
+
+#include <string.h>
+
+volatile bool nack_numeric = false;
+
+// The leading words are marked by a byte from 1, as 0 ends each reason
+#define NACK_WORD_NONE "\x01"
+#define NACK_WORD_MISSING "\x02"
+#define NACK_WORD_INVALID "\x03"
+#define NACK_WORD_UNKNOWN "\x04"
+static const char* const NACK_WORDS[] = {"", "Missing ", "Invalid ", "Unknown "};
+
+// Every reason in code order, each as its word's marker and the rest of the text
+#define NACK_TEXT(name, word, text) NACK_WORD_##word text "\0"
+static const char NACK_REASONS[] = NACK_LIST(NACK_TEXT);
+#undef NACK_TEXT
+
+static void append_str(char* dest, const char* src, int dest_max_len) {
+    strncat(dest, src, dest_max_len - strlen(dest));
+}
+
+void nack_append(char* response, nack_t nack, int max_len) {
+    append_str(response, "NACK:", max_len);
+    if (!nack_numeric) {
+        nack_append_reason(response, nack, max_len);
+        return;
+    }
+    char code[4];
+    uint8_t i = sizeof(code) - 1;
+    code[i] = '\0';
+    do {
+        code[--i] = '0' + (nack % 10);
+        nack /= 10;
+    } while (nack != 0);
+    append_str(response, &code[i], max_len);
+}
+
+void nack_append_reason(char* response, nack_t nack, int max_len) {
+    if (nack >= NACK_COUNT) {
+        return;
+    }
+    const char* reason = NACK_REASONS;
+    for (uint8_t i = 0; i < nack; i++) {
+        reason += strlen(reason) + 1;
+    }
+    if (reason[1] == '\0') {
+        // Left out of this build with its feature
+        return;
+    }
+    append_str(response, NACK_WORDS[reason[0] - 1], max_len);
+    append_str(response, &reason[1], max_len);
+}
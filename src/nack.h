@@ -0,0 +1,211 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// The reasons only given by an optional feature keep their code when it's
+// left out, but their text is dropped to save flash
+#ifdef FEATURE_EVENTS
+#define NACK_TEXT_EVENTS(text) text
+#else
+#define NACK_TEXT_EVENTS(text) ""
+#endif
+#ifdef FEATURE_SCHED
+#define NACK_TEXT_SCHED(text) text
+#else
+#define NACK_TEXT_SCHED(text) ""
+#endif
+#ifdef FEATURE_SCOPE
+#define NACK_TEXT_SCOPE(text) text
+#else
+#define NACK_TEXT_SCOPE(text) ""
+#endif
+#ifdef FEATURE_ROLLUP
+#define NACK_TEXT_ROLLUP(text) text
+#else
+#define NACK_TEXT_ROLLUP(text) ""
+#endif
+#ifdef FEATURE_SPECTRUM
+#define NACK_TEXT_SPECTRUM(text) text
+#else
+#define NACK_TEXT_SPECTRUM(text) ""
+#endif
+#ifdef FEATURE_MACROS
+#define NACK_TEXT_MACROS(text) text
+#else
+#define NACK_TEXT_MACROS(text) ""
+#endif
+#ifdef FEATURE_SEQUENCES
+#define NACK_TEXT_SEQUENCES(text) text
+#else
+#define NACK_TEXT_SEQUENCES(text) ""
+#endif
+#ifdef FEATURE_LED_PATTERNS
+#define NACK_TEXT_LED_PATTERNS(text) text
+#else
+#define NACK_TEXT_LED_PATTERNS(text) ""
+#endif
+#ifdef FEATURE_FAN_CURVE
+#define NACK_TEXT_FAN_CURVE(text) text
+#else
+#define NACK_TEXT_FAN_CURVE(text) ""
+#endif
+#ifdef FEATURE_SOC
+#define NACK_TEXT_SOC(text) text
+#else
+#define NACK_TEXT_SOC(text) ""
+#endif
+#ifdef FEATURE_ADMIT
+#define NACK_TEXT_ADMIT(text) text
+#else
+#define NACK_TEXT_ADMIT(text) ""
+#endif
+#ifdef FEATURE_RECLOSE
+#define NACK_TEXT_RECLOSE(text) text
+#else
+#define NACK_TEXT_RECLOSE(text) ""
+#endif
+#ifdef FEATURE_STALL
+#define NACK_TEXT_STALL(text) text
+#else
+#define NACK_TEXT_STALL(text) ""
+#endif
+
+// Every reason a command can be refused, as NACK_<name>. Each reason's code
+// is its position in the list, so new reasons go at the end. The reasons
+// share their leading word, one of NACK_WORD_*, to save flash.
+#define NACK_LIST(X) \
+    X(OVER_CURRENT_BUDGET, NONE, NACK_TEXT_ADMIT("Over current budget")) \
+    X(OUTPUT_SHED, NONE, "Output shed") \
+    X(INVALID_SCHEDULED_TIME, INVALID, NACK_TEXT_SCHED("scheduled time")) \
+    X(SCHEDULED_TIME_HAS_PASSED, NONE, NACK_TEXT_SCHED("Scheduled time has passed")) \
+    X(TOO_MANY_SCHEDULED_CHANGES, NONE, NACK_TEXT_SCHED("Too many scheduled changes")) \
+    X(INVALID_PULSE_DURATION, INVALID, NACK_TEXT_SCHED("pulse duration")) \
+    X(MISSING_SCOPE_COMMAND, MISSING, NACK_TEXT_SCOPE("scope command")) \
+    X(MISSING_SCOPE_SOURCE, MISSING, NACK_TEXT_SCOPE("scope source")) \
+    X(INVALID_SCOPE_SOURCE, INVALID, NACK_TEXT_SCOPE("scope source")) \
+    X(INVALID_SCOPE_THRESHOLD, INVALID, NACK_TEXT_SCOPE("scope threshold")) \
+    X(INVALID_SCOPE_PRE_TRIGGER, INVALID, NACK_TEXT_SCOPE("scope pre-trigger")) \
+    X(INVALID_SCOPE_OFFSET, INVALID, NACK_TEXT_SCOPE("scope offset")) \
+    X(CAPTURE_NOT_DONE, NONE, NACK_TEXT_SCOPE("Capture not done")) \
+    X(INVALID_SCOPE_COMMAND, INVALID, NACK_TEXT_SCOPE("scope command")) \
+    X(MISSING_ROLLUP_COMMAND, MISSING, NACK_TEXT_ROLLUP("rollup command")) \
+    X(INVALID_ROLLUP_COMMAND, INVALID, NACK_TEXT_ROLLUP("rollup command")) \
+    X(INVALID_ROLLUP_TIER, INVALID, NACK_TEXT_ROLLUP("rollup tier")) \
+    X(INVALID_ROLLUP_CHANNEL, INVALID, NACK_TEXT_ROLLUP("rollup channel")) \
+    X(MISSING_ROLLUP_BUCKET, MISSING, NACK_TEXT_ROLLUP("rollup bucket")) \
+    X(INVALID_ROLLUP_BUCKET, INVALID, NACK_TEXT_ROLLUP("rollup bucket")) \
+    X(BUCKET_NOT_HELD, NONE, NACK_TEXT_ROLLUP("Bucket not held")) \
+    X(MISSING_SPECTRUM_COMMAND, MISSING, NACK_TEXT_SPECTRUM("spectrum command")) \
+    X(MISSING_SPECTRUM_SOURCE, MISSING, NACK_TEXT_SPECTRUM("spectrum source")) \
+    X(INVALID_SPECTRUM_SOURCE, INVALID, NACK_TEXT_SPECTRUM("spectrum source")) \
+    X(INVALID_SPECTRUM_DECIMATION, INVALID, NACK_TEXT_SPECTRUM("spectrum decimation")) \
+    X(INVALID_SPECTRUM_COMMAND, INVALID, NACK_TEXT_SPECTRUM("spectrum command")) \
+    X(NO_SPECTRUM_YET, NONE, NACK_TEXT_SPECTRUM("No spectrum yet")) \
+    X(MISSING_SEQUENCE_COMMAND, MISSING, NACK_TEXT_SEQUENCES("sequence command")) \
+    X(SEQUENCE_FULL, NONE, NACK_TEXT_SEQUENCES("Sequence full")) \
+    X(INVALID_SEQUENCE_NOTE, INVALID, NACK_TEXT_SEQUENCES("sequence note")) \
+    X(MISSING_SEQUENCE_NOTE, MISSING, NACK_TEXT_SEQUENCES("sequence note")) \
+    X(INVALID_SEQUENCE_COMMAND, INVALID, NACK_TEXT_SEQUENCES("sequence command")) \
+    X(COMMAND_TOO_LONG, NONE, "Command too long") \
+    X(TAG_TOO_LONG, NONE, "Tag too long") \
+    X(BATCH_TOO_LONG, NONE, "Batch too long") \
+    X(EMPTY_COMMAND, NONE, "Empty command") \
+    X(MISSING_OUTPUT_NUMBER, MISSING, "output number") \
+    X(INVALID_OUTPUT_NUMBER, INVALID, "output number") \
+    X(MISSING_OUTPUT_COMMAND, MISSING, "output command") \
+    X(BRAIN_OUTPUT_CANNOT_BE_CONTROLLED, NONE, "Brain output cannot be controlled") \
+    X(MISSING_OUTPUT_ENABLE_ARGUMENT, MISSING, "output enable argument") \
+    X(INVALID_OUTPUT_ENABLE_ARGUMENT, INVALID, "output enable argument") \
+    X(MISSING_PULSE_DURATION, MISSING, NACK_TEXT_SCHED("pulse duration")) \
+    X(MISSING_OUTPUT_PRIORITY, MISSING, "output priority") \
+    X(INVALID_OUTPUT_PRIORITY, INVALID, "output priority") \
+    X(INVALID_RECLOSE_RETRIES, INVALID, NACK_TEXT_RECLOSE("reclose retries")) \
+    X(INVALID_RECLOSE_BACKOFF, INVALID, NACK_TEXT_RECLOSE("reclose backoff")) \
+    X(INVALID_STALL_RISE, INVALID, NACK_TEXT_STALL("stall rise")) \
+    X(INVALID_STALL_HOLD, INVALID, NACK_TEXT_STALL("stall hold")) \
+    X(INVALID_STALL_PLATEAU, INVALID, NACK_TEXT_STALL("stall plateau")) \
+    X(UNKNOWN_OUTPUT_COMMAND, UNKNOWN, "output command") \
+    X(MISSING_LED_NAME, MISSING, "LED name") \
+    X(INVALID_LED_NAME, INVALID, "LED name") \
+    X(MISSING_LED_ARGUMENT, MISSING, "LED argument") \
+    X(MISSING_LED_VALUE, MISSING, "LED value") \
+    X(INVALID_LED_VALUE, INVALID, "LED value") \
+    X(INVALID_LED_PATTERN, INVALID, NACK_TEXT_LED_PATTERNS("LED pattern")) \
+    X(FAILED_TO_GET_PIN_STATE, NONE, "Failed to get pin state") \
+    X(INVALID_LED_ARGUMENT, INVALID, "LED argument") \
+    X(MISSING_ARGUMENT, MISSING, "argument") \
+    X(MISSING_ADMISSION_COMMAND, MISSING, NACK_TEXT_ADMIT("admission command")) \
+    X(MISSING_ADMISSION_STATE, MISSING, NACK_TEXT_ADMIT("admission state")) \
+    X(INVALID_ADMISSION_STATE, INVALID, NACK_TEXT_ADMIT("admission state")) \
+    X(UNKNOWN_ADMISSION_COMMAND, UNKNOWN, NACK_TEXT_ADMIT("admission command")) \
+    X(MISSING_CAPACITY, MISSING, NACK_TEXT_SOC("capacity")) \
+    X(INVALID_CAPACITY, INVALID, NACK_TEXT_SOC("capacity")) \
+    X(MISSING_UVLO_COMMAND, MISSING, NACK_TEXT_SOC("UVLO command")) \
+    X(MISSING_UVLO_COMPENSATION, MISSING, NACK_TEXT_SOC("UVLO compensation")) \
+    X(INVALID_UVLO_COMPENSATION, INVALID, NACK_TEXT_SOC("UVLO compensation")) \
+    X(UNKNOWN_UVLO_COMMAND, UNKNOWN, NACK_TEXT_SOC("UVLO command")) \
+    X(UNKNOWN_BATTERY_COMMAND, UNKNOWN, "battery command") \
+    X(MISSING_BUTTON_NAME, MISSING, "button name") \
+    X(MISSING_BUTTON_COMMAND, MISSING, "button command") \
+    X(INVALID_BUTTON_COMMAND, INVALID, "button command") \
+    X(INVALID_BUTTON_NAME, INVALID, "button name") \
+    X(MISSING_NOTE_FREQUENCY, MISSING, "note frequency") \
+    X(INVALID_NOTE_FREQUENCY, INVALID, "note frequency") \
+    X(MISSING_NOTE_DURATION, MISSING, "note duration") \
+    X(INVALID_NOTE_DURATION, INVALID, "note duration") \
+    X(MISSING_SYSTEM_COMMAND, MISSING, "system command") \
+    X(MISSING_COEFFICIENT_COMMAND, MISSING, "coefficient command") \
+    X(MISSING_COEFFICIENT_SET_ARGUMENT, MISSING, "coefficient set argument") \
+    X(COEFFICIENT_MUST_FIT_IN_UINT16, NONE, "Coefficient must fit in uint16") \
+    X(COEFFICIENTS_MUST_BE_POSITIVE_INTEGERS, NONE, "Coefficients must be positive integers") \
+    X(UNKNOWN_COEFFICIENT_COMMAND, UNKNOWN, "coefficient command") \
+    X(MISSING_TICK_COMMAND, MISSING, "tick command") \
+    X(UNKNOWN_TICK_COMMAND, UNKNOWN, "tick command") \
+    X(MISSING_BRAIN_COMMAND, MISSING, "brain command") \
+    X(MISSING_BRAIN_ENABLE_ARGUMENT, MISSING, "brain enable argument") \
+    X(INVALID_BRAIN_ENABLE_ARGUMENT, INVALID, "brain enable argument") \
+    X(UNKNOWN_BRAIN_COMMAND, UNKNOWN, "brain command") \
+    X(MISSING_FAN_COMMAND, MISSING, "fan command") \
+    X(MISSING_FAN_OVERRIDE_ARGUMENT, MISSING, "fan override argument") \
+    X(INVALID_FAN_OVERRIDE_ARGUMENT, INVALID, "fan override argument") \
+    X(INVALID_FAN_CURVE, INVALID, NACK_TEXT_FAN_CURVE("fan curve")) \
+    X(UNKNOWN_FAN_COMMAND, UNKNOWN, "fan command") \
+    X(INVALID_SYSTEM_COMMAND, INVALID, "system command") \
+    X(MISSING_EVENT_COMMAND, MISSING, NACK_TEXT_EVENTS("event command")) \
+    X(MISSING_EVENT_ENABLE_ARGUMENT, MISSING, NACK_TEXT_EVENTS("event enable argument")) \
+    X(INVALID_EVENT_ENABLE_ARGUMENT, INVALID, NACK_TEXT_EVENTS("event enable argument")) \
+    X(UNKNOWN_EVENT_COMMAND, UNKNOWN, NACK_TEXT_EVENTS("event command")) \
+    X(MISSING_MACRO_NUMBER, MISSING, NACK_TEXT_MACROS("macro number")) \
+    X(INVALID_MACRO_NUMBER, INVALID, NACK_TEXT_MACROS("macro number")) \
+    X(MISSING_MACRO_COMMAND, MISSING, NACK_TEXT_MACROS("macro command")) \
+    X(MISSING_MACRO_TRIGGER, MISSING, NACK_TEXT_MACROS("macro trigger")) \
+    X(INVALID_MACRO_TRIGGER, INVALID, NACK_TEXT_MACROS("macro trigger")) \
+    X(INVALID_MACRO_TRIGGER_ARGUMENT, INVALID, NACK_TEXT_MACROS("macro trigger argument")) \
+    X(MISSING_MACRO_COMMAND_TO_ADD, MISSING, NACK_TEXT_MACROS("macro command to add")) \
+    X(MACROS_CANNOT_CONTAIN_MACRO_COMMANDS, NONE, NACK_TEXT_MACROS("Macros cannot contain MACRO commands")) \
+    X(MACRO_TOO_LONG, NONE, NACK_TEXT_MACROS("Macro too long")) \
+    X(UNKNOWN_MACRO_COMMAND, UNKNOWN, NACK_TEXT_MACROS("macro command")) \
+    X(UNKNOWN_COMMAND, UNKNOWN, "command") \
+    X(UNKNOWN_ERROR, UNKNOWN, "error") \
+    X(MISSING_NACK_COMMAND, MISSING, "NACK command") \
+    X(INVALID_NACK_MODE, INVALID, "NACK mode") \
+    X(INVALID_NACK_CODE, INVALID, "NACK code") \
+    X(UNKNOWN_NACK_COMMAND, UNKNOWN, "NACK command") \
+    X(OUTPUT_TRIPPED, NONE, "Output tripped") \
+    X(INVALID_MACRO_COMMAND_TO_ADD, INVALID, NACK_TEXT_MACROS("macro command to add")) \
+
+typedef enum {
+#define NACK_ENUM(name, word, text) NACK_##name,
+    NACK_LIST(NACK_ENUM)
+#undef NACK_ENUM
+    NACK_COUNT
+} nack_t;
+
+// Send codes, NACK:<code>, rather than reasons. Cleared when the host connects.
+extern volatile bool nack_numeric;
+
+// Append NACK: and the reason or its code to a response
+void nack_append(char* response, nack_t nack, int max_len);
+// Append the reason alone
+void nack_append_reason(char* response, nack_t nack, int max_len);
@@ -4,6 +4,13 @@
 #include "fan.h"
 #include "cdcacm.h"
 #include "buzzer.h"
+#include "events.h"
+#include "sched.h"
+#include "macro.h"
+#include "soc.h"
+#include "reclose.h"
+#include "scope.h"
+#include "spectrum.h"
 
 #include <libopencm3/stm32/gpio.h>
 #include <libopencm3/cm3/systick.h>
@@ -31,6 +38,13 @@ uint16_t uvlo_delay = 0;
 uint16_t neg_current_delay = 0;
 volatile uint16_t output_current[7] = {0};  // reg value here is unused
 volatile bool output_inhibited[7] = {0};
+// Motors first, then the other 12V outputs and the 5V regulator, never the brain
+volatile uint8_t output_priority[7] = {1, 1, 2, 2, SHED_PRIORITY_KEEP, 2, 3};
+volatile bool output_shed[7] = {0};
+uint16_t shed_current_delay = 0;
+uint16_t shed_uvlo_delay = 0;
+uint16_t shed_recover_delay = 0;
+bool shed_current_high = false;
 
 void outputs_init(void) {
     // SMPS
@@ -52,7 +66,7 @@ void outputs_init(void) {
     setup_current_phase(0);
 }
 
-void setup_current_phase(uint8_t phase) {
+RAMFUNC void setup_current_phase(uint8_t phase) {
     // Disable all current-sense pins
     gpio_set(GPIOC, 0x000f);
 
@@ -63,22 +77,34 @@ void setup_current_phase(uint8_t phase) {
     // Enable selected phase
     gpio_clear(GPIOC, OUTPUT_CSDIS_PIN[phase]);
 }
-void save_current_values(uint8_t phase, uint16_t current1, uint16_t current2) {
+RAMFUNC void save_current_values(uint8_t phase, uint16_t current1, uint16_t current2) {
     uint16_t total_current = current1 + current2;
     switch (phase) {
         case 0:  // H0
             output_current[OUT_H0] = total_current;
+            scope_sample(OUT_H0, total_current);
+            spectrum_sample(OUT_H0, total_current);
             break;
         case 1:  // H1
             output_current[OUT_H1] = total_current;
+            scope_sample(OUT_H1, total_current);
+            spectrum_sample(OUT_H1, total_current);
             break;
         case 2:  // L0 & L1
             output_current[OUT_L0] = current1;
             output_current[OUT_L1] = current2;
+            scope_sample(OUT_L0, current1);
+            spectrum_sample(OUT_L0, current1);
+            scope_sample(OUT_L1, current2);
+            spectrum_sample(OUT_L1, current2);
             break;
         case 3:  // L2 & L3
             output_current[OUT_L2] = current1;
             output_current[OUT_L3] = current2;
+            scope_sample(OUT_L2, current1);
+            spectrum_sample(OUT_L2, current1);
+            scope_sample(OUT_L3, current2);
+            spectrum_sample(OUT_L3, current2);
             break;
     }
 }
@@ -95,6 +121,10 @@ bool enable_output(output_t out, bool enable) {
         // Output has had an overcurrent and is disabled
         return false;
     }
+    if (enable && output_shed[out]) {
+        // Output is held off until the battery recovers
+        return false;
+    }
 
     _enable_output(out, enable);
     return true;
@@ -104,8 +134,82 @@ bool output_enabled(output_t out) {
     return (gpio_get(OUTPUT_PORT[out], OUTPUT_PIN[out]))?true:false;
 }
 
+uint16_t output_current_limit(output_t out) {
+    if (out == OUT_5V) {
+        return 2000;
+    }
+    return (out <= OUT_H1) ? 20000 : 10000;
+}
+
+uint16_t output_draw(output_t out) {
+    if (out == OUT_5V) {
+        return (reg_5v.success && (reg_5v.current > 0))?reg_5v.current:0;
+    }
+    return output_current[out];
+}
+
+bool output_set_priority(output_t out, uint8_t priority) {
+    if (priority > SHED_PRIORITY_KEEP) {
+        return false;
+    }
+    output_priority[out] = priority;
+    return true;
+}
+
+// Switch off the enabled outputs with the lowest priority, along with any
+// disabled ones at or below it, returning false if there are none left to shed
+static bool shed_next_stage(void) {
+    uint8_t lowest = SHED_PRIORITY_KEEP;
+    for (output_t out=OUT_H0; out <= OUT_5V; out++) {
+        if (output_enabled(out) && !output_shed[out] && (output_priority[out] < lowest)) {
+            lowest = output_priority[out];
+        }
+    }
+    if (lowest == SHED_PRIORITY_KEEP) {
+        return false;
+    }
+
+    for (output_t out=OUT_H0; out <= OUT_5V; out++) {
+        if (output_shed[out] || (output_priority[out] > lowest)) {continue;}
+        if (output_enabled(out)) {
+            event_push(EVENT_SHED, out);
+        }
+        _enable_output(out, false);
+        output_shed[out] = true;
+    }
+    return true;
+}
+
+// Allow shed outputs to be enabled again once the battery has recovered,
+// called every 20ms
+static void shed_recover(bool voltage_ok) {
+    uint8_t shed_mask = 0;
+    for (output_t out=OUT_H0; out <= OUT_5V; out++) {
+        if (output_shed[out]) {
+            shed_mask |= (1 << out);
+        }
+    }
+    if ((shed_mask == 0) || shed_current_high || !voltage_ok) {
+        shed_recover_delay = 0;
+        return;
+    }
+    shed_recover_delay += 20;
+    if (shed_recover_delay >= SHED_RECOVER_TIME) {
+        for (output_t out=OUT_H0; out <= OUT_5V; out++) {
+            output_shed[out] = false;
+        }
+        event_push(EVENT_SHED_CLEAR, shed_mask);
+        shed_recover_delay = 0;
+    }
+}
+
 void set_overcurrent(output_t out, bool overcurrent) {
     if (overcurrent) {
+        if (!output_inhibited[out]) {
+            event_push(EVENT_OVERCURRENT, out);
+            macro_trigger_overcurrent(out);
+            reclose_trip(out);
+        }
         // disable channel
         _enable_output(out, false);
         output_inhibited[out] = true;
@@ -187,10 +291,31 @@ static void set_global_overcurrent(void) {
 }
 
 void handle_uvlo(void) {
+    int16_t voltage = soc_uvlo_voltage(battery.voltage);
+
+    // Shed load as the voltage nears UVLO
+    if ((battery.success) && (voltage < (UVLO_VOLTAGE + SHED_UVLO_MARGIN))) {
+        shed_uvlo_delay += 20;
+        if (shed_uvlo_delay > SHED_UVLO_DELAY) {
+            shed_next_stage();
+            shed_uvlo_delay = 0;
+        }
+    } else {
+        shed_uvlo_delay = 0;
+    }
+    shed_recover(
+        !battery.success
+        || (voltage >= (UVLO_VOLTAGE + SHED_UVLO_MARGIN + SHED_UVLO_HYSTERESIS)));
+
     // Test if global voltage is below 10.2V
-    if ((battery.success) && (battery.voltage < 10200)) {
+    if ((battery.success) && (voltage < UVLO_VOLTAGE)) {
+        if (uvlo_delay == 0) {
+            event_push(EVENT_UVLO, 1);
+        }
         uvlo_delay+=20;
-        if (uvlo_delay > UVLO_DELAY) {
+        // Past the holdoff it stays latched, shedding a stage with each new
+        // measurement, every SHED_STAGE_TIME, until there's nothing left to shed
+        if ((uvlo_delay > UVLO_DELAY) && !shed_next_stage()) {
             disable_all_outputs(true);
             set_led(LED_FLAT);
 
@@ -212,16 +337,17 @@ void handle_uvlo(void) {
             }
         }
     } else {
+        if (uvlo_delay != 0) {
+            event_push(EVENT_UVLO, 0);
+        }
         uvlo_delay = 0;
     }
 }
 
-void detect_overcurrent(void) {
+RAMFUNC void detect_overcurrent(void) {
     // Test individual output currents
     for (output_t out=OUT_H0; out <= OUT_L3; out++) {
-        uint16_t current_limit = (out <= OUT_H1) ? 20000 : 10000;
-
-        if (output_current[out] > current_limit) {
+        if (output_current[out] > output_current_limit(out)) {
             overcurrent_delay[out]++;
             if (overcurrent_delay[out] > ADC_OVERCURRENT_DELAY) {
                 // disable channel
@@ -231,7 +357,7 @@ void detect_overcurrent(void) {
             overcurrent_delay[out] = 0;
         }
     }
-    if ((reg_5v.success) && (reg_5v.current > 2000)) {
+    if ((reg_5v.success) && (reg_5v.current > output_current_limit(OUT_5V))) {
         overcurrent_delay[OUT_5V]++;
         if (overcurrent_delay[OUT_5V] > REG_OVERCURRENT_DELAY) {
             // disable channel
@@ -250,15 +376,40 @@ void detect_overcurrent(void) {
     if (reg_5v.success) {
         total_current += reg_5v.current;
     }
+    // Shed load as the current nears the limit
+    shed_current_high = (
+        (total_current > SHED_CURRENT_LIMIT)
+        || ((battery.success) && (battery.current > SHED_CURRENT_LIMIT))
+    );
+    if (shed_current_high) {
+        if (++shed_current_delay > SHED_CURRENT_DELAY) {
+            shed_next_stage();
+            shed_current_delay = 0;
+        }
+    } else {
+        shed_current_delay = 0;
+    }
+
     if (
-        (total_current > 30000)
-        || ((battery.success) && (battery.current > 30000))
+        (total_current > GLOBAL_CURRENT_LIMIT)
+        || ((battery.success) && (battery.current > GLOBAL_CURRENT_LIMIT))
     ) {
+        if (overcurrent_delay[7] == 0) {
+            event_push(EVENT_BATT_OVERCURRENT, 1);
+        }
         overcurrent_delay[7]++;
-        if (overcurrent_delay[7] > BATT_OVERCURRENT_DELAY) {
+        // Past the holdoff it stays latched, shedding a stage each time the
+        // current has had time to fall without the last, until there's
+        // nothing left to shed
+        if ((overcurrent_delay[7] > BATT_OVERCURRENT_DELAY)
+                && (((overcurrent_delay[7] - BATT_OVERCURRENT_DELAY - 1) % SHED_STAGE_TIME) == 0)
+                && !shed_next_stage()) {
             set_global_overcurrent();
         }
     } else {
+        if (overcurrent_delay[7] != 0) {
+            event_push(EVENT_BATT_OVERCURRENT, 0);
+        }
         overcurrent_delay[7] = 0;
     }
 
@@ -290,6 +441,11 @@ void disable_all_outputs(bool disable_brain) {
 }
 
 void usb_reset_callback(void) {
+    // Nothing scheduled by the host should happen once it's gone, nor should
+    // tripped outputs be reclosed
+    sched_cancel(SCHED_ALL_OUTPUTS);
+    reclose_clear_all();
+
     // Switch off all outputs except brain
     for (uint8_t i = 0; i < 7; i++) {
         if (i != BRAIN_OUTPUT) {
@@ -305,8 +461,12 @@ void usb_reset_callback(void) {
 }
 
 void reset_board(void) {
+    sched_cancel(SCHED_ALL_OUTPUTS);
+    macro_clear_all();
+    reclose_clear_all();
     for (uint8_t i = 0; i < 7; i++) {
         set_overcurrent(i, false);
+        output_shed[i] = false;
         if (i == BRAIN_OUTPUT) {
             enable_output(i, true);
         } else {
@@ -5,8 +5,27 @@
 
 typedef enum {OUT_H0=0, OUT_H1, OUT_L0, OUT_L1, OUT_L2, OUT_L3, OUT_5V} output_t;
 
+#define UVLO_VOLTAGE 10200  // mV
+#define GLOBAL_CURRENT_LIMIT 30000  // mA
+
+// Before the global limits are reached, outputs are shed in order of
+// priority, lowest first. Outputs with SHED_PRIORITY_KEEP are only switched
+// off by the final shutdown.
+#define SHED_PRIORITY_KEEP 7
+#define SHED_CURRENT_LIMIT 27000  // mA
+#define SHED_CURRENT_DELAY 20  // ms over the limit between stages
+#define SHED_UVLO_MARGIN 400  // mV above UVLO_VOLTAGE
+#define SHED_UVLO_HYSTERESIS 200  // mV
+#define SHED_UVLO_DELAY 200  // ms under the margin between stages
+#define SHED_RECOVER_TIME 2000  // ms clear of both before outputs can be enabled again
+// ms between stages while the 30A or UVLO limit is held past its holdoff, the
+// time the battery measurement takes to include the last stage
+#define SHED_STAGE_TIME 20
+
 extern volatile uint16_t output_current[];
 extern volatile bool output_inhibited[];
+extern volatile uint8_t output_priority[];
+extern volatile bool output_shed[];
 
 void outputs_init(void);
 
@@ -15,6 +34,10 @@ void save_current_values(uint8_t phase, uint16_t current1, uint16_t current2);
 
 bool enable_output(output_t out, bool enable);
 bool output_enabled(output_t out);
+// The overcurrent trip limit and the present draw of an output, mA
+uint16_t output_current_limit(output_t out);
+uint16_t output_draw(output_t out);
+bool output_set_priority(output_t out, uint8_t priority);
 
 void handle_uvlo(void);
 void detect_overcurrent(void);
@@ -0,0 +1,107 @@
+#include "reclose.h"
+#include "global_vars.h"
+#include "events.h"
+
+typedef struct {
+    uint8_t attempts;
+    volatile bool pending;
+    uint32_t due;  // uptime in ms of the next retry
+    uint32_t clear_since;  // uptime in ms since the output last ran without tripping
+    uint32_t heat;  // filtered square of the current in 0.1A, << RECLOSE_HEAT_SHIFT
+} reclose_state_t;
+
+static reclose_policy_t reclose_policy[7] = {0};
+static reclose_state_t reclose_state[7] = {0};
+
+bool reclose_set_policy(output_t out, const reclose_policy_t* policy) {
+    if ((policy->retries != 0) && ((policy->backoff == 0) || (policy->max_backoff < policy->backoff))) {
+        return false;
+    }
+    reclose_policy[out] = *policy;
+    if (policy->retries == 0) {
+        reclose_state[out].pending = false;
+    }
+    return true;
+}
+
+void reclose_get_policy(output_t out, reclose_policy_t* policy) {
+    *policy = reclose_policy[out];
+}
+
+uint8_t reclose_attempts(output_t out, bool* pending) {
+    *pending = reclose_state[out].pending;
+    return reclose_state[out].attempts;
+}
+
+void reclose_cancel(output_t out) {
+    reclose_state[out].pending = false;
+    reclose_state[out].attempts = 0;
+}
+
+void reclose_clear(output_t out) {
+    reclose_cancel(out);
+    set_overcurrent(out, false);
+}
+
+void reclose_clear_all(void) {
+    for (output_t out=OUT_H0; out <= OUT_5V; out++) {
+        reclose_cancel(out);
+    }
+}
+
+void reclose_trip(output_t out) {
+    const reclose_policy_t* policy = &reclose_policy[out];
+    reclose_state_t* state = &reclose_state[out];
+    if (state->attempts >= policy->retries) {
+        // Out of retries, the host has to clear it
+        state->pending = false;
+        return;
+    }
+
+    // Double for each retry used, stopping at the maximum before it can overflow
+    uint32_t backoff = policy->backoff;
+    for (uint8_t i = 0; (i < state->attempts) && (backoff < policy->max_backoff); i++) {
+        backoff <<= 1;
+    }
+    if (backoff > policy->max_backoff) {
+        backoff = policy->max_backoff;
+    }
+    state->attempts++;
+    state->due = uptime_ms + backoff;
+    state->pending = true;
+}
+
+// Called every ms
+void reclose_tick(void) {
+    for (output_t out=OUT_H0; out <= OUT_5V; out++) {
+        reclose_state_t* state = &reclose_state[out];
+
+        uint32_t draw = output_draw(out) / 100;
+        state->heat += (draw * draw) - (state->heat >> RECLOSE_HEAT_SHIFT);
+
+        if (!output_inhibited[out]) {
+            // Forget the retries once the output has run clear for long enough
+            if (state->attempts == 0) {
+                state->clear_since = uptime_ms;
+            } else if ((uptime_ms - state->clear_since) >= RECLOSE_RESET_TIME) {
+                state->attempts = 0;
+            }
+            continue;
+        }
+        state->clear_since = uptime_ms;
+
+        if (!state->pending || ((int32_t)(uptime_ms - state->due) < 0)) {
+            continue;
+        }
+        uint32_t cool = output_current_limit(out) / 200;
+        if ((state->heat >> RECLOSE_HEAT_SHIFT) >= (cool * cool)) {
+            continue;
+        }
+
+        state->pending = false;
+        set_overcurrent(out, false);
+        if (enable_output(out, true)) {
+            event_push(EVENT_RECLOSE, out);
+        }
+    }
+}
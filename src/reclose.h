@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "output.h"
+
+// Automatic reclosing of outputs switched off by overcurrent. After each trip
+// the output is re-enabled once its backoff has passed and its heating
+// estimate has cooled, the backoff doubling with each retry.
+
+// Trip-free time after which the retries start again, ms
+#define RECLOSE_RESET_TIME 5000
+// The heating estimate is the square of the current filtered over ~1s. An
+// output can reclose once it's below the square of half its current limit.
+#define RECLOSE_HEAT_SHIFT 10
+
+typedef struct {
+    uint8_t retries;  // 0 disables reclosing
+    uint16_t backoff;  // ms before the first retry
+    uint16_t max_backoff;  // ms, the longest the backoff doubles to
+} reclose_policy_t;
+
+bool reclose_set_policy(output_t out, const reclose_policy_t* policy);
+void reclose_get_policy(output_t out, reclose_policy_t* policy);
+// Retries used since the output last ran clear, and whether one is pending
+uint8_t reclose_attempts(output_t out, bool* pending);
+#ifdef FEATURE_RECLOSE
+// Drop any pending retry once the output is meant to stay off, keeping the trip
+void reclose_cancel(output_t out);
+// Clear an output's trip and retries, leaving it off. Only to be called from the main loop.
+void reclose_clear(output_t out);
+void reclose_clear_all(void);
+
+// Only to be called from the systick handler
+void reclose_trip(output_t out);
+void reclose_tick(void);
+#else
+// Without reclosing a trip stays until it's cleared
+static inline void reclose_cancel(output_t out) {(void)out;}
+static inline void reclose_clear(output_t out) {set_overcurrent(out, false);}
+static inline void reclose_clear_all(void) {}
+static inline void reclose_trip(output_t out) {(void)out;}
+static inline void reclose_tick(void) {}
+#endif
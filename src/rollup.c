@@ -0,0 +1,146 @@
+#include "rollup.h"
+#include "global_vars.h"
+#include "output.h"
+
+// Prevent the compiler moving memory accesses across this point
+#define compiler_barrier() __asm__ volatile("" ::: "memory")
+
+// A channel's value is offset + step * its 8 bit code
+typedef struct {
+    int16_t offset;
+    uint8_t step;
+} rollup_scale_t;
+
+static const rollup_scale_t ROLLUP_SCALE[ROLLUP_CHANNELS] = {
+    {0, 100}, {0, 100}, {0, 100}, {0, 100}, {0, 100}, {0, 100},
+    [ROLLUP_REG] = {0, 10},
+    [ROLLUP_BATT_I] = {0, 200},
+    [ROLLUP_BATT_V] = {4000, 40},
+    [ROLLUP_TEMP] = {-200, 5},
+};
+
+// The bucket's end time follows from its position, so isn't stored
+typedef struct {
+    uint8_t min[ROLLUP_CHANNELS];
+    uint8_t mean[ROLLUP_CHANNELS];
+    uint8_t max[ROLLUP_CHANNELS];
+} rollup_stored_t;
+
+typedef struct {
+    uint8_t min[ROLLUP_CHANNELS];
+    uint8_t max[ROLLUP_CHANNELS];
+    uint16_t sum[ROLLUP_CHANNELS];
+    uint8_t count;
+} rollup_acc_t;
+
+// Written by the systick handler, a bucket is complete once written counts it
+static rollup_stored_t rollup_buckets[ROLLUP_TIERS][ROLLUP_LEN];
+static volatile uint32_t rollup_count[ROLLUP_TIERS] = {0};
+static rollup_acc_t rollup_acc[ROLLUP_TIERS] = {0};
+// The last good code of each channel, used when a measurement fails
+static uint8_t rollup_last[ROLLUP_CHANNELS] = {0};
+// Uptime before the first sample, each tier's buckets end a whole interval after it
+static uint32_t rollup_origin = 0;
+
+static uint8_t encode(uint8_t ch, int32_t value) {
+    // Rounded to the nearest step
+    int32_t code = (value - ROLLUP_SCALE[ch].offset + ROLLUP_SCALE[ch].step / 2)
+        / ROLLUP_SCALE[ch].step;
+    if (code < 0) {
+        return 0;
+    }
+    return (code > UINT8_MAX)?UINT8_MAX:code;
+}
+
+static int16_t decode(uint8_t ch, uint8_t code) {
+    return ROLLUP_SCALE[ch].offset + (int16_t)ROLLUP_SCALE[ch].step * code;
+}
+
+static void acc_add(rollup_acc_t* acc, const uint8_t* min, const uint8_t* mean, const uint8_t* max) {
+    for (uint8_t ch = 0; ch < ROLLUP_CHANNELS; ch++) {
+        if ((acc->count == 0) || (min[ch] < acc->min[ch])) {
+            acc->min[ch] = min[ch];
+        }
+        if ((acc->count == 0) || (max[ch] > acc->max[ch])) {
+            acc->max[ch] = max[ch];
+        }
+        acc->sum[ch] = ((acc->count == 0)?0:acc->sum[ch]) + mean[ch];
+    }
+    acc->count++;
+}
+
+static void tier_add(uint8_t tier, const uint8_t* min, const uint8_t* mean, const uint8_t* max) {
+    rollup_acc_t* acc = &rollup_acc[tier];
+    acc_add(acc, min, mean, max);
+    if (acc->count < ((tier == 0)?ROLLUP_FIRST_SAMPLES:ROLLUP_TIER_RATIO)) {
+        return;
+    }
+
+    uint32_t seq = rollup_count[tier];
+    rollup_stored_t* bucket = &rollup_buckets[tier][seq % ROLLUP_LEN];
+    for (uint8_t ch = 0; ch < ROLLUP_CHANNELS; ch++) {
+        bucket->min[ch] = acc->min[ch];
+        bucket->max[ch] = acc->max[ch];
+        bucket->mean[ch] = (acc->sum[ch] + acc->count / 2) / acc->count;
+    }
+    acc->count = 0;
+    compiler_barrier();
+    rollup_count[tier] = seq + 1;
+
+    if ((tier + 1) < ROLLUP_TIERS) {
+        tier_add(tier + 1, bucket->min, bucket->mean, bucket->max);
+    }
+}
+
+void rollup_sample(int16_t temp) {
+    if ((rollup_count[0] == 0) && (rollup_acc[0].count == 0)) {
+        rollup_origin = uptime_ms - 20;
+    }
+
+    uint8_t* codes = rollup_last;
+    for (output_t out=OUT_H0; out < OUT_5V; out++) {
+        codes[out] = encode(out, output_current[out]);
+    }
+    if (reg_5v.success) {
+        codes[ROLLUP_REG] = encode(ROLLUP_REG, reg_5v.current);
+    }
+    if (battery.success) {
+        codes[ROLLUP_BATT_I] = encode(ROLLUP_BATT_I, battery.current);
+        codes[ROLLUP_BATT_V] = encode(ROLLUP_BATT_V, battery.voltage);
+    }
+    codes[ROLLUP_TEMP] = encode(ROLLUP_TEMP, temp);
+
+    tier_add(0, codes, codes, codes);
+}
+
+uint32_t rollup_interval(uint8_t tier) {
+    uint32_t interval = 20 * ROLLUP_FIRST_SAMPLES;
+    for (uint8_t i = 0; i < tier; i++) {
+        interval *= ROLLUP_TIER_RATIO;
+    }
+    return interval;
+}
+
+uint32_t rollup_written(uint8_t tier) {
+    return rollup_count[tier];
+}
+
+bool rollup_read(uint8_t tier, uint32_t seq, rollup_bucket_t* bucket) {
+    if ((tier >= ROLLUP_TIERS) || (seq >= rollup_count[tier])) {
+        return false;
+    }
+    rollup_stored_t stored = rollup_buckets[tier][seq % ROLLUP_LEN];
+    compiler_barrier();
+    // The systick handler may have started replacing the bucket during the copy
+    if ((rollup_count[tier] - seq) >= ROLLUP_LEN) {
+        return false;
+    }
+
+    bucket->timestamp = rollup_origin + (seq + 1) * rollup_interval(tier);
+    for (uint8_t ch = 0; ch < ROLLUP_CHANNELS; ch++) {
+        bucket->min[ch] = decode(ch, stored.min[ch]);
+        bucket->mean[ch] = decode(ch, stored.mean[ch]);
+        bucket->max[ch] = decode(ch, stored.max[ch]);
+    }
+    return true;
+}
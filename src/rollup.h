@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Telemetry history kept as min/mean/max buckets in tiers of increasing
+// length, each tier built from the buckets of the one below
+
+#define ROLLUP_TIERS 3
+#define ROLLUP_LEN 20  // buckets kept in each tier
+// Samples taken every 20ms make a bucket of the first tier, then this many
+// buckets of one tier make a bucket of the next
+#define ROLLUP_FIRST_SAMPLES 5
+#define ROLLUP_TIER_RATIO 10
+
+// Channels 0-5 are the outputs in output_t order
+enum {
+    ROLLUP_REG = 6,  // 5V regulator current, mA
+    ROLLUP_BATT_I,  // battery current, mA
+    ROLLUP_BATT_V,  // battery voltage, mV
+    ROLLUP_TEMP,  // board temperature, 0.1 degrees C
+    ROLLUP_CHANNELS
+};
+
+// Values are held as 8 bits, in steps of 100mA for the outputs, 10mA for the
+// regulator, 200mA for the battery current, 40mV above 4V for the battery
+// voltage and 0.5 degrees above -20C for the temperature, clamped to the range
+// that covers. Buckets are read back in the units above.
+typedef struct {
+    uint32_t timestamp;  // uptime in ms at the end of the bucket
+    int16_t min[ROLLUP_CHANNELS];
+    int16_t mean[ROLLUP_CHANNELS];
+    int16_t max[ROLLUP_CHANNELS];
+} rollup_bucket_t;
+
+// Only to be called from the systick handler, every 20ms after the measurements
+#ifdef FEATURE_ROLLUP
+void rollup_sample(int16_t temp);
+#else
+static inline void rollup_sample(int16_t temp) {(void)temp;}
+#endif
+
+// Length of each bucket in a tier, ms
+uint32_t rollup_interval(uint8_t tier);
+// Buckets completed in a tier since startup, the newest is number written - 1
+uint32_t rollup_written(uint8_t tier);
+// Copy bucket number seq of a tier, returning false if it isn't held
+bool rollup_read(uint8_t tier, uint32_t seq, rollup_bucket_t* bucket);
@@ -0,0 +1,202 @@
+#include "sched.h"
+#include "global_vars.h"
+#include "reclose.h"
+
+// Must be powers of 2
+#define SCHED_WHEEL_SLOTS 64
+#define SCHED_REQUEST_QUEUE_LEN 16
+
+#define SCHED_NONE 0xff
+
+// Prevent the compiler moving memory accesses across this point
+#define compiler_barrier() __asm__ volatile("" ::: "memory")
+
+typedef struct {
+    uint32_t due;  // uptime in ms
+    uint8_t out;
+    bool state;
+    uint8_t next;  // next action in the same wheel slot
+} sched_action_t;
+
+// Requests from the main loop, the wheel itself is only touched by the systick handler
+typedef struct {
+    uint32_t due;
+    uint8_t out;
+    bool state;
+    // The cancel generations when the request was made, a request made
+    // before a cancel is dropped
+    uint8_t cancel_gen;
+    uint8_t cancel_all_gen;
+} sched_request_t;
+
+// Incremented by the main loop to cancel, so no queue space is needed
+static volatile uint8_t sched_cancel_gen[OUT_5V + 1] = {0};
+static volatile uint8_t sched_cancel_all_gen = 0;
+// The generations the systick handler has acted on
+static uint8_t sched_seen_cancel_gen[OUT_5V + 1] = {0};
+static uint8_t sched_seen_cancel_all_gen = 0;
+
+static sched_request_t sched_requests[SCHED_REQUEST_QUEUE_LEN];
+static volatile uint8_t sched_request_head = 0;
+static volatile uint8_t sched_request_tail = 0;
+
+// Written only by the main loop and the systick handler respectively, so
+// the outstanding count needs no locking
+static volatile uint32_t sched_requested = 0;
+static volatile uint32_t sched_completed = 0;
+
+static sched_action_t sched_actions[SCHED_MAX_ACTIONS];
+// Actions due in each ms, modulo the wheel size
+static uint8_t sched_wheel[SCHED_WHEEL_SLOTS];
+static uint8_t sched_free = SCHED_NONE;
+
+static bool sched_push_request(sched_request_t request) {
+    uint8_t next_head = (sched_request_head + 1) & (SCHED_REQUEST_QUEUE_LEN - 1);
+    if (next_head == sched_request_tail) {
+        return false;
+    }
+    sched_requests[sched_request_head] = request;
+    compiler_barrier();  // write the request before publishing it
+    sched_request_head = next_head;
+    return true;
+}
+
+bool sched_available(uint8_t count) {
+    return (sched_requested - sched_completed + count) <= SCHED_MAX_ACTIONS;
+}
+
+bool sched_output(output_t out, bool state, uint32_t due) {
+    if (!sched_available(1)) {
+        return false;
+    }
+    sched_request_t request = {
+        .due = due,
+        .out = out,
+        .state = state,
+        .cancel_gen = sched_cancel_gen[out],
+        .cancel_all_gen = sched_cancel_all_gen,
+    };
+    if (!sched_push_request(request)) {
+        return false;
+    }
+    sched_requested++;
+    return true;
+}
+
+void sched_cancel(uint8_t out) {
+    if (out == SCHED_ALL_OUTPUTS) {
+        sched_cancel_all_gen++;
+    } else {
+        sched_cancel_gen[out]++;
+    }
+}
+
+void sched_init(void) {
+    for (uint8_t i = 0; i < SCHED_WHEEL_SLOTS; i++) {
+        sched_wheel[i] = SCHED_NONE;
+    }
+    for (uint8_t i = 0; i < SCHED_MAX_ACTIONS; i++) {
+        sched_actions[i].next = (i + 1 < SCHED_MAX_ACTIONS) ? i + 1 : SCHED_NONE;
+    }
+    sched_free = 0;
+}
+
+static void sched_run(uint8_t out, bool state) {
+    if (!state) {
+        // The host wants the output off, so it mustn't be reclosed after a trip
+        reclose_cancel(out);
+    }
+    enable_output(out, state);
+}
+
+static void sched_complete(uint8_t idx) {
+    sched_actions[idx].next = sched_free;
+    sched_free = idx;
+    sched_completed++;
+}
+
+static void sched_handle_cancels(void) {
+    bool cancel_all = (sched_cancel_all_gen != sched_seen_cancel_all_gen);
+    sched_seen_cancel_all_gen = sched_cancel_all_gen;
+
+    uint8_t cancelled = 0;  // a bit for each output
+    for (uint8_t out = 0; out <= OUT_5V; out++) {
+        if (!cancel_all && (sched_cancel_gen[out] == sched_seen_cancel_gen[out])) {
+            continue;
+        }
+        sched_seen_cancel_gen[out] = sched_cancel_gen[out];
+        cancelled |= 1 << out;
+    }
+    if (cancelled == 0) {
+        return;
+    }
+
+    // Free the cancelled actions now, so the host can schedule more straight away
+    for (uint8_t slot = 0; slot < SCHED_WHEEL_SLOTS; slot++) {
+        uint8_t* link = &sched_wheel[slot];
+        while (*link != SCHED_NONE) {
+            uint8_t idx = *link;
+            if (cancelled & (1 << sched_actions[idx].out)) {
+                *link = sched_actions[idx].next;
+                sched_complete(idx);
+            } else {
+                link = &sched_actions[idx].next;
+            }
+        }
+    }
+}
+
+static void sched_handle_request(const sched_request_t* request) {
+    if (
+        (request->cancel_gen != sched_cancel_gen[request->out])
+        || (request->cancel_all_gen != sched_cancel_all_gen)
+    ) {
+        // Cancelled while waiting in the queue
+        sched_completed++;
+        return;
+    }
+
+    if ((int32_t)(request->due - uptime_ms) <= 0) {
+        // Already due, possibly waiting in the queue for this tick
+        sched_run(request->out, request->state);
+        sched_completed++;
+        return;
+    }
+
+    // There is always a free action, the main loop limits what's outstanding
+    uint8_t idx = sched_free;
+    sched_free = sched_actions[idx].next;
+
+    uint8_t slot = request->due & (SCHED_WHEEL_SLOTS - 1);
+    sched_actions[idx].due = request->due;
+    sched_actions[idx].out = request->out;
+    sched_actions[idx].state = request->state;
+    sched_actions[idx].next = sched_wheel[slot];
+    sched_wheel[slot] = idx;
+}
+
+void sched_tick(void) {
+    sched_handle_cancels();
+
+    while (sched_request_tail != sched_request_head) {
+        sched_handle_request(&sched_requests[sched_request_tail]);
+        compiler_barrier();  // read the request before releasing its slot
+        sched_request_tail = (sched_request_tail + 1) & (SCHED_REQUEST_QUEUE_LEN - 1);
+    }
+
+    // Run the actions due now, others in this slot are due on a later turn of the wheel
+    uint8_t* link = &sched_wheel[uptime_ms & (SCHED_WHEEL_SLOTS - 1)];
+    while (*link != SCHED_NONE) {
+        uint8_t idx = *link;
+        sched_action_t* action = &sched_actions[idx];
+
+        if (action->due != uptime_ms) {
+            link = &action->next;
+            continue;
+        }
+
+        *link = action->next;
+        sched_run(action->out, action->state);
+        sched_complete(idx);
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "output.h"
+
+// Outstanding output changes that can be scheduled at once
+#define SCHED_MAX_ACTIONS 16
+// Passed to sched_cancel to cancel the changes to every output
+#define SCHED_ALL_OUTPUTS 0xff
+
+#ifdef FEATURE_SCHED
+void sched_init(void);
+#else
+static inline void sched_init(void) {}
+#endif
+
+// Schedule an output change for the given uptime in ms, returns false if
+// too many changes are outstanding. Only to be called from the main loop.
+bool sched_output(output_t out, bool state, uint32_t due);
+// Whether count more changes can be scheduled
+bool sched_available(uint8_t count);
+
+#ifdef FEATURE_SCHED
+// Cancel the outstanding changes to an output. Only to be called from the main loop.
+void sched_cancel(uint8_t out);
+// Only to be called from the systick handler, after uptime_ms is updated
+void sched_tick(void);
+#else
+static inline void sched_cancel(uint8_t out) {(void)out;}
+static inline void sched_tick(void) {}
+#endif
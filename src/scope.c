@@ -0,0 +1,111 @@
+#include "scope.h"
+#include "global_vars.h"
+#include "output.h"
+
+// Prevent the compiler moving memory accesses across this point
+#define compiler_barrier() __asm__ volatile("" ::: "memory")
+
+// Written by the systick handler until the capture is done
+static uint16_t scope_buf[SCOPE_LEN];
+static uint16_t scope_head = 0;
+static uint16_t scope_filled = 0;
+static uint16_t scope_remaining = 0;
+static uint16_t scope_last = 0;
+static uint32_t scope_trigger_at = 0;
+
+// Written by the main loop while the scope is idle
+static volatile scope_state_t scope_state = SCOPE_IDLE;
+static uint8_t scope_src = 0;
+static uint16_t scope_threshold = 0;
+static uint16_t scope_pre = 0;
+
+bool scope_arm(uint8_t source, uint16_t threshold, uint16_t pre_trigger) {
+    if ((source >= SCOPE_NUM_SOURCES) || (pre_trigger >= SCOPE_LEN)) {
+        return false;
+    }
+    // Stop sampling while the capture is reset
+    scope_state = SCOPE_IDLE;
+    compiler_barrier();
+    scope_src = source;
+    scope_threshold = threshold;
+    scope_pre = pre_trigger;
+    scope_head = 0;
+    scope_filled = 0;
+    scope_trigger_at = 0;
+    // Don't trigger on the first sample
+    scope_last = UINT16_MAX;
+    compiler_barrier();
+    scope_state = SCOPE_ARMED;
+    return true;
+}
+
+void scope_stop(void) {
+    if (scope_state != SCOPE_DONE) {
+        scope_state = SCOPE_IDLE;
+    }
+}
+
+uint16_t scope_read(uint16_t offset, uint16_t* samples, uint16_t count) {
+    if ((scope_state != SCOPE_DONE) || (offset >= SCOPE_LEN)) {
+        return 0;
+    }
+    if (count > (SCOPE_LEN - offset)) {
+        count = SCOPE_LEN - offset;
+    }
+    // The ring is full once done, so the oldest sample is at the head
+    for (uint16_t i = 0; i < count; i++) {
+        samples[i] = scope_buf[(scope_head + offset + i) % SCOPE_LEN];
+    }
+    return count;
+}
+
+scope_state_t scope_get_state(void) {
+    return scope_state;
+}
+
+uint8_t scope_source(void) {
+    return scope_src;
+}
+
+uint16_t scope_pre_trigger(void) {
+    return scope_pre;
+}
+
+uint32_t scope_trigger_time(void) {
+    return scope_trigger_at;
+}
+
+uint8_t scope_interval(uint8_t source) {
+    // Outputs are measured in turn each ms, in 4 phases, the 5V regulator
+    // and the battery with the INA219s every 20ms
+    if ((source == OUT_5V) || (source == SCOPE_SOURCE_BATT)) {
+        return 20;
+    }
+    return 4;
+}
+
+void scope_sample(uint8_t source, uint16_t value) {
+    scope_state_t state = scope_state;
+    if (((state != SCOPE_ARMED) && (state != SCOPE_TRIGGERED)) || (source != scope_src)) {
+        return;
+    }
+
+    scope_buf[scope_head] = value;
+    scope_head = (scope_head + 1) % SCOPE_LEN;
+    if (scope_filled < SCOPE_LEN) {
+        scope_filled++;
+    }
+
+    if (state == SCOPE_ARMED) {
+        // Wait for the pre-trigger samples before the trigger sample
+        if ((scope_filled > scope_pre) && (scope_last < scope_threshold)
+                && (value >= scope_threshold)) {
+            scope_trigger_at = uptime_ms;
+            scope_remaining = SCOPE_LEN - scope_pre - 1;
+            scope_state = (scope_remaining == 0)?SCOPE_DONE:SCOPE_TRIGGERED;
+        }
+    } else if (--scope_remaining == 0) {
+        scope_state = SCOPE_DONE;
+    }
+    scope_last = value;
+}
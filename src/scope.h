@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Waveform capture of one current channel. Once armed, samples are kept in a
+// ring until one crosses the threshold upwards, then the capture continues
+// until the ring holds the chosen number of samples before the trigger and
+// the rest after it.
+
+#define SCOPE_LEN 256
+// Sources are the outputs in output_t order, then the battery
+#define SCOPE_SOURCE_BATT 7
+#define SCOPE_NUM_SOURCES 8
+
+typedef enum {
+    SCOPE_IDLE,
+    SCOPE_ARMED,
+    SCOPE_TRIGGERED,
+    SCOPE_DONE,
+} scope_state_t;
+
+// Only to be called from the main loop
+bool scope_arm(uint8_t source, uint16_t threshold, uint16_t pre_trigger);
+void scope_stop(void);
+// Copy samples in time order, returns the number copied. Only valid once done.
+uint16_t scope_read(uint16_t offset, uint16_t* samples, uint16_t count);
+
+scope_state_t scope_get_state(void);
+uint8_t scope_source(void);
+uint16_t scope_pre_trigger(void);
+uint32_t scope_trigger_time(void);
+// Time between samples of the source in ms
+uint8_t scope_interval(uint8_t source);
+
+// Only to be called from the systick handler with each new measurement
+#ifdef FEATURE_SCOPE
+void scope_sample(uint8_t source, uint16_t value);
+#else
+static inline void scope_sample(uint8_t source, uint16_t value) {(void)source; (void)value;}
+#endif
@@ -0,0 +1,113 @@
+#include "soc.h"
+
+// Resting voltage of a 3S LiPo against charge, increasing voltage
+typedef struct {
+    uint16_t voltage;  // mV
+    uint8_t soc;  // percent
+} soc_point_t;
+
+static const soc_point_t SOC_CURVE[] = {
+    {9900, 0},
+    {10800, 5},
+    {11100, 10},
+    {11400, 20},
+    {11550, 30},
+    {11650, 40},
+    {11760, 50},
+    {11880, 60},
+    {12000, 70},
+    {12150, 80},
+    {12330, 90},
+    {12600, 100},
+};
+#define SOC_CURVE_LEN (sizeof(SOC_CURVE) / sizeof(SOC_CURVE[0]))
+
+// Filters are first-order, updated every 20ms
+#define OCV_FILTER_SHIFT 5  // ~0.6s
+#define RINT_FILTER_SHIFT 3  // over 8 load steps
+#define CURRENT_FILTER_SHIFT 8  // ~5s
+
+volatile bool soc_uvlo_compensated = false;
+volatile uint16_t soc_capacity = SOC_CAPACITY_DEFAULT;
+
+static bool soc_started = false;
+static int16_t last_voltage;
+static int32_t last_current;
+// Filter states, scaled by their shift
+static int32_t rint_filtered = (int32_t)SOC_RINT_DEFAULT << RINT_FILTER_SHIFT;
+static int32_t ocv_filtered;
+static int32_t current_filtered;
+
+static soc_state_t soc_state = {
+    .rint = SOC_RINT_DEFAULT,
+    .runtime = SOC_RUNTIME_UNKNOWN,
+};
+
+static uint8_t ocv_to_soc(int32_t ocv) {
+    if (ocv <= SOC_CURVE[0].voltage) {
+        return 0;
+    }
+    for (uint8_t i = 1; i < SOC_CURVE_LEN; i++) {
+        if (ocv < SOC_CURVE[i].voltage) {
+            // Interpolate between the points either side
+            const soc_point_t* lo = &SOC_CURVE[i - 1];
+            const soc_point_t* hi = &SOC_CURVE[i];
+            return lo->soc + ((ocv - lo->voltage) * (hi->soc - lo->soc))
+                / (hi->voltage - lo->voltage);
+        }
+    }
+    return 100;
+}
+
+static int32_t compensate(int16_t voltage, int32_t current) {
+    // Only discharge sags the voltage, charge current is ignored
+    if (current <= 0) {
+        return voltage;
+    }
+    return voltage + (current * soc_state.rint) / 1000;
+}
+
+void soc_update(int16_t voltage, int32_t current) {
+    if (!soc_started) {
+        ocv_filtered = compensate(voltage, current) << OCV_FILTER_SHIFT;
+        current_filtered = current << CURRENT_FILTER_SHIFT;
+        soc_started = true;
+    } else {
+        // A step in load moves the voltage by the step across the resistance
+        int32_t step = current - last_current;
+        if ((step >= SOC_RINT_MIN_STEP) || (step <= -SOC_RINT_MIN_STEP)) {
+            int32_t rint = ((int32_t)(last_voltage - voltage) * 1000) / step;
+            if ((rint >= SOC_RINT_MIN) && (rint <= SOC_RINT_MAX)) {
+                rint_filtered += rint - (rint_filtered >> RINT_FILTER_SHIFT);
+                soc_state.rint = rint_filtered >> RINT_FILTER_SHIFT;
+            }
+        }
+        ocv_filtered += compensate(voltage, current) - (ocv_filtered >> OCV_FILTER_SHIFT);
+        current_filtered += current - (current_filtered >> CURRENT_FILTER_SHIFT);
+    }
+    last_voltage = voltage;
+    last_current = current;
+
+    int32_t ocv = ocv_filtered >> OCV_FILTER_SHIFT;
+    soc_state.ocv = (ocv < 0)?0:ocv;
+    soc_state.soc = ocv_to_soc(ocv);
+
+    int32_t average = current_filtered >> CURRENT_FILTER_SHIFT;
+    if (average < SOC_RUNTIME_MIN_CURRENT) {
+        soc_state.runtime = SOC_RUNTIME_UNKNOWN;
+    } else {
+        // Remaining mAh over mA, in minutes
+        soc_state.runtime = ((int32_t)soc_state.soc * soc_capacity * 60) / (100 * average);
+    }
+}
+
+void soc_get(soc_state_t* state) {
+    *state = soc_state;
+}
+
+int16_t soc_uvlo_voltage(int16_t voltage) {
+    if (!soc_uvlo_compensated || !soc_started || (voltage < SOC_UVLO_RAW_MIN)) {
+        return voltage;
+    }
+    return soc_state.ocv;
+}
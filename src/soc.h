@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Battery state of charge, estimated from the battery sense measurements
+
+// Load steps smaller than this don't give a usable resistance estimate, mA
+#define SOC_RINT_MIN_STEP 1000
+// Bounds on the internal resistance estimate, mOhm
+#define SOC_RINT_MIN 5
+#define SOC_RINT_MAX 500
+#define SOC_RINT_DEFAULT 50
+#define SOC_CAPACITY_DEFAULT 2200  // mAh
+// Below this draw the runtime isn't estimated, mA
+#define SOC_RUNTIME_MIN_CURRENT 100
+#define SOC_RUNTIME_UNKNOWN -1
+// Below this measured voltage UVLO ignores the compensation, mV
+#define SOC_UVLO_RAW_MIN 9000
+
+typedef struct {
+    uint16_t ocv;  // open-circuit voltage with the load's sag removed, mV
+    uint16_t rint;  // internal resistance, mOhm
+    uint8_t soc;  // percent
+    int32_t runtime;  // minutes at the average draw, or SOC_RUNTIME_UNKNOWN
+} soc_state_t;
+
+// Compensate the UVLO voltage for sag under load
+extern volatile bool soc_uvlo_compensated;
+extern volatile uint16_t soc_capacity;  // mAh
+
+// Only to be called from the systick handler, the host reads it from the telemetry frame
+void soc_get(soc_state_t* state);
+
+// Only to be called from the systick handler, soc_update with each battery
+// measurement and soc_uvlo_voltage for the voltage UVLO compares against
+#ifdef FEATURE_SOC
+void soc_update(int16_t voltage, int32_t current);
+int16_t soc_uvlo_voltage(int16_t voltage);
+#else
+static inline void soc_update(int16_t voltage, int32_t current) {(void)voltage; (void)current;}
+static inline int16_t soc_uvlo_voltage(int16_t voltage) {return voltage;}
+#endif
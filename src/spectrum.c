@@ -0,0 +1,326 @@
+#include "spectrum.h"
+#include "global_vars.h"
+#include "output.h"
+
+// Prevent the compiler moving memory accesses across this point
+#define compiler_barrier() __asm__ volatile("" ::: "memory")
+
+// Bins filtered each time the main loop polls, so USB isn't held up
+#define SPECTRUM_BINS_PER_POLL 4
+// Band powers are held >> this, so the bands of a full scale block fit 32 bits
+#define SPECTRUM_BAND_SHIFT 10
+
+// cos(2*pi*i/SPECTRUM_LEN) in q15 for the first quarter turn
+static const int16_t COS_Q15[SPECTRUM_LEN / 4 + 1] = {
+    32767, 32728, 32609, 32412, 32137, 31785, 31356, 30852,
+    30273, 29621, 28898, 28105, 27245, 26319, 25329, 24279,
+    23170, 22005, 20787, 19519, 18204, 16846, 15446, 14010,
+    12539, 11039, 9512, 7962, 6393, 4808, 3212, 1608,
+    0,
+};
+
+// Written by the systick handler while capturing. Once computing, the main
+// loop replaces the samples with the windowed q15 block.
+static uint16_t spec_buf[SPECTRUM_LEN];
+static uint16_t spec_fill = 0;
+static uint32_t spec_acc = 0;
+static uint8_t spec_acc_count = 0;
+static uint32_t spec_end = 0;
+
+// Written by the main loop while not capturing
+static volatile spectrum_state_t spec_state = SPECTRUM_IDLE;
+static uint8_t spec_src = 0;
+static uint8_t spec_decimate = 1;
+
+// Main loop only
+static uint8_t spec_bin = 0;  // next bin to filter, 0 before the block is prepared
+static int8_t spec_shift = 0;  // the block is scaled up by 2^spec_shift
+static uint16_t spec_mean = 0;
+static uint32_t spec_mag[SPECTRUM_BINS];  // sqrt of each bin's power
+static uint32_t spec_band_power[SPECTRUM_BANDS];  // >> SPECTRUM_BAND_SHIFT
+static uint32_t spec_count = 0;
+static spectrum_result_t spec_result = {0};
+
+static int16_t cos_q15(uint8_t i) {
+    i %= SPECTRUM_LEN;
+    if (i <= SPECTRUM_LEN / 4) {
+        return COS_Q15[i];
+    } else if (i <= SPECTRUM_LEN / 2) {
+        return -COS_Q15[SPECTRUM_LEN / 2 - i];
+    } else if (i <= SPECTRUM_LEN * 3 / 4) {
+        return -COS_Q15[i - SPECTRUM_LEN / 2];
+    }
+    return COS_Q15[SPECTRUM_LEN - i];
+}
+
+static uint32_t isqrt32(uint32_t value) {
+    uint32_t result = 0;
+    uint32_t bit = 1UL << 30;
+    while (bit > value) {
+        bit >>= 2;
+    }
+    while (bit != 0) {
+        if (value >= result + bit) {
+            value -= result + bit;
+            result = (result >> 1) + bit;
+        } else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+    return result;
+}
+
+// Undo the block's scaling, saturating to mA
+static uint16_t to_ma(uint32_t value) {
+    if (spec_shift >= 0) {
+        value >>= spec_shift;
+    } else if (value > (uint32_t)(UINT16_MAX >> -spec_shift)) {
+        return UINT16_MAX;
+    } else {
+        value <<= -spec_shift;
+    }
+    return (value > UINT16_MAX)?UINT16_MAX:value;
+}
+
+static uint8_t bin_band(uint8_t bin) {
+    uint8_t band = 0;
+    while ((2 << band) <= bin) {
+        band++;
+    }
+    return band;
+}
+
+bool spectrum_start(uint8_t source, uint8_t decimate) {
+    if ((source >= SPECTRUM_NUM_SOURCES) || (decimate == 0)
+            || (decimate > SPECTRUM_MAX_DECIMATE)) {
+        return false;
+    }
+    // Stop sampling while the capture is reset
+    spec_state = SPECTRUM_IDLE;
+    compiler_barrier();
+    spec_src = source;
+    spec_decimate = decimate;
+    spec_fill = 0;
+    spec_acc = 0;
+    spec_acc_count = 0;
+    spec_bin = 0;
+    spec_count = 0;
+    compiler_barrier();
+    spec_state = SPECTRUM_CAPTURING;
+    return true;
+}
+
+void spectrum_stop(void) {
+    spec_state = SPECTRUM_IDLE;
+}
+
+// Remove the mean, scale the block to use most of q15 and apply a Hann window
+static void prepare_block(void) {
+    uint32_t sum = 0;
+    for (uint16_t n = 0; n < SPECTRUM_LEN; n++) {
+        sum += spec_buf[n];
+    }
+    spec_mean = sum / SPECTRUM_LEN;
+
+    uint32_t max_dev = 0;
+    for (uint16_t n = 0; n < SPECTRUM_LEN; n++) {
+        int32_t dev = (int32_t)spec_buf[n] - spec_mean;
+        uint32_t abs_dev = (dev < 0)?-dev:dev;
+        if (abs_dev > max_dev) {
+            max_dev = abs_dev;
+        }
+    }
+    spec_shift = 0;
+    while (max_dev >= (1 << 14)) {
+        max_dev >>= 1;
+        spec_shift--;
+    }
+    while ((max_dev != 0) && (max_dev < (1 << 13))) {
+        max_dev <<= 1;
+        spec_shift++;
+    }
+
+    // The same storage, now holding signed samples
+    int16_t* x = (int16_t*)spec_buf;
+    for (uint16_t n = 0; n < SPECTRUM_LEN; n++) {
+        int32_t dev = (int32_t)spec_buf[n] - spec_mean;
+        dev = (spec_shift >= 0)?(dev << spec_shift):(dev >> -spec_shift);
+        int32_t window = (32767 - cos_q15(n)) >> 1;
+        x[n] = (dev * window) >> 15;
+    }
+
+    for (uint8_t band = 0; band < SPECTRUM_BANDS; band++) {
+        spec_band_power[band] = 0;
+    }
+    spec_mag[0] = 0;
+}
+
+static void filter_bin(uint8_t bin) {
+    const int16_t* x = (const int16_t*)spec_buf;
+    // 2cos(w) in q14 has the same value as cos(w) in q15
+    int32_t coeff = cos_q15(bin);
+    int32_t s1 = 0;
+    int32_t s2 = 0;
+    for (uint16_t n = 0; n < SPECTRUM_LEN; n++) {
+        int32_t s0 = x[n] + (int32_t)(((int64_t)coeff * s1) >> 14) - s2;
+        s2 = s1;
+        s1 = s0;
+    }
+    // Scale the state down until the power fits 32 bits. Its terms are each
+    // below 2^29, and the power, |X|^2, is shifted up again afterwards.
+    uint8_t shift = 0;
+    while ((s1 >= (1 << 14)) || (s1 <= -(1 << 14)) || (s2 >= (1 << 14)) || (s2 <= -(1 << 14))) {
+        s1 >>= 1;
+        s2 >>= 1;
+        shift++;
+    }
+    int32_t power = s1 * s1 + s2 * s2 - ((coeff * s1) >> 14) * s2;
+    if (power < 0) {
+        power = 0;
+    }
+    spec_mag[bin] = isqrt32(power) << shift;
+    // The windowed block is below 2^14, so the bands sum to less than 2^41
+    if ((2 * shift) >= SPECTRUM_BAND_SHIFT) {
+        spec_band_power[bin_band(bin)] += (uint32_t)power << (2 * shift - SPECTRUM_BAND_SHIFT);
+    } else {
+        spec_band_power[bin_band(bin)] += (uint32_t)power >> (SPECTRUM_BAND_SHIFT - 2 * shift);
+    }
+}
+
+// Frequency of a peak in 0.01Hz, interpolated between bins
+static uint16_t peak_frequency(uint8_t bin) {
+    int32_t offset = 0;  // 1/256 bins
+    if (bin < (SPECTRUM_BINS - 1)) {
+        uint32_t a = spec_mag[bin - 1];
+        uint32_t b = spec_mag[bin];
+        uint32_t c = spec_mag[bin + 1];
+        while (b >= (1 << 22)) {
+            a >>= 1;
+            b >>= 1;
+            c >>= 1;
+        }
+        int32_t denom = 2 * (int32_t)b - (int32_t)a - (int32_t)c;
+        if (denom > 0) {
+            offset = ((int32_t)c - (int32_t)a) * 128 / denom;
+        }
+    }
+    uint32_t freq = ((uint32_t)bin * 256 + offset) * 100000
+        / (256UL * SPECTRUM_LEN * spectrum_interval());
+    return (freq > UINT16_MAX)?UINT16_MAX:freq;
+}
+
+// The rms of the components making up a band power, mA
+static uint16_t power_rms(uint32_t power) {
+    // sqrt(2 * power / 0.375) / SPECTRUM_LEN, the Hann window keeps 0.375 of the
+    // power, and the band power's shift halves through the sqrt
+    return to_ma((isqrt32(power) * 37837) >> (21 - SPECTRUM_BAND_SHIFT / 2));
+}
+
+static void finish_block(void) {
+    spectrum_result_t* result = &spec_result;
+    result->timestamp = spec_end;
+    result->mean = spec_mean;
+
+    uint32_t total = 0;
+    for (uint8_t band = 0; band < SPECTRUM_BANDS; band++) {
+        result->band_rms[band] = power_rms(spec_band_power[band]);
+        total += spec_band_power[band];
+    }
+    result->rms = power_rms(total);
+
+    // Keep the largest local maxima
+    uint8_t peak_bin[SPECTRUM_PEAKS] = {0};
+    for (uint8_t bin = 1; bin < SPECTRUM_BINS; bin++) {
+        uint32_t mag = spec_mag[bin];
+        if ((mag == 0) || (mag <= spec_mag[bin - 1])
+                || ((bin < (SPECTRUM_BINS - 1)) && (mag < spec_mag[bin + 1]))) {
+            continue;
+        }
+        for (uint8_t i = 0; i < SPECTRUM_PEAKS; i++) {
+            if ((peak_bin[i] == 0) || (mag > spec_mag[peak_bin[i]])) {
+                for (uint8_t j = SPECTRUM_PEAKS - 1; j > i; j--) {
+                    peak_bin[j] = peak_bin[j - 1];
+                }
+                peak_bin[i] = bin;
+                break;
+            }
+        }
+    }
+    for (uint8_t i = 0; i < SPECTRUM_PEAKS; i++) {
+        if (peak_bin[i] == 0) {
+            result->peak_freq[i] = 0;
+            result->peak_amp[i] = 0;
+            continue;
+        }
+        result->peak_freq[i] = peak_frequency(peak_bin[i]);
+        // A sine's amplitude is 4 * magnitude / SPECTRUM_LEN through the window
+        result->peak_amp[i] = to_ma(spec_mag[peak_bin[i]] >> 5);
+    }
+    spec_count++;
+}
+
+void spectrum_poll(void) {
+    if (spec_state != SPECTRUM_COMPUTING) {
+        return;
+    }
+    if (spec_bin == 0) {
+        prepare_block();
+        spec_bin = 1;
+    }
+    for (uint8_t i = 0; (i < SPECTRUM_BINS_PER_POLL) && (spec_bin < SPECTRUM_BINS); i++) {
+        filter_bin(spec_bin++);
+    }
+    if (spec_bin < SPECTRUM_BINS) {
+        return;
+    }
+    finish_block();
+
+    // Collect the next block
+    spec_bin = 0;
+    spec_fill = 0;
+    spec_acc = 0;
+    spec_acc_count = 0;
+    compiler_barrier();
+    spec_state = SPECTRUM_CAPTURING;
+}
+
+spectrum_state_t spectrum_get_state(void) {
+    return spec_state;
+}
+
+uint8_t spectrum_source(void) {
+    return spec_src;
+}
+
+uint16_t spectrum_interval(void) {
+    // Outputs are measured in turn each ms, in 4 phases, the 5V regulator
+    // and the battery every 20ms
+    uint16_t interval = ((spec_src == OUT_5V) || (spec_src == SPECTRUM_SOURCE_BATT))?20:4;
+    return interval * spec_decimate;
+}
+
+uint32_t spectrum_blocks(void) {
+    return spec_count;
+}
+
+const spectrum_result_t* spectrum_result(void) {
+    return &spec_result;
+}
+
+void spectrum_sample(uint8_t source, uint16_t value) {
+    if ((spec_state != SPECTRUM_CAPTURING) || (source != spec_src)) {
+        return;
+    }
+    spec_acc += value;
+    if (++spec_acc_count < spec_decimate) {
+        return;
+    }
+    spec_buf[spec_fill] = spec_acc / spec_decimate;
+    spec_acc = 0;
+    spec_acc_count = 0;
+    if (++spec_fill == SPECTRUM_LEN) {
+        spec_end = uptime_ms;
+        spec_state = SPECTRUM_COMPUTING;
+    }
+}
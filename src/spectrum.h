@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Spectral analysis of one current channel. The systick handler collects
+// blocks of samples, then the main loop windows each block and runs a
+// fixed-point Goertzel filter for every bin, a few bins each pass, before
+// collecting the next block.
+
+#define SPECTRUM_LEN 128  // samples in each block
+#define SPECTRUM_BINS (SPECTRUM_LEN / 2)
+// Sources are numbered as for the scope, the outputs then the battery
+#define SPECTRUM_SOURCE_BATT 7
+#define SPECTRUM_NUM_SOURCES 8
+#define SPECTRUM_MAX_DECIMATE 16
+#define SPECTRUM_PEAKS 3
+// Octave bands of bins 1, 2-3, 4-7, ... 32-63
+#define SPECTRUM_BANDS 6
+
+typedef enum {
+    SPECTRUM_IDLE,
+    SPECTRUM_CAPTURING,
+    SPECTRUM_COMPUTING,
+} spectrum_state_t;
+
+typedef struct {
+    uint32_t timestamp;  // uptime at the end of the block
+    uint16_t mean;  // mA
+    uint16_t rms;  // of everything but the mean, mA
+    // Largest peaks first, 0.01Hz and mA amplitude, 0 where there are fewer
+    uint16_t peak_freq[SPECTRUM_PEAKS];
+    uint16_t peak_amp[SPECTRUM_PEAKS];
+    uint16_t band_rms[SPECTRUM_BANDS];  // mA
+} spectrum_result_t;
+
+// Only to be called from the main loop
+// Each stored sample is the average of decimate measurements
+bool spectrum_start(uint8_t source, uint8_t decimate);
+void spectrum_stop(void);
+#ifdef FEATURE_SPECTRUM
+void spectrum_poll(void);
+#else
+static inline void spectrum_poll(void) {}
+#endif
+
+spectrum_state_t spectrum_get_state(void);
+uint8_t spectrum_source(void);
+// Time between stored samples in ms
+uint16_t spectrum_interval(void);
+// Blocks analysed since started, the result is only valid once non-zero
+uint32_t spectrum_blocks(void);
+const spectrum_result_t* spectrum_result(void);
+
+// Only to be called from the systick handler with each new measurement
+#ifdef FEATURE_SPECTRUM
+void spectrum_sample(uint8_t source, uint16_t value);
+#else
+static inline void spectrum_sample(uint8_t source, uint16_t value) {(void)source; (void)value;}
+#endif
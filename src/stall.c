@@ -0,0 +1,122 @@
+#include "stall.h"
+#include "global_vars.h"
+#include "events.h"
+
+// Prevent the compiler moving memory accesses across this point
+#define compiler_barrier() __asm__ volatile("" ::: "memory")
+
+typedef struct {
+    uint16_t window_min[STALL_WINDOW_PARTS];  // mA
+    uint8_t window_part;
+    uint16_t part_time;  // ms into the current part
+    uint16_t base;  // lowest current before the step, mA
+    uint16_t step_held;  // ms, 0 while no step is seen
+    uint16_t plateau_held;  // ms
+    volatile stall_reason_t reason;
+    uint32_t since;
+} stall_state_t;
+
+static stall_config_t stall_config[7] = {0};
+static stall_state_t stall_state[7] = {0};
+
+bool stall_set_config(output_t out, const stall_config_t* config) {
+    if (((config->rise != 0) && (config->rise_time == 0)) || (config->plateau > 100)
+            || (((config->rise != 0) || (config->plateau != 0)) && (config->hold == 0))) {
+        return false;
+    }
+    // Stop detecting while the config is changed
+    stall_config[out].rise = 0;
+    stall_config[out].plateau = 0;
+    compiler_barrier();
+    stall_state[out].step_held = 0;
+    stall_state[out].plateau_held = 0;
+    compiler_barrier();
+    stall_config[out] = *config;
+    return true;
+}
+
+void stall_get_config(output_t out, stall_config_t* config) {
+    *config = stall_config[out];
+}
+
+stall_reason_t stall_get_state(output_t out, uint32_t* since) {
+    stall_reason_t reason = stall_state[out].reason;
+    *since = (reason != STALL_NONE)?stall_state[out].since:0;
+    return reason;
+}
+
+// Called every ms
+void stall_tick(void) {
+    for (output_t out=OUT_H0; out <= OUT_5V; out++) {
+        const stall_config_t* config = &stall_config[out];
+        stall_state_t* state = &stall_state[out];
+        uint16_t draw = output_draw(out);
+
+        // Track the lowest current over the rise time
+        uint16_t part_len = config->rise_time / STALL_WINDOW_PARTS;
+        if (++state->part_time >= part_len) {
+            state->window_part = (state->window_part + 1) % STALL_WINDOW_PARTS;
+            state->window_min[state->window_part] = draw;
+            state->part_time = 0;
+        } else if (draw < state->window_min[state->window_part]) {
+            state->window_min[state->window_part] = draw;
+        }
+        uint16_t floor = draw;
+        for (uint8_t i = 0; i < STALL_WINDOW_PARTS; i++) {
+            if (state->window_min[i] < floor) {
+                floor = state->window_min[i];
+            }
+        }
+
+        bool step = false;
+        if (config->rise != 0) {
+            if (state->step_held == 0) {
+                // The current has risen by the step within the rise time
+                if ((draw - floor) >= config->rise) {
+                    state->base = floor;
+                    state->step_held = 1;
+                }
+            } else if (draw >= (state->base + config->rise / 2)) {
+                if (state->step_held < UINT16_MAX) {
+                    state->step_held++;
+                }
+            } else {
+                state->step_held = 0;
+            }
+            step = state->step_held != 0;
+        }
+
+        bool plateau = false;
+        if (config->plateau != 0) {
+            uint8_t percent = config->plateau;
+            if ((state->reason == STALL_PLATEAU) && (percent > STALL_PLATEAU_HYSTERESIS)) {
+                percent -= STALL_PLATEAU_HYSTERESIS;
+            }
+            if (((uint32_t)draw * 100) >= ((uint32_t)output_current_limit(out) * percent)) {
+                if (state->plateau_held < UINT16_MAX) {
+                    state->plateau_held++;
+                }
+                plateau = true;
+            } else {
+                state->plateau_held = 0;
+            }
+        }
+
+        if (state->reason == STALL_NONE) {
+            stall_reason_t reason = STALL_NONE;
+            if (plateau && (state->plateau_held >= config->hold)) {
+                reason = STALL_PLATEAU;
+            } else if (step && (state->step_held >= config->hold)) {
+                reason = STALL_STEP;
+            }
+            if (reason != STALL_NONE) {
+                state->since = uptime_ms;
+                state->reason = reason;
+                event_push(EVENT_STALL, out);
+            }
+        } else if (!((state->reason == STALL_STEP)?step:plateau)) {
+            state->reason = STALL_NONE;
+            event_push(EVENT_STALL_CLEAR, out);
+        }
+    }
+}
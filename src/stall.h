@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "output.h"
+
+// Detection of stalled motors and other load anomalies before the overcurrent
+// limit trips. An output is flagged when its current steps up faster than a
+// set rate and stays up, or when it sits close to its limit, for a hold time.
+
+// The step's rise is measured from the lowest current over about rise_time,
+// kept as the minimums of this many parts of it
+#define STALL_WINDOW_PARTS 4
+// Below the threshold that flagged a plateau that clears it, percent of the limit
+#define STALL_PLATEAU_HYSTERESIS 5
+
+typedef struct {
+    uint16_t rise;  // mA, 0 disables step detection
+    uint16_t rise_time;  // ms the rise has to happen within, 1-65535
+    uint16_t hold;  // ms either condition has to last
+    uint8_t plateau;  // percent of the output's current limit, 0 disables plateau detection
+} stall_config_t;
+
+typedef enum {
+    STALL_NONE,
+    STALL_STEP,
+    STALL_PLATEAU,
+} stall_reason_t;
+
+bool stall_set_config(output_t out, const stall_config_t* config);
+void stall_get_config(output_t out, stall_config_t* config);
+// Why the output is flagged and the uptime in ms it was flagged
+stall_reason_t stall_get_state(output_t out, uint32_t* since);
+
+// Only to be called from the systick handler, every ms after the currents are checked
+#ifdef FEATURE_STALL
+void stall_tick(void);
+#else
+static inline void stall_tick(void) {}
+#endif
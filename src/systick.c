@@ -7,10 +7,23 @@
 #include "button.h"
 #include "led.h"
 #include "buzzer.h"
+#include "telemetry.h"
+#include "events.h"
+#include "sched.h"
+#include "macro.h"
+#include "soc.h"
+#include "admit.h"
+#include "reclose.h"
+#include "stall.h"
+#include "scope.h"
+#include "spectrum.h"
+#include "rollup.h"
 
 #include <libopencm3/cm3/systick.h>
 #include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/dwt.h>
 
+volatile uint32_t uptime_ms = 0;
 volatile INA219_meas_t battery = {0};
 volatile INA219_meas_t reg_5v = {0};
 volatile int16_t board_temp = 0;
@@ -20,6 +33,20 @@ uint8_t systick_slow_tick = 0;
 uint16_t systick_temp_tick = 0;
 uint8_t current_phase = 0;
 
+// The temperature is sampled every slow tick, averaged over each second and
+// then filtered, so single noisy readings don't move the fan
+#define TEMP_FILTER_SHIFT 2
+uint32_t temp_adc_sum = 0;
+uint16_t temp_samples = 0;
+int32_t temp_filtered = 0;  // 0.1 degrees C << TEMP_FILTER_SHIFT
+bool temp_filter_ready = false;
+
+#define TICK_MEAN_SHIFT 6
+volatile uint32_t tick_cycles_max = 0;
+volatile uint32_t tick_cycles_slow_max = 0;
+volatile uint32_t tick_cycles_mean = 0;
+static uint32_t tick_cycles_filtered = 0;  // << TICK_MEAN_SHIFT
+
 void systick_init(void) {
     // Generate a 1ms systick interrupt
     // 72MHz / 8 => 9000000 counts per second
@@ -33,44 +60,101 @@ void systick_init(void) {
 
     // Start counting.
     systick_counter_enable();
+
+    // Count cycles to time the handler
+    dwt_enable_cycle_counter();
 }
 
-void sys_tick_handler(void) {
-    // Every 20 ms read values from INA219 current sensors
-    if (++systick_slow_tick == 20) {
-        // if watchdog tripped re-init INA219's
-        if (i2c_timed_out) {
-            // reset watchdog
-            reset_i2c_watchdog();
-            init_i2c_sensors(false);
+void systick_clear_cycles(void) {
+    tick_cycles_max = 0;
+    tick_cycles_slow_max = 0;
+}
+
+// The work done every 20ms and every 1s is kept out of line, so only the
+// per-ms hot path is placed in RAM with the handler
+static __attribute__((noinline)) void slow_tick_handler(void) {
+    // if watchdog tripped re-init INA219's
+    if (i2c_timed_out) {
+        // reset watchdog
+        reset_i2c_watchdog();
+        init_i2c_sensors(false);
+    }
+    // Read INA219's
+    battery = measure_current_sense(BATTERY_SENSE_ADDR);
+    battery.current *= 10;  // convert to 1mA LSB
+    reg_5v = measure_current_sense(REG_SENSE_ADDR);
+    admit_update();
+    if (reg_5v.success) {
+        scope_sample(OUT_5V, (reg_5v.current > 0)?reg_5v.current:0);
+        spectrum_sample(OUT_5V, (reg_5v.current > 0)?reg_5v.current:0);
+    }
+    if (battery.success) {
+        // Charge current reads as 0
+        uint16_t batt_current =
+            (battery.current < 0)?0:((battery.current > UINT16_MAX)?UINT16_MAX:battery.current);
+        scope_sample(SCOPE_SOURCE_BATT, batt_current);
+        spectrum_sample(SPECTRUM_SOURCE_BATT, batt_current);
+        soc_update(battery.voltage, battery.current);
+        macro_check_battery(battery.voltage);
+    }
+
+    temp_adc_sum += get_adc_measurement(TEMP_SENSE_CHANNEL);
+    temp_samples++;
+
+    // Check UVLO
+    handle_uvlo();
+
+    rollup_sample(temp_filtered >> TEMP_FILTER_SHIFT);
+}
+
+static __attribute__((noinline)) void temp_tick_handler(void) {
+    // Filter the second's temperature samples
+    if (temp_samples != 0) {
+        int16_t temp = adc_to_temp_x10(temp_adc_sum, temp_samples);
+        if (!temp_filter_ready) {
+            temp_filtered = (int32_t)temp << TEMP_FILTER_SHIFT;
+            temp_filter_ready = true;
+        } else {
+            temp_filtered += temp - (temp_filtered >> TEMP_FILTER_SHIFT);
         }
-        // Read INA219's
-        battery = measure_current_sense(BATTERY_SENSE_ADDR);
-        battery.current *= 10;  // convert to 1mA LSB
-        reg_5v = measure_current_sense(REG_SENSE_ADDR);
+        temp_adc_sum = 0;
+        temp_samples = 0;
+    }
+    int16_t temp_x10 = temp_filtered >> TEMP_FILTER_SHIFT;
+    board_temp = temp_x10 / 10;
 
-        // Check UVLO
-        handle_uvlo();
+    // Set fan
+    bool fan_was_running = fan_running();
+    fan_update(temp_x10, fan_override);
+    if (fan_running() != fan_was_running) {
+        event_push(EVENT_FAN, !fan_was_running);
+    }
+}
+
+RAMFUNC void sys_tick_handler(void) {
+    uint32_t start_cycles = dwt_read_cycle_counter();
+    bool slow_tick = false;
+    uptime_ms++;
+
+    // Run output changes scheduled for this ms
+    sched_tick();
+
+    // Every 20 ms read values from INA219 current sensors
+    if (++systick_slow_tick == 20) {
+        slow_tick = true;
+        slow_tick_handler();
         systick_slow_tick = 0;
     }
     // Every 1s read temp sensor
     if (++systick_temp_tick == 1000) {
-        // Read temp sense
-        board_temp = adc_to_temp(get_adc_measurement(TEMP_SENSE_CHANNEL));
-
-        // Set fan
-        if((board_temp > FAN_THRESHOLD )|| fan_override) {
-            fan_enable(true);
-        } else if (board_temp < FAN_THRESHOLD) {  // 2 degree hysteresis
-            fan_enable(false);
-        }
-
-        handle_led_flash();
+        temp_tick_handler();
         systick_temp_tick = 0;
     }
 
     buzzer_tick();
 
+    led_tick();
+
     sample_buttons();
 
     // Read next ADC phase
@@ -80,4 +164,22 @@ void sys_tick_handler(void) {
 
     // Check current limits
     detect_overcurrent();
+    reclose_tick();
+    stall_tick();
+
+    // Make this tick's measurements available to the USB handlers
+    telemetry_publish();
+
+    uint32_t cycles = dwt_read_cycle_counter() - start_cycles;
+    if (slow_tick) {
+        if (cycles > tick_cycles_slow_max) {
+            tick_cycles_slow_max = cycles;
+        }
+    } else {
+        if (cycles > tick_cycles_max) {
+            tick_cycles_max = cycles;
+        }
+        tick_cycles_filtered += cycles - (tick_cycles_filtered >> TICK_MEAN_SHIFT);
+        tick_cycles_mean = tick_cycles_filtered >> TICK_MEAN_SHIFT;
+    }
 }
@@ -1,3 +1,13 @@
 #pragma once
 
+#include <stdint.h>
+
+// Longest run of the systick handler in CPU cycles since cleared, for ticks
+// without and with the 20ms sensor reads, and the filtered mean of the former
+extern volatile uint32_t tick_cycles_max;
+extern volatile uint32_t tick_cycles_slow_max;
+extern volatile uint32_t tick_cycles_mean;
+
 void systick_init(void);
+// Only to be called from the main loop
+void systick_clear_cycles(void);
@@ -0,0 +1,48 @@
+#include "telemetry.h"
+#include "global_vars.h"
+#include "output.h"
+
+// Prevent the compiler moving memory accesses across this point
+#define compiler_barrier() __asm__ volatile("" ::: "memory")
+
+// Sequence counter for the frame, odd while the frame is being written
+static volatile uint32_t telemetry_seq = 0;
+static volatile telemetry_t telemetry_frame = {0};
+
+void telemetry_publish(void) {
+    telemetry_seq++;
+    compiler_barrier();
+
+    telemetry_frame.timestamp = uptime_ms;
+    telemetry_frame.battery = battery;
+    telemetry_frame.reg_5v = reg_5v;
+    for (output_t out=OUT_H0; out < OUT_5V; out++) {
+        telemetry_frame.output_current[out] = output_current[out];
+    }
+    telemetry_frame.board_temp = board_temp;
+#ifdef FEATURE_SOC
+    soc_state_t soc;
+    soc_get(&soc);
+    telemetry_frame.soc = soc;
+#endif
+#ifdef FEATURE_ADMIT
+    admit_state_t admit;
+    admit_get(&admit);
+    telemetry_frame.admit = admit;
+#endif
+
+    compiler_barrier();
+    telemetry_seq++;
+}
+
+void telemetry_read(telemetry_t* frame) {
+    uint32_t seq;
+    // The systick handler may publish a new frame part way through the copy,
+    // if it did the sequence number will have changed so take the copy again
+    do {
+        seq = telemetry_seq;
+        compiler_barrier();
+        *frame = telemetry_frame;
+        compiler_barrier();
+    } while ((seq & 1) || (seq != telemetry_seq));
+}
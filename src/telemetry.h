@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+#include "i2c.h"
+#include "soc.h"
+#include "admit.h"
+
+// A consistent copy of the measurements taken by the systick handler
+typedef struct {
+    uint32_t timestamp;  // uptime in ms when the frame was published
+    INA219_meas_t battery;
+    INA219_meas_t reg_5v;
+    uint16_t output_current[6];
+    int16_t board_temp;
+#ifdef FEATURE_SOC
+    soc_state_t soc;
+#endif
+#ifdef FEATURE_ADMIT
+    admit_state_t admit;
+#endif
+} telemetry_t;
+
+// Only to be called from the systick handler, once the tick's measurements are complete
+void telemetry_publish(void);
+// Copy out the latest frame, never blocks the systick handler
+void telemetry_read(telemetry_t* frame);
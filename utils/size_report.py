@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+"""Report the flash and RAM used by each module from a GNU ld map file
+
+Sections are counted against the memory regions of the map's memory
+configuration. Initialised data and code placed in RAM, in .ramtext, are
+counted in both flash and RAM, as they're copied from flash at startup.
+"""
+import os
+import re
+import sys
+import argparse
+from collections import defaultdict
+from typing import Dict, List, Tuple
+
+REGION_RE = re.compile(r'^(\w+)\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)')
+OUTPUT_RE = re.compile(r'^(\.\S+)\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)(?:\s+load address 0x([0-9a-f]+))?')
+INPUT_RE = re.compile(r'^ (\S+)\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S.*)$')
+INPUT_NAME_RE = re.compile(r'^ (\S+)$')
+INPUT_CONT_RE = re.compile(r'^\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S.*)$')
+
+
+def module_name(path: str) -> str:
+    # Archive members are given as path/lib.a(member.o)
+    if '(' in path:
+        archive, member = path.split('(', 1)
+        return f'{os.path.basename(archive)}({member}'
+    return os.path.basename(path)
+
+
+def parse_map(path: str) -> Tuple[Dict[str, Tuple[int, int]], Dict[str, Dict[str, int]]]:
+    regions: Dict[str, Tuple[int, int]] = {}
+    usage: Dict[str, Dict[str, int]] = defaultdict(lambda: defaultdict(int))
+
+    with open(path) as f:
+        lines = f.read().splitlines()
+
+    part = None
+    output_kind = None
+    pending = None
+    for line in lines:
+        if line.startswith('Memory Configuration'):
+            part = 'memory'
+            continue
+        if line.startswith('Linker script and memory map'):
+            part = 'map'
+            continue
+        if line.startswith('Cross Reference Table'):
+            break
+
+        if part == 'memory':
+            match = REGION_RE.match(line)
+            if match and match.group(1) != 'Name':
+                regions[match.group(1)] = (int(match.group(2), 16), int(match.group(3), 16))
+            continue
+        if part != 'map':
+            continue
+
+        match = OUTPUT_RE.match(line)
+        if match:
+            address = int(match.group(2), 16)
+            region = next(
+                (name for name, (origin, length) in regions.items() if origin <= address < origin + length),
+                None)
+            output_kind = (region, match.group(4) is not None)
+            pending = None
+            continue
+
+        match = INPUT_RE.match(line)
+        if match:
+            name, size, source = match.group(1), int(match.group(3), 16), match.group(4)
+        else:
+            match = INPUT_NAME_RE.match(line)
+            if match:
+                pending = match.group(1)
+                continue
+            match = INPUT_CONT_RE.match(line)
+            if not match or pending is None:
+                continue
+            name, size, source = pending, int(match.group(2), 16), match.group(3)
+        pending = None
+
+        if output_kind is None or output_kind[0] is None or size == 0 or name.startswith('*'):
+            continue
+        region, loaded = output_kind
+        module = usage[module_name(source.strip())]
+        module[region] += size
+        if loaded:
+            # Copied from flash at startup
+            module['rom'] += size
+        if name.startswith('.ramtext'):
+            module['ramtext'] += size
+
+    return regions, usage
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('map', help="Map file written by the linker, e.g. src/main.map")
+    parser.add_argument('-n', '--top', type=int, default=0, help="Only list the largest modules")
+    parser.add_argument('--sort', choices=('rom', 'ram'), default='rom', help="Region to sort by")
+
+    args = parser.parse_args()
+
+    try:
+        regions, usage = parse_map(args.map)
+    except OSError as e:
+        print(e, file=sys.stderr)
+        sys.exit(1)
+    if 'rom' not in regions or 'ram' not in regions:
+        print("No rom and ram regions in the map's memory configuration", file=sys.stderr)
+        sys.exit(1)
+
+    modules: List[Tuple[str, Dict[str, int]]] = sorted(
+        usage.items(), key=lambda item: item[1][args.sort], reverse=True)
+    if args.top:
+        modules = modules[:args.top]
+
+    width = max([len(name) for name, _ in modules] + [6])
+    print(f"{'module':<{width}} {'flash':>7} {'ram':>7} {'ramtext':>7}")
+    for name, sizes in modules:
+        print(f"{name:<{width}} {sizes['rom']:>7} {sizes['ram']:>7} {sizes['ramtext'] or '':>7}")
+
+    print()
+    for region in ('rom', 'ram'):
+        used = sum(sizes[region] for sizes in usage.values())
+        length = regions[region][1]
+        print(f"{region}: {used} of {length} bytes used, {length - used} free ({100 * used / length:.1f}%)")
+
+
+if __name__ == '__main__':
+    main()